@@ -25,10 +25,12 @@
 #ifndef GRATE_HOST1X_H
 #define GRATE_HOST1X_H 1
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef BIT
 #define BIT(x) (1 << (x))
@@ -63,12 +65,40 @@ void host1x_close(struct host1x *host1x);
 struct host1x_display *host1x_get_display(struct host1x *host1x);
 struct host1x_gr2d *host1x_get_gr2d(struct host1x *host1x);
 struct host1x_gr3d *host1x_get_gr3d(struct host1x *host1x);
+struct host1x_client *host1x_get_client(struct host1x *host1x,
+				       uint32_t class);
 
 int host1x_display_get_resolution(struct host1x_display *display,
 				  unsigned int *width, unsigned int *height);
 int host1x_display_set(struct host1x_display *display,
 		       struct host1x_framebuffer *fb, bool vsync);
 
+/*
+ * Timeline of a completed page flip, in microseconds of CLOCK_MONOTONIC.
+ * Rendering times are 0 if unknown, for example because no fence was
+ * attached to the framebuffer.
+ */
+struct host1x_flip {
+	struct host1x_framebuffer *fb;
+	unsigned int sequence;
+	/* rendering was submitted */
+	uint64_t submitted;
+	/* rendering completed */
+	uint64_t completed;
+	/* the flip was queued */
+	uint64_t queued;
+	/* scanout of the framebuffer started */
+	uint64_t timestamp;
+};
+
+int host1x_display_flip(struct host1x_display *display,
+			struct host1x_framebuffer *fb);
+bool host1x_display_flip_pending(struct host1x_display *display);
+int host1x_display_wait_flip(struct host1x_display *display, int timeout,
+			     struct host1x_flip *flip);
+void host1x_display_cancel_flip(struct host1x_display *display);
+int host1x_display_get_fd(struct host1x_display *display);
+
 int host1x_overlay_create(struct host1x_overlay **overlayp,
 			  struct host1x_display *display);
 int host1x_overlay_close(struct host1x_overlay *overlay);
@@ -82,8 +112,31 @@ struct host1x_bo *host1x_bo_create(struct host1x *host1x, size_t size,
 void host1x_bo_free(struct host1x_bo *bo);
 
 int host1x_bo_invalidate(struct host1x_bo *bo, loff_t offset, size_t length);
+void host1x_bo_mark_dirty(struct host1x_bo *bo, loff_t offset, size_t length);
 int host1x_bo_mmap(struct host1x_bo *bo, void **ptr);
 
+/*
+ * Buffer objects can be shared with other devices and processes as DMA-BUF
+ * file descriptors or, where those aren't supported, as global names.
+ */
+int host1x_bo_export_fd(struct host1x_bo *bo, int *fd);
+struct host1x_bo *host1x_bo_import_fd(struct host1x *host1x, int fd);
+int host1x_bo_export_name(struct host1x_bo *bo, uint32_t *name);
+struct host1x_bo *host1x_bo_import_name(struct host1x *host1x, uint32_t name);
+
+struct host1x_bo_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+
+	/* buffer objects currently held by the cache */
+	unsigned long num_bos;
+	size_t size;
+};
+
+void host1x_get_bo_cache_stats(struct host1x *host1x,
+			       struct host1x_bo_cache_stats *stats);
+
 #define HOST1X_OPCODE_SETCL(offset, classid, mask) \
 	((0x0 << 28) | (((offset) & 0xfff) << 16) | (((classid) & 0x3ff) << 6) | ((mask) & 0x3f))
 #define HOST1X_OPCODE_INCR(offset, count) \
@@ -97,69 +150,507 @@ int host1x_bo_mmap(struct host1x_bo *bo, void **ptr);
 #define HOST1X_OPCODE_EXTEND(subop, value) \
 	((0xe << 28) | (((subop) & 0xf) << 24) | ((value) & 0xffffff))
 
+/* returns the number of payload words that follow an opcode */
+static inline unsigned int host1x_opcode_get_count(uint32_t word)
+{
+	switch (word >> 28) {
+	case 0x0: /* SETCL */
+		return __builtin_popcount(word & 0x3f);
+
+	case 0x1: /* INCR */
+	case 0x2: /* NONINCR */
+		return word & 0xffff;
+
+	case 0x3: /* MASK */
+		return __builtin_popcount(word & 0xffff);
+
+	case 0x6: /* GATHER */
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
 struct host1x_pushbuf_reloc {
+	struct host1x_bo *target;
 	unsigned long source_offset;
 	unsigned long target_handle;
 	unsigned long target_offset;
 	unsigned long shift;
 };
 
+struct host1x_job;
+
 struct host1x_pushbuf {
+	struct host1x_job *job;
 	struct host1x_bo *bo;
 	unsigned long offset;
 	unsigned long length;
 
 	struct host1x_pushbuf_reloc *relocs;
 	unsigned long num_relocs;
+	unsigned long max_relocs;
 
 	uint32_t *ptr;
+	uint32_t *end;
+	bool owned;
+
+	/* contents belong to a fragment and were flushed when it was built */
+	bool shared;
+
+	/*
+	 * Number of payload words that the last opcode still expects, and how
+	 * many of the leading ones are written to the syncpoint increment
+	 * register.
+	 */
+	unsigned long data_words;
+	unsigned long syncpt_words;
 };
 
 struct host1x_pushbuf *host1x_pushbuf_create(struct host1x_bo *bo,
 					     unsigned long offset);
 
+struct host1x_arena_chunk;
+
+struct host1x_arena {
+	struct host1x_arena_chunk *chunks;
+};
+
+struct host1x_ring;
+
+/*
+ * A wait for a syncpoint in the command stream. The kernel is told about
+ * these so that it can drop waits for thresholds that have already passed.
+ */
+struct host1x_job_waitchk {
+	struct host1x_bo *bo;
+	unsigned long offset;
+	uint32_t syncpt;
+	uint32_t thresh;
+};
+
 struct host1x_job {
 	uint32_t syncpt;
 	uint32_t syncpt_incrs;
 
-	struct host1x_pushbuf *pushbufs;
+	struct host1x_pushbuf **pushbufs;
 	unsigned int num_pushbufs;
+	unsigned int max_pushbufs;
+
+	struct host1x_job_waitchk *waitchks;
+	unsigned int num_waitchks;
+	unsigned int max_waitchks;
+
+	struct host1x_arena arena;
+	struct host1x_ring *ring;
 };
 
-struct host1x_job *host1x_job_create(uint32_t syncpt, uint32_t increments);
+struct host1x_ring *host1x_ring_create(struct host1x *host1x,
+				       unsigned int num_bos, size_t size);
+void host1x_ring_free(struct host1x_ring *ring);
+
+struct host1x_job *host1x_job_create(uint32_t syncpt);
 void host1x_job_free(struct host1x_job *job);
+void host1x_job_reset(struct host1x_job *job);
 struct host1x_pushbuf *host1x_job_append(struct host1x_job *job,
 					 struct host1x_bo *bo,
 					 unsigned long offset);
-int host1x_pushbuf_push(struct host1x_pushbuf *pb, uint32_t word);
+struct host1x_pushbuf *host1x_job_append_ring(struct host1x_job *job,
+					      struct host1x_ring *ring);
+int host1x_pushbuf_grow(struct host1x_pushbuf *pb, unsigned int words);
+void host1x_pushbuf_decode(struct host1x_pushbuf *pb, const uint32_t *words,
+			   unsigned long count);
 int host1x_pushbuf_relocate(struct host1x_pushbuf *pb, struct host1x_bo *target,
 			    unsigned long offset, unsigned long shift);
 
+struct host1x_fence;
+
+int host1x_pushbuf_wait(struct host1x_pushbuf *pb, struct host1x_fence *fence,
+			uint32_t class);
+
+/*
+ * A fragment is an immutable piece of command stream that is recorded once
+ * and can then be referenced by any number of jobs without copying it.
+ */
+struct host1x_fragment {
+	struct host1x_job *job;
+	struct host1x_pushbuf *pb;
+	bool sealed;
+};
+
+struct host1x_fragment *host1x_fragment_create(struct host1x *host1x,
+					       uint32_t syncpt);
+void host1x_fragment_free(struct host1x_fragment *fragment);
+struct host1x_pushbuf *host1x_fragment_begin(struct host1x_fragment *fragment);
+int host1x_fragment_end(struct host1x_fragment *fragment);
+unsigned long host1x_fragment_get_length(struct host1x_fragment *fragment);
+int host1x_pushbuf_gather(struct host1x_pushbuf *pb,
+			  struct host1x_fragment *fragment);
+
+/*
+ * A template is a piece of command stream that is recorded from a push
+ * buffer once and then copied into other push buffers, with some words
+ * patched and the relocations pointed at new targets.
+ */
+struct host1x_template_target {
+	struct host1x_bo *bo;
+	unsigned long offset;
+};
+
+struct host1x_template;
+
+struct host1x_template *host1x_template_create(void);
+void host1x_template_free(struct host1x_template *tmpl);
+void host1x_template_begin(struct host1x_template *tmpl,
+			   struct host1x_pushbuf *pb);
+int host1x_template_patch(struct host1x_template *tmpl,
+			  struct host1x_pushbuf *pb, unsigned int slot);
+int host1x_template_end(struct host1x_template *tmpl,
+			struct host1x_pushbuf *pb);
+bool host1x_template_is_valid(struct host1x_template *tmpl);
+void host1x_template_reset(struct host1x_template *tmpl);
+int host1x_pushbuf_stamp(struct host1x_pushbuf *pb,
+			 struct host1x_template *tmpl, const uint32_t *patches,
+			 const struct host1x_template_target *targets);
+
+/*
+ * Make sure that at least the given number of words can be written to the
+ * push buffer contiguously. If the current segment is too small, a new one
+ * is chained into the job. Use this before emitting an opcode together with
+ * its payload so that both end up in the same segment.
+ */
+static inline int host1x_pushbuf_prepare(struct host1x_pushbuf *pb,
+					 unsigned int words)
+{
+	if ((unsigned long)(pb->end - pb->ptr) < words)
+		return host1x_pushbuf_grow(pb, words);
+
+	return 0;
+}
+
+/*
+ * Push a single word. An opcode is never split from its payload: when a word
+ * starts a new opcode, room for all of its payload is made as well, because
+ * the kernel's command stream firewall rejects opcodes that continue in the
+ * next command buffer.
+ */
+static inline int host1x_pushbuf_push(struct host1x_pushbuf *pb,
+				      uint32_t word)
+{
+	unsigned int words = 1;
+	int err;
+
+	if (pb->data_words == 0)
+		words += host1x_opcode_get_count(word);
+
+	err = host1x_pushbuf_prepare(pb, words);
+	if (err < 0)
+		return err;
+
+	*pb->ptr++ = word;
+	pb->length++;
+
+	/* plain payload words don't need to be decoded */
+	if (pb->data_words > 0 && pb->syncpt_words == 0)
+		pb->data_words--;
+	else
+		host1x_pushbuf_decode(pb, &word, 1);
+
+	return 0;
+}
+
+static inline uint32_t *__host1x_pushbuf_reserve(struct host1x_pushbuf *pb,
+						 unsigned int words)
+{
+	uint32_t *ptr;
+
+	if (host1x_pushbuf_prepare(pb, words) < 0)
+		return NULL;
+
+	ptr = pb->ptr;
+	pb->ptr += words;
+	pb->length += words;
+
+	return ptr;
+}
+
+/*
+ * Reserve space for a number of words and return a pointer to it. The words
+ * count as pushed, so the caller must fill in all of them. They are taken to
+ * be the payload of the preceding opcode and are not decoded, so they must
+ * not contain syncpoint increments.
+ */
+static inline uint32_t *host1x_pushbuf_reserve(struct host1x_pushbuf *pb,
+					       unsigned int words)
+{
+	uint32_t *ptr;
+
+	ptr = __host1x_pushbuf_reserve(pb, words);
+	if (!ptr)
+		return NULL;
+
+	if (pb->data_words > words)
+		pb->data_words -= words;
+	else
+		pb->data_words = 0;
+
+	if (pb->syncpt_words > words)
+		pb->syncpt_words -= words;
+	else
+		pb->syncpt_words = 0;
+
+	return ptr;
+}
+
+static inline int host1x_pushbuf_push_array(struct host1x_pushbuf *pb,
+					    const uint32_t *words,
+					    unsigned int count)
+{
+	unsigned long end = pb->data_words;
+	uint32_t *ptr;
+	int err;
+
+	/* the payload of the last opcode must end up in the same segment */
+	while (end < count)
+		end += 1 + host1x_opcode_get_count(words[end]);
+
+	err = host1x_pushbuf_prepare(pb, end > count ? end : count);
+	if (err < 0)
+		return err;
+
+	ptr = __host1x_pushbuf_reserve(pb, count);
+	if (!ptr)
+		return -ENOMEM;
+
+	memcpy(ptr, words, count * sizeof(*words));
+	host1x_pushbuf_decode(pb, words, count);
+
+	return 0;
+}
+
 int host1x_client_submit(struct host1x_client *client, struct host1x_job *job);
 int host1x_client_flush(struct host1x_client *client, uint32_t *fence);
 int host1x_client_wait(struct host1x_client *client, uint32_t fence,
 		       uint32_t timeout);
 
+/*
+ * A fence is signaled once the syncpoint of a job has reached the value that
+ * was returned when the job was submitted. A zeroed fence is always signaled.
+ * Timeouts are given in milliseconds, with ~0 meaning to wait forever.
+ */
+struct host1x_fence {
+	struct host1x_client *client;
+	uint32_t syncpt;
+	uint32_t value;
+};
+
+int host1x_client_submit_async(struct host1x_client *client,
+			       struct host1x_job *job,
+			       struct host1x_fence *fence);
+int host1x_fence_query(struct host1x_fence *fence);
+int host1x_fence_wait(struct host1x_fence *fence, uint32_t timeout);
+int host1x_fence_wait_any(struct host1x_fence *fences, unsigned int count,
+			  uint32_t timeout, unsigned int *index);
+int host1x_fence_wait_all(struct host1x_fence *fences, unsigned int count,
+			  uint32_t timeout);
+int host1x_fence_get_fd(struct host1x *host1x, struct host1x_fence *fences,
+			unsigned int count, int *fd);
+
 struct host1x_framebuffer *host1x_framebuffer_create(struct host1x *host1x,
 						     unsigned short width,
 						     unsigned short height,
 						     unsigned short depth,
 						     unsigned long flags);
+struct host1x_framebuffer *
+host1x_framebuffer_create_from_bo(struct host1x *host1x, struct host1x_bo *bo,
+				  unsigned short width, unsigned short height,
+				  unsigned int pitch, unsigned short depth,
+				  unsigned long flags);
 void host1x_framebuffer_free(struct host1x_framebuffer *fb);
+struct host1x_bo *host1x_framebuffer_get_bo(struct host1x_framebuffer *fb);
+void host1x_framebuffer_set_fence(struct host1x_framebuffer *fb, int fd);
 int host1x_framebuffer_save(struct host1x_framebuffer *fb, const char *path);
 
 struct host1x_gr2d;
 struct host1x_gr3d;
 
+struct host1x_batch {
+	struct host1x_client *client;
+	struct host1x_ring *ring;
+	struct host1x_job *job;
+	struct host1x_pushbuf *pb;
+	unsigned long limit;
+	unsigned int num_ops;
+
+	/* completion of the most recently submitted job */
+	struct host1x_fence fence;
+
+	/* number of operations and of kernel submissions so far */
+	unsigned long ops;
+	unsigned long submits;
+};
+
+struct host1x_batch *host1x_batch_create(struct host1x_client *client,
+					 struct host1x_ring *ring,
+					 unsigned long limit);
+void host1x_batch_free(struct host1x_batch *batch);
+struct host1x_pushbuf *host1x_batch_begin(struct host1x_batch *batch);
+int host1x_batch_end(struct host1x_batch *batch);
+int host1x_batch_flush(struct host1x_batch *batch, struct host1x_fence *fence);
+int host1x_batch_wait(struct host1x_batch *batch, struct host1x_fence *fence);
+
+/*
+ * Recorders allow command streams to be built on several threads at once.
+ * Each recorder must only be used by one thread at a time and owns its own
+ * command buffers and relocations. Finished jobs are handed to the queue,
+ * whose thread submits them to the kernel in the order they were finished.
+ */
+struct host1x_queue;
+struct host1x_recorder;
+
+struct host1x_queue *host1x_queue_create(struct host1x *host1x);
+void host1x_queue_free(struct host1x_queue *queue);
+
+struct host1x_recorder *host1x_recorder_create(struct host1x_queue *queue,
+					       struct host1x_client *client,
+					       unsigned int depth,
+					       size_t size);
+void host1x_recorder_free(struct host1x_recorder *recorder);
+struct host1x_pushbuf *host1x_recorder_begin(struct host1x_recorder *recorder);
+int host1x_recorder_end(struct host1x_recorder *recorder);
+int host1x_recorder_flush(struct host1x_recorder *recorder,
+			  struct host1x_fence *fence);
+
+/*
+ * If a fence is passed, these return as soon as the job has been submitted
+ * and the fence tracks its completion. Otherwise they wait for the job.
+ */
 int host1x_gr2d_clear(struct host1x_gr2d *gr2d, struct host1x_framebuffer *fb,
-		      float red, float green, float blue, float alpha);
+		      float red, float green, float blue, float alpha,
+		      struct host1x_fence *fence);
 int host1x_gr2d_blit(struct host1x_gr2d *gr2d, struct host1x_framebuffer *src,
 		     struct host1x_framebuffer *dst, unsigned int sx,
 		     unsigned int sy, unsigned int dx, unsigned int dy,
-		     unsigned int width, unsigned int height);
+		     unsigned int width, unsigned int height,
+		     struct host1x_fence *fence);
 void host1x_gr3d_viewport(struct host1x_pushbuf *pb, float x, float y,
 			  float width, float height);
 int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
-			 struct host1x_framebuffer *fb);
+			 struct host1x_framebuffer *fb,
+			 struct host1x_fence *fence);
+
+/*
+ * Capture files record all jobs submitted through a host1x device so that
+ * they can be replayed later on. A capture file starts with a header that
+ * is followed by a sequence of records. All values are in native byte order.
+ *
+ * Buffer object contents are stored as blobs that are identified by the
+ * 64-bit FNV-1a hash of their data and written only once per capture.
+ *
+ * A submit record is followed by its command buffers, relocations and the
+ * state of the buffer objects that the relocations refer to. The words of
+ * each command buffer are stored in a blob and the placeholder words of the
+ * relocations are stored unpatched.
+ */
+#define HOST1X_CAPTURE_MAGIC 0x43583148 /* "H1XC" */
+#define HOST1X_CAPTURE_VERSION 1
+
+enum host1x_capture_type {
+	HOST1X_CAPTURE_BLOB = 1,
+	HOST1X_CAPTURE_BO = 2,
+	HOST1X_CAPTURE_SUBMIT = 3,
+};
+
+struct host1x_capture_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+/* followed by size bytes of payload */
+struct host1x_capture_record {
+	uint32_t type;
+	uint32_t size;
+};
+
+/* followed by the data */
+struct host1x_capture_blob {
+	uint64_t hash;
+};
+
+/* declares a buffer object before it is first used */
+struct host1x_capture_bo {
+	uint32_t id;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t padding;
+};
+
+struct host1x_capture_submit {
+	uint32_t class;
+	uint32_t syncpt;
+	uint32_t syncpt_incrs;
+	uint32_t num_cmdbufs;
+	uint32_t num_relocs;
+	uint32_t num_bos;
+};
+
+struct host1x_capture_cmdbuf {
+	uint32_t words;
+	uint32_t padding;
+	uint64_t hash;
+};
+
+struct host1x_capture_reloc {
+	uint32_t cmdbuf;
+	uint32_t offset; /* in bytes, relative to the command buffer */
+	uint32_t target;
+	uint32_t target_offset;
+	uint32_t shift;
+	uint32_t padding;
+};
+
+/* contents of a buffer object at the time of the submission */
+struct host1x_capture_state {
+	uint32_t id;
+	uint32_t padding;
+	uint64_t hash;
+};
+
+uint64_t host1x_capture_hash(const void *data, size_t size);
+int host1x_capture_start(struct host1x *host1x, const char *path);
+void host1x_capture_stop(struct host1x *host1x);
+
+struct host1x_shadow_stats {
+	unsigned long written;
+	unsigned long elided;
+};
+
+struct host1x_shadow;
+
+struct host1x_shadow *host1x_client_get_shadow(struct host1x_client *client);
+void host1x_shadow_invalidate(struct host1x_shadow *shadow);
+unsigned long host1x_shadow_get_generation(struct host1x_shadow *shadow);
+void host1x_shadow_get_stats(struct host1x_shadow *shadow,
+			     struct host1x_shadow_stats *stats);
+int host1x_shadow_write(struct host1x_shadow *shadow,
+			struct host1x_pushbuf *pb, uint32_t offset,
+			uint32_t value);
+int host1x_shadow_write_incr(struct host1x_shadow *shadow,
+			     struct host1x_pushbuf *pb, uint32_t offset,
+			     const uint32_t *values, unsigned int count);
+int host1x_shadow_write_mask(struct host1x_shadow *shadow,
+			     struct host1x_pushbuf *pb, uint32_t offset,
+			     uint16_t mask, const uint32_t *values);
+int host1x_shadow_upload(struct host1x_shadow *shadow,
+			 struct host1x_pushbuf *pb, uint32_t data,
+			 unsigned int start, const uint32_t *values,
+			 unsigned int count);
+int host1x_shadow_emit(struct host1x_shadow *shadow,
+		       struct host1x_pushbuf *pb, const uint32_t *words,
+		       unsigned int count);
+int host1x_shadow_gather(struct host1x_shadow *shadow,
+			 struct host1x_pushbuf *pb,
+			 struct host1x_fragment *fragment);
 
 #endif
@@ -42,6 +42,10 @@ struct grate_display *grate_display_open(struct grate *grate)
 		return NULL;
 
 	display->base = host1x_get_display(grate->host1x);
+	if (!display->base) {
+		free(display);
+		return NULL;
+	}
 
 	return display;
 }
@@ -65,6 +69,28 @@ void grate_display_show(struct grate_display *display,
 	host1x_display_set(display->base, fb->front, vsync);
 }
 
+bool grate_display_can_flip(struct grate_display *display)
+{
+	return host1x_display_get_fd(display->base) >= 0;
+}
+
+int grate_display_flip(struct grate_display *display,
+		       struct host1x_framebuffer *fb)
+{
+	return host1x_display_flip(display->base, fb);
+}
+
+int grate_display_wait_flip(struct grate_display *display, int timeout,
+			    struct host1x_flip *flip)
+{
+	return host1x_display_wait_flip(display->base, timeout, flip);
+}
+
+void grate_display_cancel_flip(struct grate_display *display)
+{
+	host1x_display_cancel_flip(display->base);
+}
+
 struct grate_overlay *grate_overlay_create(struct grate_display *display)
 {
 	struct grate_overlay *overlay;
@@ -93,13 +93,15 @@ bool grate_parse_command_line(struct grate_options *options, int argc,
 	static const struct option long_opts[] = {
 		{ "fullscreen", 0, NULL, 'f' },
 		{ "geometry", 1, NULL, 'g' },
+		{ "rgb565", 0, NULL, 'r' },
 		{ "vsync", 0, NULL, 'v' },
 	};
-	static const char opts[] = "fg:v";
+	static const char opts[] = "fg:rv";
 	int opt;
 
 	options->fullscreen = false;
 	options->vsync = false;
+	options->format = GRATE_RGBA8888;
 	options->x = 0;
 	options->y = 0;
 	options->width = 256;
@@ -115,6 +117,10 @@ bool grate_parse_command_line(struct grate_options *options, int argc,
 			grate_parse_geometry(options, optarg);
 			break;
 
+		case 'r':
+			options->format = GRATE_RGB565;
+			break;
+
 		case 'v':
 			options->vsync = true;
 			break;
@@ -143,6 +149,16 @@ struct grate *grate_init(struct grate_options *options)
 
 	grate->options = options;
 
+	grate->draw.head = host1x_template_create();
+	grate->draw.tail = host1x_template_create();
+	if (!grate->draw.head || !grate->draw.tail) {
+		host1x_template_free(grate->draw.tail);
+		host1x_template_free(grate->draw.head);
+		host1x_close(grate->host1x);
+		free(grate);
+		return NULL;
+	}
+
 	grate->display = grate_display_open(grate);
 	if (grate->display) {
 		if (!grate->options->fullscreen)
@@ -159,8 +175,11 @@ struct grate *grate_init(struct grate_options *options)
 
 void grate_exit(struct grate *grate)
 {
-	if (grate)
+	if (grate) {
+		host1x_template_free(grate->draw.tail);
+		host1x_template_free(grate->draw.head);
 		host1x_close(grate->host1x);
+	}
 
 	free(grate);
 }
@@ -183,21 +202,69 @@ void grate_clear_color(struct grate *grate, float red, float green,
 	grate->clear.a = alpha;
 }
 
-void grate_clear(struct grate *grate)
+/*
+ * Clears a buffer on gr2d. Rather than waiting on the CPU for gr3d to finish
+ * with the buffer, gr2d waits in the command stream for the last job that
+ * used it, so that a buffer can be cleared while gr3d renders to another.
+ */
+static int grate_clear_buffer(struct grate *grate,
+			      struct host1x_framebuffer *fb,
+			      const struct grate_color *color)
 {
 	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
-	struct grate_color *clear = &grate->clear;
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct host1x_fence fence;
 	int err;
 
-	if (!grate->fb) {
+	/* rendering to the buffer may not have been submitted yet */
+	err = host1x_batch_flush(gr3d->batch, &fence);
+	if (err < 0) {
+		grate_error("host1x_batch_flush() failed: %d\n", err);
+		return err;
+	}
+
+	err = host1x_batch_wait(gr2d->batch, &fb->bo->fence);
+	if (err < 0) {
+		grate_error("host1x_batch_wait() failed: %d\n", err);
+		return err;
+	}
+
+	err = host1x_gr2d_clear(gr2d, fb, color->r, color->g, color->b,
+				color->a, &grate->gr2d_fence);
+	if (err < 0) {
+		grate_error("host1x_gr2d_clear() failed: %d\n", err);
+		return err;
+	}
+
+	return 0;
+}
+
+static bool grate_color_equal(const struct grate_color *a,
+			      const struct grate_color *b)
+{
+	return a->r == b->r && a->g == b->g && a->b == b->b && a->a == b->a;
+}
+
+void grate_clear(struct grate *grate)
+{
+	struct grate_framebuffer *fb = grate->fb;
+	struct grate_color *clear = &grate->clear;
+
+	if (!fb) {
 		grate_error("no framebuffer bound to state\n");
 		return;
 	}
 
-	err = host1x_gr2d_clear(gr2d, grate->fb->back, clear->r, clear->g,
-				clear->b, clear->a);
-	if (err < 0)
-		grate_error("host1x_gr2d_clear() failed: %d\n", err);
+	/* the frame scheduler may have done this already */
+	if (fb->precleared != fb->back ||
+	    !grate_color_equal(&fb->precolor, clear)) {
+		if (grate_clear_buffer(grate, fb->back, clear) < 0)
+			return;
+	}
+
+	fb->precleared = NULL;
+	fb->cleared = true;
+	fb->color = *clear;
 }
 
 void grate_bind_framebuffer(struct grate *grate, struct grate_framebuffer *fb)
@@ -227,7 +294,6 @@ void grate_attribute_pointer(struct grate *grate, unsigned int location,
 {
 	struct grate_vertex_attribute *attribute;
 	size_t length;
-	int err;
 
 	if (location > GRATE_MAX_ATTRIBUTES) {
 		fprintf(stderr, "ERROR: invalid location: %u\n", location);
@@ -244,11 +310,7 @@ void grate_attribute_pointer(struct grate *grate, unsigned int location,
 	attribute->size = size;
 	attribute->bo = bo;
 
-	err = host1x_bo_invalidate(bo->bo, offset, length);
-	if (err < 0) {
-		fprintf(stderr, "ERROR: failed to invalidate buffer\n");
-		return;
-	}
+	host1x_bo_mark_dirty(bo->bo, offset, length);
 }
 
 int grate_get_uniform_location(struct grate *grate, const char *name)
@@ -307,22 +369,141 @@ enum host1x_gr3d_primitive {
 	HOST1X_GR3D_TRIANGLE_LOOP,
 };
 
+static const uint32_t state_404[] = { 0x00000000, 0x000fffff };
+static const uint32_t state_354[] = { 0x3efffff0, 0x3efffff0 };
+static const uint32_t state_346[] = { 0x00001401, 0x3f800000 };
+static const uint32_t state_34c[] = { 0x00000002, 0x3f000000 };
+static const uint32_t state_358[] = { 0x4376f000, 0x4376f000, 0x40dfae14 };
+static const uint32_t state_e15[] = {
+	0x08000001, 0x08000001, 0x08000001, 0x08000001,
+	0x08000001, 0x08000001, 0x08000001,
+};
+static const uint32_t state_348[] = {
+	0x3f800000, 0x00000000, 0x00000000, 0x3f800000,
+};
+static const uint32_t state_300[] = { 0x00000008, 0x0000fecd };
+static const uint32_t state_344[] = { 0x00000000, 0x00000000 };
+
+static uint32_t grate_attribute_mode(struct grate_vertex_attribute *attr)
+{
+	uint32_t stride = attr->stride * sizeof(float);
+
+	return stride << 8 | attr->size << 4 | HOST1X_GR3D_FLOAT;
+}
+
+static void grate_draw_get_key(struct grate *grate,
+			       struct host1x_shadow *shadow,
+			       struct grate_draw_key *key)
+{
+	struct host1x_framebuffer *fb = grate->fb->back;
+	unsigned int i;
+
+	memset(key, 0, sizeof(*key));
+
+	key->program = grate->program;
+	key->generation = host1x_shadow_get_generation(shadow);
+	key->width = fb->width;
+	key->height = fb->height;
+	key->depth = fb->depth;
+
+	for (i = 0; i < GRATE_MAX_ATTRIBUTES; i++) {
+		struct grate_vertex_attribute *attr = &grate->attributes[i];
+
+		if (attr->bo)
+			key->attributes[i] = grate_attribute_mode(attr);
+	}
+}
+
+/*
+ * Copies the command stream recorded by an earlier draw with the same key.
+ * The state it writes is already in place, so only the uniforms need to be
+ * checked against the shadow.
+ */
+static int grate_draw_stamp(struct grate *grate, struct host1x_pushbuf *pb,
+			    struct host1x_shadow *shadow,
+			    const uint32_t *patches, struct grate_bo *bo,
+			    unsigned long offset)
+{
+	struct host1x_template_target targets[2 + GRATE_MAX_ATTRIBUTES];
+	struct grate_program *program = grate->program;
+	unsigned int i, num_targets = 0;
+	int err;
+
+	err = host1x_pushbuf_stamp(pb, grate->draw.head, patches, NULL);
+	if (err < 0)
+		return err;
+
+	err = host1x_shadow_upload(shadow, pb, 0x208, 0,
+				   (void *)program->uniform, 256 * 4);
+	if (err < 0)
+		return err;
+
+	/* relocations in the order in which they were recorded */
+	targets[num_targets].bo = grate->fb->back->bo;
+	targets[num_targets].offset = 0;
+	num_targets++;
+
+	for (i = 0; i < GRATE_MAX_ATTRIBUTES; i++) {
+		struct grate_vertex_attribute *attr = &grate->attributes[i];
+
+		if (!attr->bo)
+			continue;
+
+		targets[num_targets].bo = attr->bo->bo;
+		targets[num_targets].offset = attr->offset;
+		num_targets++;
+	}
+
+	targets[num_targets].bo = bo->bo;
+	targets[num_targets].offset = offset;
+	num_targets++;
+
+	return host1x_pushbuf_stamp(pb, grate->draw.tail, patches, targets);
+}
+
+/*
+ * A word that ends up in another segment than the start of the template only
+ * means that the template isn't usable and is recorded again by a later draw.
+ * Anything else leaves the command stream incomplete.
+ */
+static int grate_draw_patch(struct host1x_template *tmpl,
+			    struct host1x_pushbuf *pb, unsigned int slot)
+{
+	int err;
+
+	err = host1x_template_patch(tmpl, pb, slot);
+	if (err == -EAGAIN)
+		return 0;
+
+	if (err < 0)
+		grate_error("host1x_template_patch() failed: %d\n", err);
+
+	return err;
+}
+
 void grate_draw_elements(struct grate *grate, enum grate_primitive type,
 			 unsigned int size, unsigned int count,
 			 struct grate_bo *bo, unsigned long offset)
 {
 	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct host1x_shadow *shadow = host1x_client_get_shadow(gr3d->client);
 	struct host1x_syncpt *syncpt = &gr3d->client->syncpts[0];
 	struct host1x_framebuffer *fb = grate->fb->back;
 	struct grate_program *program = grate->program;
 	struct grate_viewport *vp = &grate->viewport;
 	unsigned long length = count * size;
 	enum host1x_gr3d_primitive mode;
-	uint32_t format, pitch, fence;
+	uint32_t format;
 	enum host1x_gr3d_index index;
-	unsigned int depth = 32, i;
+	unsigned int depth = fb->depth, i;
 	struct host1x_pushbuf *pb;
-	struct host1x_job *job;
+	union {
+		uint32_t u;
+		float f;
+	} viewport[4];
+	struct grate_draw_key key;
+	uint32_t values[4], patches[GRATE_DRAW_NUM_PATCHES];
+	bool upload, record = false;
 	int err;
 
 	switch (type) {
@@ -345,10 +526,12 @@ void grate_draw_elements(struct grate *grate, enum grate_primitive type,
 		return;
 	}
 
-	/* invalidate memory for indices */
-	err = host1x_bo_invalidate(bo->bo, offset, length);
+	host1x_bo_mark_dirty(bo->bo, offset, length);
+
+	/* let gr3d wait for the framebuffer to be cleared */
+	err = host1x_batch_wait(gr3d->batch, &grate->gr2d_fence);
 	if (err < 0) {
-		fprintf(stderr, "ERROR: failed to invalidate buffer\n");
+		grate_error("host1x_batch_wait() failed: %d\n", err);
 		return;
 	}
 
@@ -356,79 +539,117 @@ void grate_draw_elements(struct grate *grate, enum grate_primitive type,
 	 * build command stream
 	 */
 
-	job = host1x_job_create(syncpt->id, 9);
-	if (!job)
+	pb = host1x_batch_begin(gr3d->batch);
+	if (!pb)
 		return;
 
-	pb = host1x_job_append(job, gr3d->commands, 0);
-	if (!pb) {
-		host1x_job_free(job);
-		return;
+	patches[GRATE_DRAW_PATCH_PRIMITIVE] = 0xc8000000 | (index << 28) |
+					      (mode << 24);
+	patches[GRATE_DRAW_PATCH_COUNT] = (count - 1) << 20;
+
+	viewport[0].f = vp->x * 16.0f + vp->width * 8.0f;
+	viewport[1].f = vp->y * 16.0f + vp->height * 8.0f;
+	viewport[2].f = vp->width * 8.0f;
+	viewport[3].f = vp->height * 8.0f;
+
+	for (i = 0; i < 4; i++)
+		patches[GRATE_DRAW_PATCH_VIEWPORT + i] = viewport[i].u;
+
+	/*
+	 * A draw with the same key as the previous one is recorded, and draws
+	 * after that are stamped out from the recording.
+	 */
+	grate_draw_get_key(grate, shadow, &key);
+
+	if (memcmp(&key, &grate->draw.key, sizeof(key)) == 0) {
+		if (host1x_template_is_valid(grate->draw.head) &&
+		    host1x_template_is_valid(grate->draw.tail)) {
+			err = grate_draw_stamp(grate, pb, shadow, patches, bo,
+					       offset);
+			if (err < 0) {
+				grate_error("grate_draw_stamp() failed: %d\n",
+					    err);
+				return;
+			}
+
+			err = host1x_batch_end(gr3d->batch);
+			if (err < 0)
+				grate_error("host1x_batch_end() failed: %d\n",
+					    err);
+
+			return;
+		}
+
+		record = true;
+	} else {
+		host1x_template_reset(grate->draw.head);
+		host1x_template_reset(grate->draw.tail);
+		grate->draw.key = key;
 	}
 
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x404, 2));
-	host1x_pushbuf_push(pb, 0x00000000);
-	host1x_pushbuf_push(pb, 0x000fffff);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x354, 9));
-	host1x_pushbuf_push(pb, 0x3efffff0);
-	host1x_pushbuf_push(pb, 0x3efffff0);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x740, 0x035));
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xe26, 0x779));
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x346, 0x2));
-	host1x_pushbuf_push(pb, 0x00001401);
-	host1x_pushbuf_push(pb, 0x3f800000);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x34c, 0x2));
-	host1x_pushbuf_push(pb, 0x00000002);
-	host1x_pushbuf_push(pb, 0x3f000000);
+	if (record)
+		host1x_template_begin(grate->draw.head, pb);
+
+	/*
+	 * Registers that only hold state are written through the shadow, so
+	 * that values left by the previous draw aren't sent again. Syncpoint
+	 * increments, triggers and relocations always go out.
+	 */
+	host1x_shadow_write_incr(shadow, pb, 0x404, state_404, 2);
+	host1x_shadow_write_mask(shadow, pb, 0x354, 0x9, state_354);
+	host1x_shadow_write(shadow, pb, 0x740, 0x035);
+	host1x_shadow_write(shadow, pb, 0xe26, 0x779);
+	host1x_shadow_write_incr(shadow, pb, 0x346, state_346, 2);
+	host1x_shadow_write_incr(shadow, pb, 0x34c, state_34c, 2);
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x1));
 	host1x_pushbuf_push(pb, 0x000002 << 8 | syncpt->id);
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x1));
 	host1x_pushbuf_push(pb, 0x000002 << 8 | syncpt->id);
 
-	host1x_gr3d_viewport(pb, vp->x, vp->y, vp->width, vp->height);
+	/*
+	 * The viewport bypasses the shadow so that its words are always in
+	 * the stream and can be patched when the template is stamped out.
+	 */
+	err = host1x_pushbuf_prepare(pb, 5);
+	if (err < 0) {
+		grate_error("host1x_pushbuf_prepare() failed: %d\n", err);
+		return;
+	}
 
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x358, 0x03));
-	host1x_pushbuf_push(pb, 0x4376f000);
-	host1x_pushbuf_push(pb, 0x4376f000);
-	host1x_pushbuf_push(pb, 0x40dfae14);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x343, 0x01));
-	host1x_pushbuf_push(pb, 0xb8e00000);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x350, 0x02));
-	host1x_pushbuf_push(pb, fb->width  & 0xffff);
-	host1x_pushbuf_push(pb, fb->height & 0xffff);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe11, 0x01));
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x352, 0x1b));
 
-	if (depth == 16) {
+	for (i = 0; i < 4; i++) {
+		if (record) {
+			err = grate_draw_patch(grate->draw.head, pb,
+					       GRATE_DRAW_PATCH_VIEWPORT + i);
+			if (err < 0)
+				return;
+		}
+
+		host1x_pushbuf_push(pb, patches[GRATE_DRAW_PATCH_VIEWPORT + i]);
+	}
+
+	host1x_shadow_write_incr(shadow, pb, 0x358, state_358, 3);
+	host1x_shadow_write(shadow, pb, 0x343, 0xb8e00000);
+
+	values[0] = fb->width & 0xffff;
+	values[1] = fb->height & 0xffff;
+	host1x_shadow_write_incr(shadow, pb, 0x350, values, 2);
+
+	if (depth == 16)
 		format = HOST1X_GR3D_FORMAT_RGB565;
-		pitch = fb->width * 2;
-	} else {
+	else
 		format = HOST1X_GR3D_FORMAT_RGBA8888;
-		pitch = fb->width * 4;
-	}
-
-	host1x_pushbuf_push(pb, 0x04000000 | (pitch << 8) | format << 2 | 0x1);
-
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x903, 0x01));
-	host1x_pushbuf_push(pb, 0x00000002);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe15, 0x07));
-	host1x_pushbuf_push(pb, 0x08000001);
-	host1x_pushbuf_push(pb, 0x08000001);
-	host1x_pushbuf_push(pb, 0x08000001);
-	host1x_pushbuf_push(pb, 0x08000001);
-	host1x_pushbuf_push(pb, 0x08000001);
-	host1x_pushbuf_push(pb, 0x08000001);
-	host1x_pushbuf_push(pb, 0x08000001);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe10, 0x01));
-	host1x_pushbuf_push(pb, 0x0c000000);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe13, 0x01));
-	host1x_pushbuf_push(pb, 0x0c000000);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe12, 0x01));
-	host1x_pushbuf_push(pb, 0x0c000000);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x348, 0x04));
-	host1x_pushbuf_push(pb, 0x3f800000);
-	host1x_pushbuf_push(pb, 0x00000000);
-	host1x_pushbuf_push(pb, 0x00000000);
-	host1x_pushbuf_push(pb, 0x3f800000);
+
+	host1x_shadow_write(shadow, pb, 0xe11,
+			    0x04000000 | (fb->pitch << 8) | format << 2 | 0x1);
+
+	host1x_shadow_write(shadow, pb, 0x903, 0x00000002);
+	host1x_shadow_write_incr(shadow, pb, 0xe15, state_e15, 7);
+	host1x_shadow_write(shadow, pb, 0xe10, 0x0c000000);
+	host1x_shadow_write(shadow, pb, 0xe13, 0x0c000000);
+	host1x_shadow_write(shadow, pb, 0xe12, 0x0c000000);
+	host1x_shadow_write_incr(shadow, pb, 0x348, state_348, 4);
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xe27, 0x01));
 
 	for (i = 0; i < 4; i++) {
@@ -448,26 +669,38 @@ void grate_draw_elements(struct grate *grate, enum grate_primitive type,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x01));
 	host1x_pushbuf_push(pb, 0x000002 << 8 | syncpt->id);
 
-	grate_shader_emit(pb, grate->program->vs);
-
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x343, 0x01));
-	host1x_pushbuf_push(pb, 0xb8e00000);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x300, 0x02));
-	host1x_pushbuf_push(pb, 0x00000008);
-	host1x_pushbuf_push(pb, 0x0000fecd);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe20, 0x01));
-	host1x_pushbuf_push(pb, 0x58000000);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x503, 0x00));
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x545, 0x00));
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xe22, 0x00));
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x603, 0x00));
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x803, 0x00));
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x520, 0x01));
-	host1x_pushbuf_push(pb, 0x20006001);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x546, 0x01));
-	host1x_pushbuf_push(pb, 0x00000040);
-
-	grate_shader_emit(pb, grate->program->fs);
+	/*
+	 * The shaders stay resident until another program is used or the
+	 * shadow is invalidated, which also means that gr3d lost its state.
+	 */
+	upload = program != grate->emitted.program ||
+		 host1x_shadow_get_generation(shadow) !=
+			grate->emitted.generation;
+
+	if (upload)
+		grate_shader_emit(shadow, pb, program->vs);
+
+	host1x_shadow_write(shadow, pb, 0x343, 0xb8e00000);
+	host1x_shadow_write_incr(shadow, pb, 0x300, state_300, 2);
+	host1x_shadow_write(shadow, pb, 0xe20, 0x58000000);
+
+	if (upload) {
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x503, 0x00));
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x545, 0x00));
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xe22, 0x00));
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x603, 0x00));
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x803, 0x00));
+	}
+
+	host1x_shadow_write(shadow, pb, 0x520, 0x20006001);
+	host1x_shadow_write(shadow, pb, 0x546, 0x00000040);
+
+	if (upload) {
+		grate_shader_emit(shadow, pb, program->fs);
+
+		grate->emitted.generation = host1x_shadow_get_generation(shadow);
+		grate->emitted.program = program;
+	}
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xa02, 0x06));
 	host1x_pushbuf_push(pb, 0x000001ff);
@@ -480,26 +713,19 @@ void grate_draw_elements(struct grate *grate, enum grate_primitive type,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xa08, 0x100));
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x40c, 0x06));
 
-	/* upload uniforms */
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x207, 0x001));
-	host1x_pushbuf_push(pb, 0x00000000);
-
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x208, 256 * 4));
+	if (record)
+		host1x_template_end(grate->draw.head, pb);
 
-	for (i = 0; i < 256; i++) {
-		uint32_t *ptr = (void *)&program->uniform[i * 4];
+	/* upload the uniforms that changed since the last draw */
+	host1x_shadow_upload(shadow, pb, 0x208, 0, (void *)program->uniform,
+			     256 * 4);
 
-		host1x_pushbuf_push(pb, ptr[0]);
-		host1x_pushbuf_push(pb, ptr[1]);
-		host1x_pushbuf_push(pb, ptr[2]);
-		host1x_pushbuf_push(pb, ptr[3]);
-	}
+	if (record)
+		host1x_template_begin(grate->draw.tail, pb);
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x120, 0x01));
 	host1x_pushbuf_push(pb, 0x00030081);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x344, 0x02));
-	host1x_pushbuf_push(pb, 0x00000000);
-	host1x_pushbuf_push(pb, 0x00000000);
+	host1x_shadow_write_incr(shadow, pb, 0x344, state_344, 2);
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x01));
 	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xa00, 0xe01));
@@ -510,13 +736,11 @@ void grate_draw_elements(struct grate *grate, enum grate_primitive type,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe01, 0x01));
 	host1x_pushbuf_relocate(pb, fb->bo, 0, 0);
 	host1x_pushbuf_push(pb, 0xdeadbeef);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe31, 0x01));
-	host1x_pushbuf_push(pb, 0x00000000);
+	host1x_shadow_write(shadow, pb, 0xe31, 0x00000000);
 
 	for (i = 0; i < GRATE_MAX_ATTRIBUTES; i++) {
 		unsigned int reg = 0x100 + (i << 1);
 		struct grate_vertex_attribute *attr;
-		uint32_t value, stride;
 
 		attr = &grate->attributes[i];
 		if (!attr->bo)
@@ -524,23 +748,36 @@ void grate_draw_elements(struct grate *grate, enum grate_primitive type,
 
 		//fprintf(stdout, "DEBUG: attribute #%02u: %p@%lx\n", i,
 		//	attr->bo, attr->offset);
-		host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(reg, 0x02));
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(reg, 0x01));
 		host1x_pushbuf_relocate(pb, attr->bo->bo, attr->offset, 0);
 		host1x_pushbuf_push(pb, 0xdeadbeef);
 
-		stride = attr->stride * sizeof(float);
-
-		value = stride << 8 | attr->size << 4 | HOST1X_GR3D_FLOAT;
-
-		host1x_pushbuf_push(pb, value);
+		host1x_shadow_write(shadow, pb, reg + 1,
+				    grate_attribute_mode(attr));
 	}
 
 	/* primitive indices */
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x121, 0x03));
 	host1x_pushbuf_relocate(pb, bo->bo, offset, 0);
 	host1x_pushbuf_push(pb, 0xdeadbeef);
-	host1x_pushbuf_push(pb, 0xc8000000 | (index << 28) | (mode << 24));
-	host1x_pushbuf_push(pb, (count - 1) << 20);
+
+	if (record) {
+		err = grate_draw_patch(grate->draw.tail, pb,
+				       GRATE_DRAW_PATCH_PRIMITIVE);
+		if (err < 0)
+			return;
+	}
+
+	host1x_pushbuf_push(pb, patches[GRATE_DRAW_PATCH_PRIMITIVE]);
+
+	if (record) {
+		err = grate_draw_patch(grate->draw.tail, pb,
+				       GRATE_DRAW_PATCH_COUNT);
+		if (err < 0)
+			return;
+	}
+
+	host1x_pushbuf_push(pb, patches[GRATE_DRAW_PATCH_COUNT]);
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xe27, 0x02));
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x01));
@@ -550,25 +787,60 @@ void grate_draw_elements(struct grate *grate, enum grate_primitive type,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 0x01));
 	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
 
-	err = host1x_client_submit(gr3d->client, job);
+	if (record)
+		host1x_template_end(grate->draw.tail, pb);
+
+	err = host1x_batch_end(gr3d->batch);
+	if (err < 0)
+		grate_error("host1x_batch_end() failed: %d\n", err);
+}
+
+void grate_flush(struct grate *grate)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct host1x_fence fences[2];
+	int err;
+
+	err = host1x_batch_flush(gr3d->batch, &fences[1]);
 	if (err < 0) {
-		host1x_job_free(job);
+		grate_error("host1x_batch_flush() failed: %d\n", err);
 		return;
 	}
 
-	host1x_job_free(job);
+	fences[0] = grate->gr2d_fence;
 
-	err = host1x_client_flush(gr3d->client, &fence);
+	err = host1x_fence_wait_all(fences, 2, -1);
 	if (err < 0)
-		return;
-
-	err = host1x_client_wait(gr3d->client, fence, -1);
-	if (err < 0)
-		return;
+		grate_error("host1x_fence_wait_all() failed: %d\n", err);
 }
 
-void grate_flush(struct grate *grate)
+/*
+ * Submits all pending rendering without waiting for it. The returned file
+ * descriptor becomes readable once the rendering has completed, so that it
+ * can be polled along with other events. It needs to be closed by the
+ * caller. Returns a negative error code on failure.
+ */
+int grate_flush_fd(struct grate *grate)
 {
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct host1x_fence fences[2];
+	int err, fd;
+
+	err = host1x_batch_flush(gr3d->batch, &fences[1]);
+	if (err < 0) {
+		grate_error("host1x_batch_flush() failed: %d\n", err);
+		return err;
+	}
+
+	fences[0] = grate->gr2d_fence;
+
+	err = host1x_fence_get_fd(grate->host1x, fences, 2, &fd);
+	if (err < 0) {
+		grate_error("host1x_fence_get_fd() failed: %d\n", err);
+		return err;
+	}
+
+	return fd;
 }
 
 struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
@@ -578,40 +850,64 @@ struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 						   unsigned long flags)
 {
 	struct grate_framebuffer *fb;
-	unsigned int bpp = 32;
+	unsigned int bpp, i;
+
+	switch (format) {
+	case GRATE_RGBA8888:
+		bpp = 32;
+		break;
 
-	if (format != GRATE_RGBA8888)
+	case GRATE_RGB565:
+		bpp = 16;
+		break;
+
+	default:
 		return NULL;
+	}
 
 	fb = calloc(1, sizeof(*fb));
 	if (!fb)
 		return NULL;
 
-	fb->front = host1x_framebuffer_create(grate->host1x, width, height,
-					      bpp, 0);
-	if (!fb->front) {
-		free(fb);
-		return NULL;
-	}
+	fb->flags = flags;
+
+	if (flags & GRATE_QUAD_BUFFERED)
+		fb->num_buffers = 4;
+	else if (flags & GRATE_TRIPLE_BUFFERED)
+		fb->num_buffers = 3;
+	else if (flags & GRATE_DOUBLE_BUFFERED)
+		fb->num_buffers = 2;
+	else
+		fb->num_buffers = 1;
+
+	for (i = 0; i < fb->num_buffers; i++) {
+		fb->buffers[i] = host1x_framebuffer_create(grate->host1x,
+							   width, height,
+							   bpp, 0);
+		if (!fb->buffers[i]) {
+			while (i--)
+				host1x_framebuffer_free(fb->buffers[i]);
 
-	if (flags & GRATE_DOUBLE_BUFFERED) {
-		fb->back = host1x_framebuffer_create(grate->host1x, width,
-						     height, bpp, 0);
-		if (!fb->back) {
-			host1x_framebuffer_free(fb->front);
 			free(fb);
 			return NULL;
 		}
 	}
 
+	fb->front = fb->buffers[0];
+
+	if (fb->num_buffers > 1)
+		fb->back = fb->buffers[1];
+
 	return fb;
 }
 
 void grate_framebuffer_free(struct grate_framebuffer *fb)
 {
+	unsigned int i;
+
 	if (fb) {
-		host1x_framebuffer_free(fb->front);
-		host1x_framebuffer_free(fb->back);
+		for (i = 0; i < fb->num_buffers; i++)
+			host1x_framebuffer_free(fb->buffers[i]);
 	}
 
 	free(fb);
@@ -625,6 +921,196 @@ void grate_framebuffer_swap(struct grate_framebuffer *fb)
 	fb->back = tmp;
 }
 
+static void grate_framebuffer_flip_done(struct grate *grate,
+					struct grate_framebuffer *fb,
+					const struct host1x_flip *flip)
+{
+	unsigned int index = grate->num_flips++ % GRATE_MAX_FLIPS;
+
+	grate->flips[index] = *flip;
+	fb->front = fb->pending;
+	fb->pending = NULL;
+}
+
+/*
+ * Retires the pending flip once it has completed. Waits at most timeout
+ * milliseconds for it, or indefinitely if timeout is negative.
+ */
+static int grate_framebuffer_wait_flip(struct grate *grate,
+				       struct grate_framebuffer *fb,
+				       int timeout)
+{
+	struct host1x_flip flip;
+	int err;
+
+	if (!fb->pending)
+		return 0;
+
+	err = grate_display_wait_flip(grate->display, timeout, &flip);
+	if (err < 0)
+		return err;
+
+	grate_framebuffer_flip_done(grate, fb, &flip);
+
+	return 0;
+}
+
+/*
+ * The frame scheduler of pipelined framebuffers. Frames usually start by
+ * clearing the back buffer to the same color as the previous one, so that
+ * clear is queued on gr2d as soon as the next back buffer is known, while
+ * gr3d is still busy rendering the frame that was just presented. Once the
+ * application asks for the clear, only the color needs to be checked.
+ */
+static void grate_framebuffer_schedule(struct grate *grate,
+				       struct grate_framebuffer *fb)
+{
+	if (!(fb->flags & GRATE_PIPELINED) || !fb->back)
+		return;
+
+	if (!fb->cleared || fb->precleared == fb->back)
+		return;
+
+	if (grate_clear_buffer(grate, fb->back, &fb->color) < 0)
+		return;
+
+	fb->precleared = fb->back;
+	fb->precolor = fb->color;
+	fb->cleared = false;
+}
+
+static void grate_framebuffer_wait_back(struct grate *grate,
+					struct grate_framebuffer *fb)
+{
+	unsigned int i;
+	int err;
+
+	/* pick up flips that have completed in the meantime */
+	grate_framebuffer_wait_flip(grate, fb, 0);
+
+	while (true) {
+		for (i = 0; i < fb->num_buffers; i++) {
+			if (fb->buffers[i] != fb->front &&
+			    fb->buffers[i] != fb->pending) {
+				fb->back = fb->buffers[i];
+				return;
+			}
+		}
+
+		/*
+		 * The flip is still pending with the display, so keep handling
+		 * its events until it completes.
+		 */
+		err = grate_framebuffer_wait_flip(grate, fb, 1000);
+		if (err == 0)
+			continue;
+
+		grate_error("failed to wait for page flip: %d\n", err);
+
+		if (err == -ETIMEDOUT)
+			continue;
+
+		/*
+		 * The flip will never be seen to complete, so forget about it
+		 * and show its buffer directly. The previous front buffer then
+		 * becomes the back buffer.
+		 */
+		grate_display_cancel_flip(grate->display);
+		fb->back = fb->pending;
+		fb->pending = NULL;
+		grate_display_show(grate->display, fb, false);
+		return;
+	}
+}
+
+/*
+ * Makes a buffer that is neither scanned out nor queued for scanout the
+ * back buffer. Only blocks if all of them are, which with more than two
+ * buffers lets the next frame be rendered while a flip is pending.
+ */
+void grate_framebuffer_acquire(struct grate *grate,
+			       struct grate_framebuffer *fb)
+{
+	if (!fb->back && fb->num_buffers > 1)
+		grate_framebuffer_wait_back(grate, fb);
+
+	grate_framebuffer_schedule(grate, fb);
+}
+
+/*
+ * Queues the back buffer for scanout at the next vertical blank without
+ * waiting for it. The back buffer must be acquired again before the next
+ * frame is rendered.
+ */
+void grate_framebuffer_present(struct grate *grate,
+			       struct grate_framebuffer *fb)
+{
+	struct grate_options *options = grate->options;
+	int err, fd;
+
+	/* a clear done ahead of time only stands in for this frame's clear */
+	fb->precleared = NULL;
+
+	if (!grate->display || !fb->back) {
+		grate_flush(grate);
+	} else {
+		/* let the display wait for rendering instead of the CPU */
+		fd = grate_flush_fd(grate);
+		if (fd < 0)
+			grate_flush(grate);
+		else
+			host1x_framebuffer_set_fence(fb->back, fd);
+	}
+
+	if (grate->overlay) {
+		grate_overlay_show(grate->overlay, fb, 0, 0, options->width,
+				   options->height, options->vsync);
+		return;
+	}
+
+	if (!grate->display) {
+		grate_framebuffer_save(fb, "test.png");
+		return;
+	}
+
+	if (!options->vsync || !fb->back ||
+	    !grate_display_can_flip(grate->display)) {
+		grate_display_show(grate->display, fb, options->vsync);
+		return;
+	}
+
+	/* only one flip can be queued at a time */
+	err = grate_framebuffer_wait_flip(grate, fb, 1000);
+	if (err == -ETIMEDOUT) {
+		/*
+		 * Drop the frame but keep the back buffer. The flip stays
+		 * pending and is retired by a later wait once it completes.
+		 */
+		grate_error("failed to wait for page flip: %d\n", err);
+		return;
+	}
+
+	if (err < 0) {
+		/* the flip will never be seen to complete, show the frame */
+		grate_error("failed to wait for page flip: %d\n", err);
+		grate_display_cancel_flip(grate->display);
+		fb->front = fb->pending;
+		fb->pending = NULL;
+		grate_display_show(grate->display, fb, false);
+		return;
+	}
+
+	err = grate_display_flip(grate->display, fb->back);
+	if (err < 0) {
+		grate_error("grate_display_flip() failed: %d\n", err);
+		grate_display_show(grate->display, fb, false);
+		return;
+	}
+
+	fb->pending = fb->back;
+	fb->back = NULL;
+}
+
 void grate_framebuffer_save(struct grate_framebuffer *fb, const char *path)
 {
 	host1x_framebuffer_save(fb->back, path);
@@ -632,24 +1118,59 @@ void grate_framebuffer_save(struct grate_framebuffer *fb, const char *path)
 
 void grate_use_program(struct grate *grate, struct grate_program *program)
 {
+	if (program != grate->program)
+		grate->emitted.program = NULL;
+
 	grate->program = program;
 }
 
 void grate_swap_buffers(struct grate *grate)
 {
-	if (grate->display || grate->overlay) {
-		struct grate_options *options = grate->options;
+	grate_framebuffer_present(grate, grate->fb);
+	grate_framebuffer_acquire(grate, grate->fb);
+}
 
-		if (grate->overlay)
-			grate_overlay_show(grate->overlay, grate->fb, 0, 0,
-					   options->width, options->height,
-					   options->vsync);
-		else
-			grate_display_show(grate->display, grate->fb,
-					   options->vsync);
-	} else {
-		grate_framebuffer_save(grate->fb, "test.png");
+/*
+ * Returns the completion times of up to count of the most recent page
+ * flips, oldest first, in microseconds of CLOCK_MONOTONIC.
+ */
+unsigned int grate_get_flip_timestamps(struct grate *grate,
+				       uint64_t *timestamps,
+				       unsigned int count)
+{
+	const struct host1x_flip *flip;
+	unsigned int i;
+
+	count = grate_get_recent_flips(grate, count);
+
+	for (i = 0; i < count; i++) {
+		flip = grate_get_recent_flip(grate, count, i);
+		timestamps[i] = flip->timestamp;
 	}
+
+	return count;
+}
+
+/* clamps count to the number of flips that are still recorded */
+unsigned int grate_get_recent_flips(struct grate *grate, unsigned int count)
+{
+	if (count > grate->num_flips)
+		count = grate->num_flips;
+
+	if (count > GRATE_MAX_FLIPS)
+		count = GRATE_MAX_FLIPS;
+
+	return count;
+}
+
+/* returns the i-th of the count most recent flips, oldest first */
+const struct host1x_flip *grate_get_recent_flip(struct grate *grate,
+						unsigned int count,
+						unsigned int i)
+{
+	unsigned int first = grate->num_flips - count;
+
+	return &grate->flips[(first + i) % GRATE_MAX_FLIPS];
 }
 
 void grate_wait_for_key(struct grate *grate)
@@ -46,9 +46,14 @@ enum grate_type {
 
 enum grate_format {
 	GRATE_RGBA8888,
+	GRATE_RGB565,
 };
 
 #define GRATE_DOUBLE_BUFFERED (1 << 0)
+#define GRATE_TRIPLE_BUFFERED (1 << 1)
+#define GRATE_QUAD_BUFFERED (1 << 2)
+/* clear the next back buffer on gr2d while gr3d renders the current one */
+#define GRATE_PIPELINED (1 << 3)
 
 struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 						   unsigned int width,
@@ -57,6 +62,10 @@ struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 						   unsigned long flags);
 void grate_framebuffer_free(struct grate_framebuffer *fb);
 void grate_framebuffer_save(struct grate_framebuffer *fb, const char *path);
+void grate_framebuffer_acquire(struct grate *grate,
+			       struct grate_framebuffer *fb);
+void grate_framebuffer_present(struct grate *grate,
+			       struct grate_framebuffer *fb);
 
 struct grate_display *grate_display_open(struct grate *grate);
 void grate_display_close(struct grate_display *display);
@@ -82,6 +91,7 @@ struct grate_options {
 	unsigned int x, y, width, height;
 	bool fullscreen;
 	bool vsync;
+	enum grate_format format;
 };
 
 bool grate_parse_command_line(struct grate_options *options, int argc,
@@ -117,7 +127,11 @@ void grate_draw_elements(struct grate *grate, enum grate_primitive type,
 			 struct grate_bo *bo, unsigned long offset);
 
 void grate_flush(struct grate *grate);
+int grate_flush_fd(struct grate *grate);
 void grate_swap_buffers(struct grate *grate);
+unsigned int grate_get_flip_timestamps(struct grate *grate,
+				       uint64_t *timestamps,
+				       unsigned int count);
 void grate_wait_for_key(struct grate *grate);
 bool grate_key_pressed(struct grate *grate);
 
@@ -144,11 +158,39 @@ void grate_program_free(struct grate_program *program);
 void grate_program_link(struct grate_program *program);
 void grate_use_program(struct grate *grate, struct grate_program *program);
 
+struct grate_percentiles {
+	float p50;
+	float p90;
+	float p99;
+	float max;
+};
+
+/* frame pacing of recent page flips, times are in milliseconds */
+struct grate_frame_stats {
+	unsigned int frames;
+	/* vertical blanks at which no new frame was ready */
+	unsigned int missed;
+	/* frames shown for a different number of refreshes than the last */
+	unsigned int judder;
+	/* refresh period of the display */
+	float period;
+	/* between consecutive flips */
+	struct grate_percentiles interval;
+	/* from submission until rendering completed */
+	struct grate_percentiles render;
+	/* from submission until scanout */
+	struct grate_percentiles latency;
+};
+
+void grate_get_frame_stats(struct grate *grate, unsigned int count,
+			   struct grate_frame_stats *stats);
+
 struct grate_profile;
 
 struct grate_profile *grate_profile_start(struct grate *grate);
 void grate_profile_free(struct grate_profile *profile);
 void grate_profile_sample(struct grate_profile *profile);
+float grate_profile_get_time(struct grate_profile *profile);
 void grate_profile_finish(struct grate_profile *profile);
 
 #endif
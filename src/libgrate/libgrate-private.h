@@ -2,8 +2,10 @@
 #define GRATE_LIBGRATE_PRIVATE_H 1
 
 #include "grate.h"
+#include "host1x.h"
 
 #define GRATE_MAX_ATTRIBUTES 16
+#define GRATE_MAX_FLIPS 128
 
 struct host1x_pushbuf;
 
@@ -53,15 +55,41 @@ struct grate_program {
 	float uniform[256 * 4];
 };
 
-void grate_shader_emit(struct host1x_pushbuf *pb, struct grate_shader *shader);
+void grate_shader_emit(struct host1x_shadow *shadow, struct host1x_pushbuf *pb,
+		       struct grate_shader *shader);
+
+#define GRATE_MAX_BUFFERS 4
 
 struct grate_framebuffer {
+	/* scanned out, or waiting to be */
 	struct host1x_framebuffer *front;
+	/* rendered to, NULL until acquired */
 	struct host1x_framebuffer *back;
+	/* queued for scanout at the next vertical blank */
+	struct host1x_framebuffer *pending;
+
+	struct host1x_framebuffer *buffers[GRATE_MAX_BUFFERS];
+	unsigned int num_buffers;
+	unsigned long flags;
+
+	/* the current frame was cleared, and to which color */
+	bool cleared;
+	struct grate_color color;
+
+	/* back buffer that was cleared ahead of time, and to which color */
+	struct host1x_framebuffer *precleared;
+	struct grate_color precolor;
 };
 
 void grate_framebuffer_swap(struct grate_framebuffer *fb);
 
+bool grate_display_can_flip(struct grate_display *display);
+int grate_display_flip(struct grate_display *display,
+		       struct host1x_framebuffer *fb);
+int grate_display_wait_flip(struct grate_display *display, int timeout,
+			    struct host1x_flip *flip);
+void grate_display_cancel_flip(struct grate_display *display);
+
 struct grate_viewport {
 	float x;
 	float y;
@@ -69,6 +97,28 @@ struct grate_viewport {
 	float height;
 };
 
+/*
+ * Everything a draw depends on apart from its buffers, primitive, count and
+ * viewport. Consecutive draws with the same key produce the same command
+ * stream.
+ */
+struct grate_draw_key {
+	struct grate_program *program;
+	unsigned long generation;
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	uint32_t attributes[GRATE_MAX_ATTRIBUTES];
+};
+
+enum grate_draw_patch {
+	GRATE_DRAW_PATCH_PRIMITIVE,
+	GRATE_DRAW_PATCH_COUNT,
+	/* X bias, Y bias, X scale and Y scale */
+	GRATE_DRAW_PATCH_VIEWPORT,
+	GRATE_DRAW_NUM_PATCHES = GRATE_DRAW_PATCH_VIEWPORT + 4,
+};
+
 struct grate {
 	struct grate_options *options;
 	struct grate_display *display;
@@ -81,9 +131,33 @@ struct grate {
 
 	struct grate_vertex_attribute attributes[GRATE_MAX_ATTRIBUTES];
 
+	/* program whose shaders were last uploaded to gr3d */
+	struct {
+		struct grate_program *program;
+		unsigned long generation;
+	} emitted;
+
+	/* the draw stream before and after the uniforms are uploaded */
+	struct {
+		struct grate_draw_key key;
+		struct host1x_template *head;
+		struct host1x_template *tail;
+	} draw;
+
+	struct host1x_fence gr2d_fence;
+
+	/* timelines of the most recent page flips */
+	struct host1x_flip flips[GRATE_MAX_FLIPS];
+	unsigned int num_flips;
+
 	struct host1x *host1x;
 };
 
+unsigned int grate_get_recent_flips(struct grate *grate, unsigned int count);
+const struct host1x_flip *grate_get_recent_flip(struct grate *grate,
+						unsigned int count,
+						unsigned int i);
+
 #define grate_error(fmt, args...) \
 	fprintf(stderr, "ERROR: " fmt, ##args)
 
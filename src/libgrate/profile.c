@@ -21,14 +21,18 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <math.h>
+#include <string.h>
 #include <time.h>
 
 #include "libgrate-private.h"
 
 struct grate_profile {
+	struct grate *grate;
 	struct timespec start;
 	struct timespec end;
 	unsigned int frames;
+	unsigned int flips;
 };
 
 static float timespec_diff(const struct timespec *start,
@@ -45,12 +49,146 @@ static float timespec_diff(const struct timespec *start,
 	return seconds + ns / 1000000000.0f;
 }
 
+static int compare_floats(const void *a, const void *b)
+{
+	float x = *(const float *)a, y = *(const float *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* sorts the values and picks nearest-rank percentiles */
+static void grate_percentiles_compute(struct grate_percentiles *p,
+				      float *values, unsigned int count)
+{
+	memset(p, 0, sizeof(*p));
+
+	if (count == 0)
+		return;
+
+	qsort(values, count, sizeof(*values), compare_floats);
+
+	p->p50 = values[(50 * count + 99) / 100 - 1];
+	p->p90 = values[(90 * count + 99) / 100 - 1];
+	p->p99 = values[(99 * count + 99) / 100 - 1];
+	p->max = values[count - 1];
+}
+
+/*
+ * Computes frame pacing statistics over up to count of the most recent
+ * page flips. The number of refreshes that a frame was shown for is taken
+ * from the vertical blank sequence numbers if the display provides them,
+ * otherwise it is estimated from the shortest flip interval.
+ */
+void grate_get_frame_stats(struct grate *grate, unsigned int count,
+			   struct grate_frame_stats *stats)
+{
+	float intervals[GRATE_MAX_FLIPS], periods[GRATE_MAX_FLIPS];
+	float render[GRATE_MAX_FLIPS], latency[GRATE_MAX_FLIPS];
+	unsigned int num_periods = 0, num_render = 0, num_latency = 0;
+	unsigned int i, vblanks, last = 0;
+	const struct host1x_flip *flip, *prev;
+	float shortest = 0.0f;
+
+	memset(stats, 0, sizeof(*stats));
+
+	count = grate_get_recent_flips(grate, count);
+	stats->frames = count;
+
+	for (i = 0; i < count; i++) {
+		flip = grate_get_recent_flip(grate, count, i);
+
+		if (flip->submitted && flip->completed >= flip->submitted)
+			render[num_render++] =
+				(flip->completed - flip->submitted) / 1000.0f;
+
+		if (flip->submitted && flip->timestamp >= flip->submitted)
+			latency[num_latency++] =
+				(flip->timestamp - flip->submitted) / 1000.0f;
+
+		if (i == 0)
+			continue;
+
+		prev = grate_get_recent_flip(grate, count, i - 1);
+		intervals[i - 1] = (flip->timestamp - prev->timestamp) / 1000.0f;
+
+		if (i == 1 || intervals[i - 1] < shortest)
+			shortest = intervals[i - 1];
+
+		if (flip->sequence > prev->sequence)
+			periods[num_periods++] = intervals[i - 1] /
+				(flip->sequence - prev->sequence);
+	}
+
+	grate_percentiles_compute(&stats->render, render, num_render);
+	grate_percentiles_compute(&stats->latency, latency, num_latency);
+
+	if (count < 2)
+		return;
+
+	if (num_periods > 0) {
+		struct grate_percentiles p;
+
+		grate_percentiles_compute(&p, periods, num_periods);
+		stats->period = p.p50;
+	} else {
+		stats->period = shortest;
+	}
+
+	/* the intervals are sorted below, so count refreshes first */
+	for (i = 1; i < count; i++) {
+		flip = grate_get_recent_flip(grate, count, i);
+		prev = grate_get_recent_flip(grate, count, i - 1);
+
+		if (flip->sequence > prev->sequence)
+			vblanks = flip->sequence - prev->sequence;
+		else if (stats->period > 0.0f)
+			vblanks = lroundf(intervals[i - 1] / stats->period);
+		else
+			vblanks = 1;
+
+		if (vblanks == 0)
+			vblanks = 1;
+
+		stats->missed += vblanks - 1;
+
+		if (last && vblanks != last)
+			stats->judder++;
+
+		last = vblanks;
+	}
+
+	grate_percentiles_compute(&stats->interval, intervals, count - 1);
+}
+
+static void grate_percentiles_dump(const char *name,
+				   const struct grate_percentiles *p, FILE *fp)
+{
+	fprintf(fp, "  %-10s %8.3f %8.3f %8.3f %8.3f\n", name, p->p50, p->p90,
+		p->p99, p->max);
+}
+
 static void grate_profile_dump(struct grate_profile *profile, FILE *fp)
 {
 	float time = timespec_diff(&profile->start, &profile->end);
+	struct grate_frame_stats stats;
 
 	fprintf(fp, "%u frames in %.3f seconds: %.2f fps\n", profile->frames,
 		time, profile->frames / time);
+
+	grate_get_frame_stats(profile->grate,
+			      profile->grate->num_flips - profile->flips,
+			      &stats);
+	if (stats.frames < 2)
+		return;
+
+	fprintf(fp, "%u flips, refresh period %.3f ms, %u missed vblanks, "
+		"%u judder\n", stats.frames, stats.period, stats.missed,
+		stats.judder);
+	fprintf(fp, "  %-10s %8s %8s %8s %8s\n", "ms", "50th", "90th", "99th",
+		"max");
+	grate_percentiles_dump("interval", &stats.interval, fp);
+	grate_percentiles_dump("render", &stats.render, fp);
+	grate_percentiles_dump("latency", &stats.latency, fp);
 }
 
 struct grate_profile *grate_profile_start(struct grate *grate)
@@ -62,6 +200,8 @@ struct grate_profile *grate_profile_start(struct grate *grate)
 		return NULL;
 
 	clock_gettime(CLOCK_MONOTONIC, &profile->start);
+	profile->flips = grate->num_flips;
+	profile->grate = grate;
 	profile->frames = 0;
 
 	return profile;
@@ -77,6 +217,16 @@ void grate_profile_sample(struct grate_profile *profile)
 	profile->frames++;
 }
 
+/* returns the number of seconds since the profile was started */
+float grate_profile_get_time(struct grate_profile *profile)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return timespec_diff(&profile->start, &now);
+}
+
 void grate_profile_finish(struct grate_profile *profile)
 {
 	clock_gettime(CLOCK_MONOTONIC, &profile->end);
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "../libhost1x/host1x-private.h"
 #include "libgrate-private.h"
 #include "host1x.h"
 #include "libcgc.h"
@@ -35,14 +36,46 @@ struct grate_shader {
 
 	unsigned int num_words;
 	uint32_t *words;
+
+	/* copy of the words that jobs reference instead of pushing them */
+	struct host1x_fragment *fragment;
 };
 
-void grate_shader_emit(struct host1x_pushbuf *pb, struct grate_shader *shader)
+void grate_shader_emit(struct host1x_shadow *shadow, struct host1x_pushbuf *pb,
+		       struct grate_shader *shader)
 {
-	unsigned int i;
+	if (shader->fragment)
+		host1x_shadow_gather(shadow, pb, shader->fragment);
+	else
+		host1x_shadow_emit(shadow, pb, shader->words,
+				   shader->num_words);
+}
+
+static struct host1x_fragment *grate_shader_record(struct grate *grate,
+						   struct grate_shader *shader)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct host1x_fragment *fragment;
+	struct host1x_pushbuf *pb;
+	int err;
+
+	fragment = host1x_fragment_create(grate->host1x,
+					  gr3d->client->syncpts[0].id);
+	if (!fragment)
+		return NULL;
+
+	pb = host1x_fragment_begin(fragment);
 
-	for (i = 0; i < shader->num_words; i++)
-		host1x_pushbuf_push(pb, shader->words[i]);
+	err = host1x_pushbuf_push_array(pb, shader->words, shader->num_words);
+	if (err == 0)
+		err = host1x_fragment_end(fragment);
+
+	if (err < 0) {
+		host1x_fragment_free(fragment);
+		return NULL;
+	}
+
+	return fragment;
 }
 
 struct grate_shader *grate_shader_new(struct grate *grate,
@@ -132,13 +165,19 @@ struct grate_shader *grate_shader_new(struct grate *grate,
 
 	free(code);
 
+	/* shaders are pushed as is if they can't be recorded */
+	if (shader->num_words > 0)
+		shader->fragment = grate_shader_record(grate, shader);
+
 	return shader;
 }
 
 void grate_shader_free(struct grate_shader *shader)
 {
-	if (shader)
+	if (shader) {
+		host1x_fragment_free(shader->fragment);
 		cgc_shader_free(shader->cgc);
+	}
 
 	free(shader);
 }
@@ -47,7 +47,8 @@ void grate_shader_free(struct grate_shader *shader)
 	free(shader);
 }
 
-void grate_shader_emit(struct host1x_pushbuf *pb, struct grate_shader *shader)
+void grate_shader_emit(struct host1x_shadow *shadow, struct host1x_pushbuf *pb,
+		       struct grate_shader *shader)
 {
 }
 
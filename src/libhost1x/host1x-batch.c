@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * A batch collects the command streams of many operations on the same
+ * client in a single job, so that they can be submitted to the kernel all
+ * at once. The batch is submitted when it is flushed explicitly or when the
+ * job has grown beyond the size limit of the batch.
+ */
+struct host1x_batch *host1x_batch_create(struct host1x_client *client,
+					 struct host1x_ring *ring,
+					 unsigned long limit)
+{
+	struct host1x_syncpt *syncpt = &client->syncpts[0];
+	struct host1x_batch *batch;
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+
+	batch->job = host1x_job_create(syncpt->id);
+	if (!batch->job) {
+		free(batch);
+		return NULL;
+	}
+
+	batch->client = client;
+	batch->ring = ring;
+	batch->limit = limit;
+
+	return batch;
+}
+
+void host1x_batch_free(struct host1x_batch *batch)
+{
+	if (!batch)
+		return;
+
+	host1x_fence_wait(&batch->fence, -1);
+	host1x_job_free(batch->job);
+	free(batch);
+}
+
+/*
+ * Returns the push buffer that the next operation should be written to. The
+ * operation must be completed with host1x_batch_end().
+ */
+struct host1x_pushbuf *host1x_batch_begin(struct host1x_batch *batch)
+{
+	if (!batch->pb) {
+		host1x_job_reset(batch->job);
+
+		batch->pb = host1x_job_append_ring(batch->job, batch->ring);
+	}
+
+	return batch->pb;
+}
+
+static int host1x_batch_submit(struct host1x_batch *batch)
+{
+	int err;
+
+	if (batch->num_ops == 0)
+		return 0;
+
+	err = host1x_client_submit_async(batch->client, batch->job,
+					 &batch->fence);
+
+	batch->num_ops = 0;
+	batch->pb = NULL;
+
+	if (err < 0)
+		return err;
+
+	batch->submits++;
+
+	return 0;
+}
+
+int host1x_batch_end(struct host1x_batch *batch)
+{
+	struct host1x_job *job = batch->job;
+	unsigned long words = 0;
+	unsigned int i;
+
+	batch->num_ops++;
+	batch->ops++;
+
+	for (i = 0; i < job->num_pushbufs; i++)
+		words += job->pushbufs[i]->length;
+
+	if (words >= batch->limit)
+		return host1x_batch_submit(batch);
+
+	return 0;
+}
+
+/*
+ * Submit all pending operations. If a fence is passed it is set to track the
+ * completion of all operations submitted so far, otherwise this waits for
+ * them to complete.
+ */
+int host1x_batch_flush(struct host1x_batch *batch, struct host1x_fence *fence)
+{
+	int err;
+
+	err = host1x_batch_submit(batch);
+	if (err < 0)
+		return err;
+
+	if (fence) {
+		*fence = batch->fence;
+		return 0;
+	}
+
+	return host1x_fence_wait(&batch->fence, -1);
+}
+
+/*
+ * Makes the operations that follow wait for a fence, usually one of another
+ * client. The wait happens in the command stream, so the CPU doesn't block.
+ */
+int host1x_batch_wait(struct host1x_batch *batch, struct host1x_fence *fence)
+{
+	struct host1x_pushbuf *pb;
+	int err;
+
+	/* a channel executes its own jobs in order anyway */
+	if (fence->client == batch->client)
+		return 0;
+
+	err = host1x_fence_query(fence);
+	if (err != 0)
+		return err < 0 ? err : 0;
+
+	pb = host1x_batch_begin(batch);
+	if (!pb)
+		return -ENOMEM;
+
+	return host1x_pushbuf_wait(pb, fence, batch->client->class);
+}
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * Freed buffer objects are kept around, together with their mappings, in
+ * buckets of fixed sizes so that subsequent allocations of a similar size
+ * can be served without going back to the kernel. There are four bucket
+ * sizes per power of two, so rounding up wastes less than a quarter of a
+ * buffer object, but bucket sizes are always multiples of the page size. A
+ * buffer object is only handed out again once the last job that used it has
+ * completed, and buffer objects that haven't been reused for a while are
+ * released.
+ *
+ * The cache is shared by all threads that allocate buffer objects from the
+ * same host1x instance and is therefore protected by a lock.
+ */
+#define HOST1X_BO_CACHE_MIN_SIZE 4096
+#define HOST1X_BO_CACHE_TIMEOUT 1 /* seconds */
+
+static time_t host1x_bo_cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+void host1x_bo_cache_init(struct host1x_bo_cache *cache)
+{
+	pthread_mutex_init(&cache->lock, NULL);
+}
+
+void host1x_bo_cache_exit(struct host1x_bo_cache *cache)
+{
+	host1x_bo_cache_purge(cache);
+	pthread_mutex_destroy(&cache->lock);
+}
+
+/* returns the size of the bucket that follows one of the given size */
+static size_t host1x_bo_cache_next_size(size_t size)
+{
+	unsigned int shift = 8 * sizeof(long) - 1 - __builtin_clzl(size);
+	size_t step = ((size_t)1 << shift) / 4;
+
+	if (step < HOST1X_BO_CACHE_MIN_SIZE)
+		step = HOST1X_BO_CACHE_MIN_SIZE;
+
+	return size + step;
+}
+
+/* returns the index of the smallest bucket that can hold size bytes */
+static int host1x_bo_cache_bucket(size_t size)
+{
+	size_t bucket_size = HOST1X_BO_CACHE_MIN_SIZE;
+	int i;
+
+	for (i = 0; i < HOST1X_BO_CACHE_BUCKETS; i++) {
+		if (size <= bucket_size)
+			return i;
+
+		bucket_size = host1x_bo_cache_next_size(bucket_size);
+	}
+
+	return -ENOSPC;
+}
+
+static size_t host1x_bo_cache_bucket_size(int bucket)
+{
+	size_t size = HOST1X_BO_CACHE_MIN_SIZE;
+
+	while (bucket-- > 0)
+		size = host1x_bo_cache_next_size(size);
+
+	return size;
+}
+
+static void host1x_bo_cache_unlink(struct host1x_bo_cache *cache,
+				   struct host1x_bo_bucket *bucket,
+				   struct host1x_bo *bo)
+{
+	if (bo->prev)
+		bo->prev->next = bo->next;
+	else
+		bucket->first = bo->next;
+
+	if (bo->next)
+		bo->next->prev = bo->prev;
+	else
+		bucket->last = bo->prev;
+
+	bo->prev = bo->next = NULL;
+
+	cache->stats.num_bos--;
+	cache->stats.size -= bo->size;
+}
+
+/*
+ * Buckets are sorted by the time at which their buffer objects were freed,
+ * so eviction stops at the first buffer object that is recent enough.
+ */
+static void host1x_bo_cache_evict(struct host1x_bo_cache *cache, time_t now)
+{
+	struct host1x_bo *bo;
+	int i;
+
+	for (i = 0; i < HOST1X_BO_CACHE_BUCKETS; i++) {
+		struct host1x_bo_bucket *bucket = &cache->buckets[i];
+
+		while ((bo = bucket->first) != NULL) {
+			if (now - bo->freed <= HOST1X_BO_CACHE_TIMEOUT)
+				break;
+
+			host1x_bo_cache_unlink(cache, bucket, bo);
+			cache->stats.evictions++;
+			bo->free(bo);
+		}
+	}
+}
+
+/*
+ * Checks the fence of a cached buffer object against the syncpoint value that
+ * was last observed. This never reads the syncpoint, so it is cheap enough to
+ * be done with the cache locked.
+ */
+static bool host1x_bo_cache_idle(struct host1x_bo *bo)
+{
+	struct host1x_client *client = bo->fence.client;
+	struct host1x_syncpt *syncpt;
+
+	if (!client)
+		return true;
+
+	syncpt = host1x_client_find_syncpt(client, bo->fence.syncpt);
+
+	return syncpt && host1x_syncpt_expired(syncpt, bo->fence.value);
+}
+
+/*
+ * Unlinks the first idle buffer object with matching flags from a bucket.
+ * If there is none, the fence of the oldest busy one is returned in fence.
+ */
+static struct host1x_bo *host1x_bo_cache_find(struct host1x_bo_cache *cache,
+					      struct host1x_bo_bucket *bucket,
+					      unsigned long flags,
+					      struct host1x_fence *fence)
+{
+	struct host1x_bo *bo;
+
+	memset(fence, 0, sizeof(*fence));
+
+	for (bo = bucket->first; bo; bo = bo->next) {
+		if (bo->flags != flags)
+			continue;
+
+		if (!host1x_bo_cache_idle(bo)) {
+			if (!fence->client)
+				*fence = bo->fence;
+
+			continue;
+		}
+
+		host1x_bo_cache_unlink(cache, bucket, bo);
+		memset(&bo->fence, 0, sizeof(bo->fence));
+
+		/* captures must see a recycled buffer object as a new one */
+		bo->capture_id = 0;
+
+		return bo;
+	}
+
+	return NULL;
+}
+
+/*
+ * Looks up an idle buffer object that can hold size bytes. On a miss, size
+ * is rounded up to the bucket size so that the new buffer object can later
+ * be returned to the cache.
+ *
+ * If none of the buffer objects is known to be idle, the fence of the oldest
+ * one is queried after dropping the lock, so that other threads don't have
+ * to wait for the syscall, and the bucket is scanned again if it signaled.
+ */
+struct host1x_bo *host1x_bo_cache_get(struct host1x_bo_cache *cache,
+				      size_t *size, unsigned long flags)
+{
+	struct host1x_bo_bucket *bucket;
+	struct host1x_fence fence;
+	struct host1x_bo *bo;
+	int index, err;
+
+	pthread_mutex_lock(&cache->lock);
+
+	host1x_bo_cache_evict(cache, host1x_bo_cache_now());
+
+	index = host1x_bo_cache_bucket(*size);
+	if (index < 0) {
+		cache->stats.misses++;
+		pthread_mutex_unlock(&cache->lock);
+		return NULL;
+	}
+
+	bucket = &cache->buckets[index];
+
+	bo = host1x_bo_cache_find(cache, bucket, flags, &fence);
+	if (!bo && fence.client) {
+		pthread_mutex_unlock(&cache->lock);
+
+		/* this updates the cached syncpoint value */
+		err = host1x_fence_query(&fence);
+
+		pthread_mutex_lock(&cache->lock);
+
+		if (err == 1)
+			bo = host1x_bo_cache_find(cache, bucket, flags, &fence);
+	}
+
+	if (bo) {
+		cache->stats.hits++;
+	} else {
+		cache->stats.misses++;
+		*size = host1x_bo_cache_bucket_size(index);
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+	return bo;
+}
+
+/*
+ * Returns false if the buffer object can't be cached, in which case the
+ * caller needs to free it.
+ */
+bool host1x_bo_cache_put(struct host1x_bo_cache *cache, struct host1x_bo *bo)
+{
+	struct host1x_bo_bucket *bucket;
+	time_t now = host1x_bo_cache_now();
+	int index;
+
+	if (bo->shared)
+		return false;
+
+	index = host1x_bo_cache_bucket(bo->size);
+	if (index < 0 || host1x_bo_cache_bucket_size(index) != bo->size)
+		return false;
+
+	bucket = &cache->buckets[index];
+
+	pthread_mutex_lock(&cache->lock);
+
+	bo->freed = now;
+	bo->prev = bucket->last;
+	bo->next = NULL;
+
+	if (bucket->last)
+		bucket->last->next = bo;
+	else
+		bucket->first = bo;
+
+	bucket->last = bo;
+
+	cache->stats.num_bos++;
+	cache->stats.size += bo->size;
+
+	host1x_bo_cache_evict(cache, now);
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return true;
+}
+
+void host1x_bo_cache_purge(struct host1x_bo_cache *cache)
+{
+	struct host1x_bo *bo;
+	int i;
+
+	pthread_mutex_lock(&cache->lock);
+
+	for (i = 0; i < HOST1X_BO_CACHE_BUCKETS; i++) {
+		struct host1x_bo_bucket *bucket = &cache->buckets[i];
+
+		while ((bo = bucket->first) != NULL) {
+			host1x_bo_cache_unlink(cache, bucket, bo);
+			bo->free(bo);
+		}
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void host1x_bo_cache_get_stats(struct host1x_bo_cache *cache,
+			       struct host1x_bo_cache_stats *stats)
+{
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
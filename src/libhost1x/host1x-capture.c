@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+struct host1x_capture {
+	FILE *fp;
+	uint32_t generation;
+	uint32_t next_id;
+
+	/* open-addressed set of the hashes of all blobs written so far */
+	uint64_t *hashes;
+	unsigned long num_hashes;
+	unsigned long max_hashes;
+};
+
+uint64_t host1x_capture_hash(const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static uint64_t *host1x_capture_lookup(uint64_t *hashes, unsigned long max,
+				       uint64_t hash)
+{
+	unsigned long i = hash & (max - 1);
+
+	/* a hash of 0 marks an empty slot, so it is stored as 1 instead */
+	if (hash == 0)
+		hash = 1;
+
+	while (hashes[i] != 0 && hashes[i] != hash)
+		i = (i + 1) & (max - 1);
+
+	return &hashes[i];
+}
+
+/* returns 1 if the hash is new, 0 if it was seen before */
+static int host1x_capture_insert(struct host1x_capture *capture,
+				 uint64_t hash)
+{
+	uint64_t *slot;
+	unsigned long i;
+
+	if (2 * (capture->num_hashes + 1) > capture->max_hashes) {
+		unsigned long max = capture->max_hashes ?
+				    capture->max_hashes * 2 : 256;
+		uint64_t *hashes;
+
+		hashes = calloc(max, sizeof(*hashes));
+		if (!hashes)
+			return -ENOMEM;
+
+		for (i = 0; i < capture->max_hashes; i++) {
+			if (capture->hashes[i] == 0)
+				continue;
+
+			slot = host1x_capture_lookup(hashes, max,
+						     capture->hashes[i]);
+			*slot = capture->hashes[i];
+		}
+
+		free(capture->hashes);
+		capture->hashes = hashes;
+		capture->max_hashes = max;
+	}
+
+	slot = host1x_capture_lookup(capture->hashes, capture->max_hashes,
+				     hash);
+	if (*slot != 0)
+		return 0;
+
+	*slot = hash ? hash : 1;
+	capture->num_hashes++;
+
+	return 1;
+}
+
+static int host1x_capture_write(struct host1x_capture *capture,
+				const void *data, size_t size)
+{
+	if (fwrite(data, 1, size, capture->fp) != size)
+		return -EIO;
+
+	return 0;
+}
+
+static int host1x_capture_record(struct host1x_capture *capture,
+				 uint32_t type, size_t size)
+{
+	struct host1x_capture_record record;
+
+	record.type = type;
+	record.size = size;
+
+	return host1x_capture_write(capture, &record, sizeof(record));
+}
+
+/* writes the data as a blob unless an identical one was written before */
+static int host1x_capture_blob(struct host1x_capture *capture,
+			       const void *data, size_t size, uint64_t *hashp)
+{
+	struct host1x_capture_blob blob;
+	int err;
+
+	blob.hash = host1x_capture_hash(data, size);
+	*hashp = blob.hash;
+
+	err = host1x_capture_insert(capture, blob.hash);
+	if (err <= 0)
+		return err;
+
+	err = host1x_capture_record(capture, HOST1X_CAPTURE_BLOB,
+				    sizeof(blob) + size);
+	if (err < 0)
+		return err;
+
+	err = host1x_capture_write(capture, &blob, sizeof(blob));
+	if (err < 0)
+		return err;
+
+	return host1x_capture_write(capture, data, size);
+}
+
+/*
+ * Assigns an ID to the buffer object when it is first used in a capture. IDs
+ * left over from an earlier capture are replaced.
+ */
+static int host1x_capture_bo(struct host1x_capture *capture,
+			     struct host1x_bo *bo)
+{
+	struct host1x_capture_bo record;
+	int err;
+
+	if (bo->capture_id != 0 &&
+	    bo->capture_generation == capture->generation)
+		return 0;
+
+	bo->capture_id = ++capture->next_id;
+	bo->capture_generation = capture->generation;
+
+	memset(&record, 0, sizeof(record));
+	record.id = bo->capture_id;
+	record.size = bo->size;
+	record.flags = bo->flags;
+
+	err = host1x_capture_record(capture, HOST1X_CAPTURE_BO,
+				    sizeof(record));
+	if (err < 0)
+		return err;
+
+	return host1x_capture_write(capture, &record, sizeof(record));
+}
+
+int host1x_capture_start(struct host1x *host1x, const char *path)
+{
+	struct host1x_capture_header header;
+	struct host1x_capture *capture;
+	int err;
+
+	if (host1x->capture)
+		return -EBUSY;
+
+	capture = calloc(1, sizeof(*capture));
+	if (!capture)
+		return -ENOMEM;
+
+	capture->fp = fopen(path, "wb");
+	if (!capture->fp) {
+		err = -errno;
+		free(capture);
+		return err;
+	}
+
+	capture->generation = ++host1x->capture_generation;
+
+	header.magic = HOST1X_CAPTURE_MAGIC;
+	header.version = HOST1X_CAPTURE_VERSION;
+
+	err = host1x_capture_write(capture, &header, sizeof(header));
+	if (err < 0) {
+		fclose(capture->fp);
+		free(capture);
+		return err;
+	}
+
+	host1x->capture = capture;
+
+	return 0;
+}
+
+void host1x_capture_stop(struct host1x *host1x)
+{
+	struct host1x_capture *capture = host1x->capture;
+
+	if (!capture)
+		return;
+
+	fclose(capture->fp);
+	free(capture->hashes);
+	free(capture);
+
+	host1x->capture = NULL;
+}
+
+static int host1x_capture_submit(struct host1x_capture *capture,
+				 struct host1x_capture_submit *submit,
+				 struct host1x_job *job, struct host1x_bo **bos,
+				 const uint64_t *hashes)
+{
+	struct host1x_capture_cmdbuf cmdbuf;
+	struct host1x_capture_reloc reloc;
+	struct host1x_capture_state state;
+	unsigned int i, j;
+	int err;
+
+	err = host1x_capture_record(capture, HOST1X_CAPTURE_SUBMIT,
+				    sizeof(*submit) +
+				    submit->num_cmdbufs * sizeof(cmdbuf) +
+				    submit->num_relocs * sizeof(reloc) +
+				    submit->num_bos * sizeof(state));
+	if (err < 0)
+		return err;
+
+	err = host1x_capture_write(capture, submit, sizeof(*submit));
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		memset(&cmdbuf, 0, sizeof(cmdbuf));
+		cmdbuf.words = job->pushbufs[i]->length;
+		cmdbuf.hash = hashes[i];
+
+		err = host1x_capture_write(capture, &cmdbuf, sizeof(cmdbuf));
+		if (err < 0)
+			return err;
+	}
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		struct host1x_pushbuf *pb = job->pushbufs[i];
+
+		for (j = 0; j < pb->num_relocs; j++) {
+			struct host1x_pushbuf_reloc *r = &pb->relocs[j];
+
+			memset(&reloc, 0, sizeof(reloc));
+			reloc.cmdbuf = i;
+			reloc.offset = r->source_offset - pb->offset;
+			reloc.target = r->target->capture_id;
+			reloc.target_offset = r->target_offset;
+			reloc.shift = r->shift;
+
+			err = host1x_capture_write(capture, &reloc,
+						   sizeof(reloc));
+			if (err < 0)
+				return err;
+		}
+	}
+
+	for (i = 0; i < submit->num_bos; i++) {
+		memset(&state, 0, sizeof(state));
+		state.id = bos[i]->capture_id;
+		state.hash = hashes[job->num_pushbufs + i];
+
+		err = host1x_capture_write(capture, &state, sizeof(state));
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Records a job right before it is submitted, so that the relocations have
+ * not been patched yet. Relocation targets that are referenced multiple
+ * times have their contents stored only once per submission.
+ */
+int host1x_capture_job(struct host1x_capture *capture,
+		       struct host1x_client *client, struct host1x_job *job)
+{
+	struct host1x_capture_submit submit;
+	unsigned int num_bos = 0, i, j, k;
+	struct host1x_bo **bos;
+	uint64_t *hashes;
+	int err = 0;
+
+	memset(&submit, 0, sizeof(submit));
+	submit.class = client->class;
+	submit.syncpt = job->syncpt;
+	submit.syncpt_incrs = job->syncpt_incrs;
+	submit.num_cmdbufs = job->num_pushbufs;
+
+	for (i = 0; i < job->num_pushbufs; i++)
+		submit.num_relocs += job->pushbufs[i]->num_relocs;
+
+	/* hashes of the command buffers followed by those of the targets */
+	hashes = calloc(submit.num_cmdbufs + submit.num_relocs + 1,
+			sizeof(*hashes));
+	if (!hashes)
+		return -ENOMEM;
+
+	bos = calloc(submit.num_relocs + 1, sizeof(*bos));
+	if (!bos) {
+		free(hashes);
+		return -ENOMEM;
+	}
+
+	/* blobs and buffer objects are declared before the submit record */
+	for (i = 0; i < job->num_pushbufs && err == 0; i++) {
+		struct host1x_pushbuf *pb = job->pushbufs[i];
+
+		err = host1x_capture_blob(capture, pb->bo->ptr + pb->offset,
+					  pb->length * 4, &hashes[i]);
+
+		for (j = 0; j < pb->num_relocs && err == 0; j++) {
+			struct host1x_bo *target = pb->relocs[j].target;
+
+			for (k = 0; k < num_bos; k++)
+				if (bos[k] == target)
+					break;
+
+			if (k < num_bos)
+				continue;
+
+			err = host1x_bo_mmap(target, NULL);
+			if (err < 0)
+				break;
+
+			err = host1x_capture_bo(capture, target);
+			if (err < 0)
+				break;
+
+			err = host1x_capture_blob(capture, target->ptr,
+						  target->size,
+						  &hashes[submit.num_cmdbufs +
+							  num_bos]);
+			bos[num_bos++] = target;
+		}
+	}
+
+	if (err == 0) {
+		submit.num_bos = num_bos;
+		err = host1x_capture_submit(capture, &submit, job, bos, hashes);
+	}
+
+	free(bos);
+	free(hashes);
+
+	return err;
+}
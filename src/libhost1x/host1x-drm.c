@@ -23,13 +23,17 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
+#include <linux/sync_file.h>
+
 #include <libdrm/drm_fourcc.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -37,11 +41,6 @@
 #include "host1x-private.h"
 #include "tegra_drm.h"
 
-enum host1x_class {
-	HOST1X_CLASS_GR2D = 0x51,
-	HOST1X_CLASS_GR3D = 0x60,
-};
-
 struct drm;
 
 struct drm_bo {
@@ -59,6 +58,17 @@ struct drm_channel {
 	uint64_t context;
 	struct drm *drm;
 	uint32_t fence;
+
+	/* scratch space for submissions, reused to avoid allocations */
+	struct drm_tegra_cmdbuf *cmdbufs;
+	unsigned int max_cmdbufs;
+	struct drm_tegra_reloc *relocs;
+	unsigned int max_relocs;
+	struct drm_tegra_waitchk *waitchks;
+	unsigned int max_waitchks;
+
+	/* newer kernels reject wait checks but still execute the waits */
+	bool no_waitchks;
 };
 
 static inline struct drm_channel *to_drm_channel(struct host1x_client *client)
@@ -66,6 +76,26 @@ static inline struct drm_channel *to_drm_channel(struct host1x_client *client)
 	return container_of(client, struct drm_channel, client);
 }
 
+/* property IDs needed to update a plane with an atomic commit */
+struct drm_plane {
+	uint32_t id;
+
+	uint32_t fb_id;
+	uint32_t crtc_id;
+	uint32_t src_x;
+	uint32_t src_y;
+	uint32_t src_w;
+	uint32_t src_h;
+	uint32_t crtc_x;
+	uint32_t crtc_y;
+	uint32_t crtc_w;
+	uint32_t crtc_h;
+	/* 0 if the plane can't wait for fences */
+	uint32_t in_fence_fd;
+};
+
+struct drm_overlay;
+
 struct drm_display {
 	struct host1x_display base;
 	struct drm *drm;
@@ -73,6 +103,15 @@ struct drm_display {
 	uint32_t connector;
 	unsigned int pipe;
 	uint32_t crtc;
+
+	/* only valid if atomic modesetting is supported */
+	bool atomic;
+	struct drm_plane primary;
+	struct drm_overlay *overlays;
+	/* an atomic commit hasn't completed yet */
+	bool busy;
+	/* in-fence of the primary plane, kept to timestamp rendering */
+	int fence;
 };
 
 static inline struct drm_display *to_drm_display(struct host1x_display *display)
@@ -83,6 +122,7 @@ static inline struct drm_display *to_drm_display(struct host1x_display *display)
 struct drm_overlay {
 	struct host1x_overlay base;
 	struct drm_display *display;
+	struct drm_overlay *next;
 	uint32_t plane;
 
 	unsigned int x;
@@ -90,6 +130,12 @@ struct drm_overlay {
 	unsigned int width;
 	unsigned int height;
 	uint32_t format;
+
+	/* state waiting for the next atomic commit */
+	struct drm_plane props;
+	struct host1x_framebuffer *fb;
+	bool dirty;
+	int fence;
 };
 
 static inline struct drm_overlay *to_drm_overlay(struct host1x_overlay *overlay)
@@ -122,7 +168,100 @@ static struct drm *to_drm(struct host1x *host1x)
 	return container_of(host1x, struct drm, base);
 }
 
-static int drm_display_find_plane(struct drm_display *display, uint32_t *plane)
+static int drm_get_property(struct drm *drm, uint32_t object, uint32_t type,
+			    const char *name, uint32_t *id, uint64_t *value)
+{
+	drmModeObjectProperties *props;
+	int err = -ENOENT;
+	uint32_t i;
+
+	props = drmModeObjectGetProperties(drm->fd, object, type);
+	if (!props)
+		return -errno;
+
+	for (i = 0; i < props->count_props && err < 0; i++) {
+		drmModePropertyRes *prop;
+
+		prop = drmModeGetProperty(drm->fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		if (strcmp(prop->name, name) == 0) {
+			if (id)
+				*id = prop->prop_id;
+
+			if (value)
+				*value = props->prop_values[i];
+
+			err = 0;
+		}
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	return err;
+}
+
+static int drm_plane_init(struct drm *drm, struct drm_plane *plane,
+			  uint32_t id)
+{
+	static const struct {
+		const char *name;
+		size_t offset;
+	} properties[] = {
+		{ "FB_ID", offsetof(struct drm_plane, fb_id) },
+		{ "CRTC_ID", offsetof(struct drm_plane, crtc_id) },
+		{ "SRC_X", offsetof(struct drm_plane, src_x) },
+		{ "SRC_Y", offsetof(struct drm_plane, src_y) },
+		{ "SRC_W", offsetof(struct drm_plane, src_w) },
+		{ "SRC_H", offsetof(struct drm_plane, src_h) },
+		{ "CRTC_X", offsetof(struct drm_plane, crtc_x) },
+		{ "CRTC_Y", offsetof(struct drm_plane, crtc_y) },
+		{ "CRTC_W", offsetof(struct drm_plane, crtc_w) },
+		{ "CRTC_H", offsetof(struct drm_plane, crtc_h) },
+	};
+	unsigned int i;
+	int err;
+
+	memset(plane, 0, sizeof(*plane));
+	plane->id = id;
+
+	for (i = 0; i < ARRAY_SIZE(properties); i++) {
+		uint32_t *prop = (void *)plane + properties[i].offset;
+
+		err = drm_get_property(drm, id, DRM_MODE_OBJECT_PLANE,
+				       properties[i].name, prop, NULL);
+		if (err < 0)
+			return err;
+	}
+
+	/* older kernels can't make commits wait for fences */
+	err = drm_get_property(drm, id, DRM_MODE_OBJECT_PLANE, "IN_FENCE_FD",
+			       &plane->in_fence_fd, NULL);
+	if (err < 0)
+		plane->in_fence_fd = 0;
+
+	return 0;
+}
+
+static bool drm_plane_has_type(struct drm *drm, uint32_t id, uint64_t type)
+{
+	uint64_t value;
+	int err;
+
+	/* without the property only overlays are exposed */
+	err = drm_get_property(drm, id, DRM_MODE_OBJECT_PLANE, "type", NULL,
+			       &value);
+	if (err < 0)
+		return type == DRM_PLANE_TYPE_OVERLAY;
+
+	return value == type;
+}
+
+static int drm_display_find_plane(struct drm_display *display, uint64_t type,
+				  uint32_t *plane)
 {
 	struct drm *drm = display->drm;
 	drmModePlaneRes *res;
@@ -134,10 +273,13 @@ static int drm_display_find_plane(struct drm_display *display, uint32_t *plane)
 
 	for (i = 0; i < res->count_planes && !id; i++) {
 		drmModePlane *p = drmModeGetPlane(drm->fd, res->planes[i]);
-		if (!p) {
-		}
+		if (!p)
+			continue;
 
-		if (!p->crtc_id && (p->possible_crtcs & (1 << display->pipe)))
+		/* the primary plane is in use by the CRTC already */
+		if ((p->possible_crtcs & (1 << display->pipe)) &&
+		    (!p->crtc_id || type == DRM_PLANE_TYPE_PRIMARY) &&
+		    drm_plane_has_type(drm, p->plane_id, type))
 			id = p->plane_id;
 
 		drmModeFreePlane(p);
@@ -154,11 +296,192 @@ static int drm_display_find_plane(struct drm_display *display, uint32_t *plane)
 	return 0;
 }
 
+static bool drm_fence_is_sync_file(int fd)
+{
+	struct sync_file_info info;
+
+	memset(&info, 0, sizeof(info));
+
+	return ioctl(fd, SYNC_IOC_FILE_INFO, &info) == 0;
+}
+
+/*
+ * Adds the properties that show the framebuffer on a plane to an atomic
+ * request. If the plane can wait for the framebuffer's fence the fence is
+ * returned and needs to be kept open until the request has been committed,
+ * otherwise the CPU waits for it.
+ */
+static int drm_plane_add(struct drm_plane *plane, drmModeAtomicReq *req,
+			 uint32_t crtc, struct host1x_framebuffer *fb,
+			 unsigned int x, unsigned int y, unsigned int width,
+			 unsigned int height, int *fence)
+{
+	const struct {
+		uint32_t property;
+		uint64_t value;
+	} values[] = {
+		{ plane->fb_id, fb->handle },
+		{ plane->crtc_id, crtc },
+		{ plane->src_x, 0 },
+		{ plane->src_y, 0 },
+		{ plane->src_w, fb->width << 16 },
+		{ plane->src_h, fb->height << 16 },
+		{ plane->crtc_x, x },
+		{ plane->crtc_y, y },
+		{ plane->crtc_w, width },
+		{ plane->crtc_h, height },
+	};
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < ARRAY_SIZE(values); i++) {
+		err = drmModeAtomicAddProperty(req, plane->id,
+					       values[i].property,
+					       values[i].value);
+		if (err < 0)
+			return -ENOMEM;
+	}
+
+	*fence = -1;
+
+	if (!plane->in_fence_fd || fb->fence < 0 ||
+	    !drm_fence_is_sync_file(fb->fence))
+		return host1x_framebuffer_wait_fence(fb);
+
+	err = drmModeAtomicAddProperty(req, plane->id, plane->in_fence_fd,
+				       fb->fence);
+	if (err < 0)
+		return -ENOMEM;
+
+	*fence = host1x_framebuffer_take_fence(fb);
+
+	return 0;
+}
+
+static int drm_display_handle_events(struct host1x_display *display);
+
+/*
+ * Atomic commits can't be queued, so a new one has to wait for the previous
+ * one to complete. This only blocks if updates are submitted faster than the
+ * display refreshes.
+ */
+static int drm_display_wait_idle(struct drm_display *display)
+{
+	struct pollfd fds;
+	int err;
+
+	while (display->busy) {
+		fds.fd = display->drm->fd;
+		fds.events = POLLIN;
+		fds.revents = 0;
+
+		err = poll(&fds, 1, 1000);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -errno;
+		}
+
+		if (err == 0)
+			return -ETIMEDOUT;
+
+		err = drm_display_handle_events(&display->base);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Shows the framebuffer, if any, on the primary plane together with all
+ * overlay updates that haven't been committed yet. The commit takes effect
+ * at the next vertical blank and completion is reported as a page-flip
+ * event, so the CPU never waits for it here.
+ */
+static int drm_display_commit(struct drm_display *display,
+			      struct host1x_framebuffer *fb)
+{
+	struct drm *drm = display->drm;
+	struct drm_overlay *overlay;
+	drmModeAtomicReq *req;
+	int fence = -1, err;
+
+	err = drm_display_wait_idle(display);
+	if (err < 0)
+		return err;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	if (fb)
+		err = drm_plane_add(&display->primary, req, display->crtc, fb,
+				    0, 0, fb->width, fb->height, &fence);
+
+	for (overlay = display->overlays; overlay; overlay = overlay->next) {
+		if (!overlay->dirty || err < 0)
+			continue;
+
+		err = drm_plane_add(&overlay->props, req, display->crtc,
+				    overlay->fb, overlay->x, overlay->y,
+				    overlay->width, overlay->height,
+				    &overlay->fence);
+	}
+
+	if (err == 0) {
+		err = drmModeAtomicCommit(drm->fd, req,
+					  DRM_MODE_ATOMIC_NONBLOCK |
+					  DRM_MODE_PAGE_FLIP_EVENT, display);
+		if (err < 0) {
+			fprintf(stderr, "drmModeAtomicCommit() failed: %m\n");
+			err = -errno;
+		} else {
+			display->busy = true;
+		}
+	}
+
+	/* the kernel holds on to the fences by itself */
+	for (overlay = display->overlays; overlay; overlay = overlay->next) {
+		if (overlay->fence >= 0)
+			close(overlay->fence);
+
+		overlay->fence = -1;
+
+		if (err == 0)
+			overlay->dirty = false;
+	}
+
+	/* keep the fence to find out when rendering completed */
+	if (fence >= 0) {
+		if (err == 0 && display->fence < 0)
+			display->fence = fence;
+		else
+			close(fence);
+	}
+
+	drmModeAtomicFree(req);
+
+	return err;
+}
+
 static int drm_overlay_close(struct host1x_overlay *overlay)
 {
 	struct drm_overlay *plane = to_drm_overlay(overlay);
 	struct drm_display *display = plane->display;
 	struct drm *drm = display->drm;
+	struct drm_overlay **overlayp;
+
+	for (overlayp = &display->overlays; *overlayp;
+	     overlayp = &(*overlayp)->next) {
+		if (*overlayp == plane) {
+			*overlayp = plane->next;
+			break;
+		}
+	}
+
+	drm_display_wait_idle(display);
 
 	drmModeSetPlane(drm->fd, plane->plane, display->crtc, 0, 0, 0, 0, 0,
 			0, 0, 0, 0, 0);
@@ -177,6 +500,33 @@ static int drm_overlay_set(struct host1x_overlay *overlay,
 	struct drm *drm = display->drm;
 	int err;
 
+	if (display->atomic) {
+		plane->fb = fb;
+		plane->x = x;
+		plane->y = y;
+		plane->width = width;
+		plane->height = height;
+		plane->dirty = true;
+
+		/*
+		 * Atomic updates always take effect at a vertical blank. If a
+		 * commit is still in flight, the overlay is committed as soon
+		 * as it completes, unless the caller wants to wait for it.
+		 */
+		if (!vsync && display->busy)
+			return 0;
+
+		err = drm_display_commit(display, NULL);
+		if (err < 0 || !vsync)
+			return err;
+
+		return drm_display_wait_idle(display);
+	}
+
+	err = host1x_framebuffer_wait_fence(fb);
+	if (err < 0)
+		return err;
+
 	if (vsync) {
 		drmVBlank vblank = {
 			.request = {
@@ -209,7 +559,7 @@ static int drm_overlay_create(struct host1x_display *display,
 	uint32_t plane = 0;
 	int err;
 
-	err = drm_display_find_plane(drm, &plane);
+	err = drm_display_find_plane(drm, DRM_PLANE_TYPE_OVERLAY, &plane);
 	if (err < 0)
 		return err;
 
@@ -217,11 +567,23 @@ static int drm_overlay_create(struct host1x_display *display,
 	if (!overlay)
 		return -ENOMEM;
 
+	if (drm->atomic) {
+		err = drm_plane_init(drm->drm, &overlay->props, plane);
+		if (err < 0) {
+			free(overlay);
+			return err;
+		}
+	}
+
 	overlay->base.close = drm_overlay_close;
 	overlay->base.set = drm_overlay_set;
 
 	overlay->display = drm;
 	overlay->plane = plane;
+	overlay->fence = -1;
+
+	overlay->next = drm->overlays;
+	drm->overlays = overlay;
 
 	*overlayp = &overlay->base;
 
@@ -232,6 +594,31 @@ static void drm_display_on_page_flip(int fd, unsigned int frame,
 				     unsigned int sec, unsigned int usec,
 				     void *data)
 {
+	struct drm_display *display = data;
+	struct host1x_framebuffer *fb = display->base.pending;
+	struct drm_overlay *overlay;
+
+	display->busy = false;
+
+	if (display->fence >= 0) {
+		if (fb)
+			fb->completed = host1x_fence_fd_get_timestamp(display->fence);
+
+		close(display->fence);
+		display->fence = -1;
+	}
+
+	/* atomic commits that only update overlays also end up here */
+	if (fb)
+		host1x_display_flip_done(&display->base, frame, sec, usec);
+
+	/* overlay updates that were made while the commit was in flight */
+	for (overlay = display->overlays; overlay; overlay = overlay->next) {
+		if (overlay->dirty) {
+			drm_display_commit(display, NULL);
+			break;
+		}
+	}
 }
 
 static void drm_display_on_vblank(int fd, unsigned int frame,
@@ -240,45 +627,66 @@ static void drm_display_on_vblank(int fd, unsigned int frame,
 {
 }
 
-static int drm_display_set(struct host1x_display *display,
-			   struct host1x_framebuffer *fb, bool vsync)
+static int drm_display_flip(struct host1x_display *display,
+			    struct host1x_framebuffer *fb)
 {
 	struct drm_display *drm = to_drm_display(display);
 	int err;
 
-	if (vsync) {
-		struct timeval timeout;
-		fd_set fds;
+	if (drm->atomic)
+		return drm_display_commit(drm, fb);
 
-		err = drmModePageFlip(drm->drm->fd, drm->crtc, fb->handle,
-				      DRM_MODE_PAGE_FLIP_EVENT, drm);
-		if (err < 0) {
-			fprintf(stderr, "drmModePageFlip() failed: %m\n");
-			return -errno;
-		}
+	err = host1x_framebuffer_wait_fence(fb);
+	if (err < 0)
+		return err;
 
-		memset(&timeout, 0, sizeof(timeout));
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
+	err = drmModePageFlip(drm->drm->fd, drm->crtc, fb->handle,
+			      DRM_MODE_PAGE_FLIP_EVENT, drm);
+	if (err < 0) {
+		fprintf(stderr, "drmModePageFlip() failed: %m\n");
+		return -errno;
+	}
 
-		FD_ZERO(&fds);
-		FD_SET(drm->drm->fd, &fds);
+	return 0;
+}
 
-		err = select(drm->drm->fd + 1, &fds, NULL, NULL, &timeout);
-		if (err <= 0) {
-		}
+static int drm_display_handle_events(struct host1x_display *display)
+{
+	struct drm_display *drm = to_drm_display(display);
+	drmEventContext context;
+	int err;
 
-		if (FD_ISSET(drm->drm->fd, &fds)) {
-			drmEventContext context;
+	memset(&context, 0, sizeof(context));
+	context.version = DRM_EVENT_CONTEXT_VERSION;
+	context.page_flip_handler = drm_display_on_page_flip;
+	context.vblank_handler = drm_display_on_vblank;
 
-			memset(&context, 0, sizeof(context));
-			context.version = DRM_EVENT_CONTEXT_VERSION;
-			context.page_flip_handler = drm_display_on_page_flip;
-			context.vblank_handler = drm_display_on_vblank;
+	err = drmHandleEvent(drm->drm->fd, &context);
+	if (err < 0)
+		return -errno;
 
-			drmHandleEvent(drm->drm->fd, &context);
-		}
+	return 0;
+}
+
+static int drm_display_set(struct host1x_display *display,
+			   struct host1x_framebuffer *fb, bool vsync)
+{
+	struct drm_display *drm = to_drm_display(display);
+	int err;
+
+	if (vsync) {
+		err = host1x_display_flip(display, fb);
+		if (err < 0)
+			return err;
+
+		err = host1x_display_wait_flip(display, 1000, NULL);
+		if (err < 0)
+			return err;
 	} else {
+		err = host1x_framebuffer_wait_fence(fb);
+		if (err < 0)
+			return err;
+
 		err = drmModeSetCrtc(drm->drm->fd, drm->crtc, fb->handle, 0,
 				     0, &drm->connector, 1, &drm->mode);
 		if (err < 0)
@@ -348,6 +756,42 @@ static int drm_display_setup(struct drm_display *display)
 	return ret;
 }
 
+/*
+ * Switches to atomic modesetting if the kernel supports it. Otherwise the
+ * legacy page-flip and plane IOCTLs are used.
+ */
+static int drm_display_setup_atomic(struct drm_display *display)
+{
+	struct drm *drm = display->drm;
+	uint32_t plane;
+	int err;
+
+	err = drmSetClientCap(drm->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+	if (err < 0)
+		return -errno;
+
+	err = drmSetClientCap(drm->fd, DRM_CLIENT_CAP_ATOMIC, 1);
+	if (err < 0) {
+		err = -errno;
+		drmSetClientCap(drm->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 0);
+		return err;
+	}
+
+	err = drm_display_find_plane(display, DRM_PLANE_TYPE_PRIMARY, &plane);
+	if (err == 0)
+		err = drm_plane_init(drm, &display->primary, plane);
+
+	if (err < 0) {
+		drmSetClientCap(drm->fd, DRM_CLIENT_CAP_ATOMIC, 0);
+		drmSetClientCap(drm->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 0);
+		return err;
+	}
+
+	display->atomic = true;
+
+	return 0;
+}
+
 static int drm_display_create(struct drm_display **displayp, struct drm *drm)
 {
 	struct drm_display *display;
@@ -358,6 +802,7 @@ static int drm_display_create(struct drm_display **displayp, struct drm *drm)
 		return -ENOMEM;
 
 	display->drm = drm;
+	display->fence = -1;
 
 	err = drmSetMaster(drm->fd);
 	if (err < 0) {
@@ -371,10 +816,17 @@ static int drm_display_create(struct drm_display **displayp, struct drm *drm)
 		return err;
 	}
 
+	err = drm_display_setup_atomic(display);
+	if (err < 0)
+		fprintf(stderr, "atomic modesetting not supported: %d\n", err);
+
 	display->base.width = display->mode.hdisplay;
 	display->base.height = display->mode.vdisplay;
 	display->base.create_overlay = drm_overlay_create;
 	display->base.set = drm_display_set;
+	display->base.flip = drm_display_flip;
+	display->base.handle_events = drm_display_handle_events;
+	display->base.fd = drm->fd;
 
 	*displayp = display;
 
@@ -390,6 +842,9 @@ static int drm_display_close(struct drm_display *display)
 
 	drm = display->drm;
 
+	if (display->fence >= 0)
+		close(display->fence);
+
 	drmDropMaster(drm->fd);
 	free(display);
 
@@ -450,38 +905,156 @@ static void drm_bo_free(struct host1x_bo *bo)
 	free(drm);
 }
 
-static struct host1x_bo *drm_bo_create(struct host1x *host1x, size_t size,
-				       unsigned long flags)
+static int drm_bo_export_fd(struct host1x_bo *bo, int *fd)
 {
-	struct drm_tegra_gem_create args;
-	struct drm *drm = to_drm(host1x);
-	struct drm_bo *bo;
+	struct drm_bo *drm = to_drm_bo(bo);
+	struct drm_prime_handle args;
+	int err;
+
+	memset(&args, 0, sizeof(args));
+	args.handle = bo->handle;
+	args.flags = DRM_CLOEXEC | DRM_RDWR;
+
+	err = ioctl(drm->drm->fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &args);
+	if (err < 0)
+		return -errno;
+
+	*fd = args.fd;
+
+	return 0;
+}
+
+static int drm_bo_export_name(struct host1x_bo *bo, uint32_t *name)
+{
+	struct drm_bo *drm = to_drm_bo(bo);
+	struct drm_gem_flink args;
 	int err;
 
+	memset(&args, 0, sizeof(args));
+	args.handle = bo->handle;
+
+	err = ioctl(drm->drm->fd, DRM_IOCTL_GEM_FLINK, &args);
+	if (err < 0)
+		return -errno;
+
+	*name = args.name;
+
+	return 0;
+}
+
+static struct drm_bo *drm_bo_alloc(struct drm *drm, uint32_t handle,
+				   size_t size)
+{
+	struct drm_bo *bo;
+
 	bo = calloc(1, sizeof(*bo));
 	if (!bo)
 		return NULL;
 
 	bo->drm = drm;
 
+	bo->base.handle = handle;
+	bo->base.size = size;
+
+	bo->base.mmap = drm_bo_mmap;
+	bo->base.invalidate = drm_bo_invalidate;
+	bo->base.flush = drm_bo_flush;
+	bo->base.export_fd = drm_bo_export_fd;
+	bo->base.export_name = drm_bo_export_name;
+	bo->base.free = drm_bo_free;
+
+	return bo;
+}
+
+static void drm_gem_handle_close(struct drm *drm, uint32_t handle)
+{
+	struct drm_gem_close args;
+
+	memset(&args, 0, sizeof(args));
+	args.handle = handle;
+
+	ioctl(drm->fd, DRM_IOCTL_GEM_CLOSE, &args);
+}
+
+static struct host1x_bo *drm_bo_create(struct host1x *host1x, size_t size,
+				       unsigned long flags)
+{
+	struct drm_tegra_gem_create args;
+	struct drm *drm = to_drm(host1x);
+	struct drm_bo *bo;
+	int err;
+
 	memset(&args, 0, sizeof(args));
 	args.flags = DRM_TEGRA_GEM_CREATE_BOTTOM_UP |
 		     DRM_TEGRA_GEM_CREATE_TILED;
 	args.size = size;
 
 	err = ioctl(drm->fd, DRM_IOCTL_TEGRA_GEM_CREATE, &args);
-	if (err < 0) {
-		free(bo);
+	if (err < 0)
+		return NULL;
+
+	bo = drm_bo_alloc(drm, args.handle, size);
+	if (!bo) {
+		drm_gem_handle_close(drm, args.handle);
 		return NULL;
 	}
 
-	bo->base.handle = args.handle;
-	bo->base.size = size;
+	return &bo->base;
+}
 
-	bo->base.mmap = drm_bo_mmap;
-	bo->base.invalidate = drm_bo_invalidate;
-	bo->base.flush = drm_bo_flush;
-	bo->base.free = drm_bo_free;
+/*
+ * XXX: importing the same buffer twice yields the same GEM handle, so the
+ * two buffer objects must not be freed independently.
+ */
+static struct host1x_bo *drm_bo_import_fd(struct host1x *host1x, int fd)
+{
+	struct drm *drm = to_drm(host1x);
+	struct drm_prime_handle args;
+	struct drm_bo *bo;
+	off_t size;
+	int err;
+
+	/* the size of a DMA-BUF can be queried by seeking to its end */
+	size = lseek(fd, 0, SEEK_END);
+	if (size < 0)
+		return NULL;
+
+	memset(&args, 0, sizeof(args));
+	args.fd = fd;
+
+	err = ioctl(drm->fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &args);
+	if (err < 0)
+		return NULL;
+
+	bo = drm_bo_alloc(drm, args.handle, size);
+	if (!bo) {
+		drm_gem_handle_close(drm, args.handle);
+		return NULL;
+	}
+
+	return &bo->base;
+}
+
+static struct host1x_bo *drm_bo_import_name(struct host1x *host1x,
+					    uint32_t name)
+{
+	struct drm *drm = to_drm(host1x);
+	struct drm_gem_open args;
+	struct drm_bo *bo;
+	int err;
+
+	memset(&args, 0, sizeof(args));
+	args.name = name;
+
+	err = ioctl(drm->fd, DRM_IOCTL_GEM_OPEN, &args);
+	if (err < 0)
+		return NULL;
+
+	bo = drm_bo_alloc(drm, args.handle, args.size);
+	if (!bo) {
+		drm_gem_handle_close(drm, args.handle);
+		return NULL;
+	}
 
 	return &bo->base;
 }
@@ -493,13 +1066,21 @@ static int drm_framebuffer_init(struct host1x *host1x,
 	struct drm *drm = to_drm(host1x);
 	int err;
 
-	/* XXX: support other formats */
-	if (fb->depth != 32) {
-		fprintf(stderr, "ERROR: only 32-bit (XBGR8888) supported\n");
+	switch (fb->depth) {
+	case 16:
+		format = DRM_FORMAT_RGB565;
+		break;
+
+	case 32:
+		format = DRM_FORMAT_XBGR8888;
+		break;
+
+	default:
+		fprintf(stderr, "ERROR: %u bits per pixel not supported\n",
+			fb->depth);
 		return -EINVAL;
 	}
 
-	format = DRM_FORMAT_XBGR8888;
 	handles[0] = fb->bo->handle;
 	pitches[0] = fb->pitch;
 	offsets[0] = 0;
@@ -529,74 +1110,137 @@ static int drm_channel_open(struct drm *drm, uint32_t class, uint64_t *channel)
 	return 0;
 }
 
+/*
+ * Makes room for at least count elements of the given size, growing the
+ * array geometrically so that steady-state submissions don't allocate. On
+ * failure the array is left untouched and NULL is returned.
+ */
+static void *drm_channel_reserve(void *array, unsigned int *max,
+				 unsigned int count, size_t size)
+{
+	unsigned int num = *max;
+
+	if (array && count <= num)
+		return array;
+
+	while (num < count || num == 0)
+		num = num * 2 + 8;
+
+	array = realloc(array, num * size);
+	if (array)
+		*max = num;
+
+	return array;
+}
+
 static int drm_channel_submit(struct host1x_client *client,
 			      struct host1x_job *job)
 {
 	struct drm_channel *channel = to_drm_channel(client);
-	struct drm_tegra_reloc *relocs, *reloc;
-	unsigned int i, j, num_relocs = 0;
-	struct drm_tegra_cmdbuf *cmdbufs;
+	unsigned int i, j, num_relocs = 0, num_waitchks = 0;
 	struct drm_tegra_syncpt syncpt;
+	uint32_t waitchk_mask = 0;
 	struct drm_tegra_submit args;
+	void *array;
 	int err;
 
 	memset(&syncpt, 0, sizeof(syncpt));
 	syncpt.id = job->syncpt;
 	syncpt.incrs = job->syncpt_incrs;
 
-	cmdbufs = calloc(job->num_pushbufs, sizeof(*cmdbufs));
-	if (!cmdbufs)
+	array = drm_channel_reserve(channel->cmdbufs, &channel->max_cmdbufs,
+				    job->num_pushbufs,
+				    sizeof(*channel->cmdbufs));
+	if (!array)
 		return -ENOMEM;
 
+	channel->cmdbufs = array;
+
 	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pushbuf = &job->pushbufs[i];
-		struct drm_tegra_cmdbuf *cmdbuf = &cmdbufs[i];
+		struct host1x_pushbuf *pushbuf = job->pushbufs[i];
+		struct drm_tegra_cmdbuf *cmdbuf = &channel->cmdbufs[i];
 
 		cmdbuf->handle = pushbuf->bo->handle;
 		cmdbuf->offset = pushbuf->offset;
 		cmdbuf->words = pushbuf->length;
+		cmdbuf->pad = 0;
 
-		num_relocs += pushbuf->num_relocs;
-	}
-
-	relocs = calloc(num_relocs, sizeof(*relocs));
-	if (!relocs)
-		return -ENOMEM;
-
-	reloc = relocs;
+		array = drm_channel_reserve(channel->relocs,
+					    &channel->max_relocs,
+					    num_relocs + pushbuf->num_relocs,
+					    sizeof(*channel->relocs));
+		if (!array)
+			return -ENOMEM;
 
-	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pushbuf = &job->pushbufs[i];
+		channel->relocs = array;
 
 		for (j = 0; j < pushbuf->num_relocs; j++) {
 			struct host1x_pushbuf_reloc *r = &pushbuf->relocs[j];
+			struct drm_tegra_reloc *reloc;
 
+			reloc = &channel->relocs[num_relocs++];
 			reloc->cmdbuf.handle = pushbuf->bo->handle;
 			reloc->cmdbuf.offset = r->source_offset;
 			reloc->target.handle = r->target_handle;
 			reloc->target.offset = r->target_offset;
 			reloc->shift = r->shift;
-
-			reloc++;
+			reloc->pad = 0;
 		}
 	}
 
+	array = drm_channel_reserve(channel->waitchks, &channel->max_waitchks,
+				    job->num_waitchks,
+				    sizeof(*channel->waitchks));
+	if (!array)
+		return -ENOMEM;
+
+	channel->waitchks = array;
+
+	for (i = 0; i < job->num_waitchks && !channel->no_waitchks; i++) {
+		struct host1x_job_waitchk *w = &job->waitchks[i];
+		struct drm_tegra_waitchk *waitchk = &channel->waitchks[i];
+
+		/* the kernel takes a 32-bit mask of the waited for syncpoints */
+		if (w->syncpt >= 32)
+			return -EINVAL;
+
+		waitchk->handle = w->bo->handle;
+		waitchk->offset = w->offset;
+		waitchk->syncpt = w->syncpt;
+		waitchk->thresh = w->thresh;
+		waitchk_mask |= 1u << w->syncpt;
+		num_waitchks++;
+	}
+
 	memset(&args, 0, sizeof(args));
 	args.context = channel->context;
 	args.num_syncpts = 1;
 	args.num_cmdbufs = job->num_pushbufs;
 	args.num_relocs = num_relocs;
 	args.submit_version = 0;
-	args.num_waitchks = 0;
-	args.waitchk_mask = 0;
+	args.num_waitchks = num_waitchks;
+	args.waitchk_mask = waitchk_mask;
 	args.timeout = 1000;
 
 	args.syncpts = (unsigned long)&syncpt;
-	args.cmdbufs = (unsigned long)cmdbufs;
-	args.relocs = (unsigned long)relocs;
-	args.waitchks = 0;
+	args.cmdbufs = (unsigned long)channel->cmdbufs;
+	args.relocs = (unsigned long)channel->relocs;
+	args.waitchks = (unsigned long)channel->waitchks;
 
 	err = ioctl(channel->drm->fd, DRM_IOCTL_TEGRA_SUBMIT, &args);
+	if (err < 0 && errno == EINVAL && num_waitchks > 0) {
+		args.num_waitchks = 0;
+		args.waitchk_mask = 0;
+
+		/*
+		 * Only stop passing wait checks if they were the reason for
+		 * the job to be rejected.
+		 */
+		err = ioctl(channel->drm->fd, DRM_IOCTL_TEGRA_SUBMIT, &args);
+		if (err == 0)
+			channel->no_waitchks = true;
+	}
+
 	if (err < 0) {
 		fprintf(stderr, "ioctl(DRM_IOCTL_TEGRA_SUBMIT) failed: %d\n",
 			errno);
@@ -606,7 +1250,6 @@ static int drm_channel_submit(struct host1x_client *client,
 	channel->fence = args.fence;
 
 	return 0;
-	return 0;
 }
 
 static int drm_channel_flush(struct host1x_client *client, uint32_t *fence)
@@ -618,28 +1261,59 @@ static int drm_channel_flush(struct host1x_client *client, uint32_t *fence)
 	return 0;
 }
 
-static int drm_channel_wait(struct host1x_client *client, uint32_t fence,
-			    uint32_t timeout)
+static int drm_channel_wait(struct host1x_client *client, uint32_t id,
+			    uint32_t fence, uint32_t timeout)
 {
 	struct drm_channel *channel = to_drm_channel(client);
 	struct drm_tegra_syncpt_wait args;
 	struct host1x_syncpt *syncpt;
 	int err;
 
-	syncpt = &channel->client.syncpts[0];
+	syncpt = host1x_client_find_syncpt(client, id);
+
+	if (syncpt && host1x_syncpt_expired(syncpt, fence))
+		return 0;
 
 	memset(&args, 0, sizeof(args));
-	args.id = syncpt->id;
+	args.id = id;
 	args.thresh = fence;
 	args.timeout = timeout;
 
 	err = ioctl(channel->drm->fd, DRM_IOCTL_TEGRA_SYNCPT_WAIT, &args);
 	if (err < 0) {
-		fprintf(stderr, "ioctl(DRM_IOCTL_TEGRA_SYNCPT_WAIT) failed: %d\n",
+		/* timeouts are expected when polling */
+		if (errno != EAGAIN)
+			fprintf(stderr, "ioctl(DRM_IOCTL_TEGRA_SYNCPT_WAIT) failed: %d\n",
+				errno);
+
+		return -errno;
+	}
+
+	if (syncpt)
+		host1x_syncpt_update(syncpt, args.value);
+
+	return 0;
+}
+
+static int drm_channel_read_syncpt(struct host1x_client *client,
+				   uint32_t syncpt, uint32_t *value)
+{
+	struct drm_channel *channel = to_drm_channel(client);
+	struct drm_tegra_syncpt_read args;
+	int err;
+
+	memset(&args, 0, sizeof(args));
+	args.id = syncpt;
+
+	err = ioctl(channel->drm->fd, DRM_IOCTL_TEGRA_SYNCPT_READ, &args);
+	if (err < 0) {
+		fprintf(stderr, "ioctl(DRM_IOCTL_TEGRA_SYNCPT_READ) failed: %d\n",
 			errno);
 		return -errno;
 	}
 
+	*value = args.value;
+
 	return 0;
 }
 
@@ -665,6 +1339,7 @@ static int drm_channel_init(struct drm *drm, struct drm_channel *channel,
 
 	for (i = 0; i < num_syncpts; i++) {
 		struct drm_tegra_get_syncpt args;
+		uint32_t value;
 
 		memset(&args, 0, sizeof(args));
 		args.context = channel->context;
@@ -677,12 +1352,21 @@ static int drm_channel_init(struct drm *drm, struct drm_channel *channel,
 		}
 
 		syncpts[i].id = args.id;
-		syncpts[i].value = 0;
+
+		/* the cached value must not be ahead of the hardware */
+		err = drm_channel_read_syncpt(&channel->client, args.id,
+					      &value);
+		if (err < 0)
+			value = 0;
+
+		atomic_init(&syncpts[i].value, value);
 	}
 
+	channel->client.class = class;
 	channel->client.submit = drm_channel_submit;
 	channel->client.flush = drm_channel_flush;
 	channel->client.wait = drm_channel_wait;
+	channel->client.read_syncpt = drm_channel_read_syncpt;
 
 	return 0;
 }
@@ -701,6 +1385,9 @@ static void drm_channel_exit(struct drm_channel *channel)
 			-errno);
 
 	free(channel->client.syncpts);
+	free(channel->waitchks);
+	free(channel->relocs);
+	free(channel->cmdbufs);
 }
 
 static int drm_gr2d_create(struct drm_gr2d **gr2dp, struct drm *drm)
@@ -786,6 +1473,7 @@ static void drm_close(struct host1x *host1x)
 	drm_gr3d_close(drm->gr3d);
 	drm_gr2d_close(drm->gr2d);
 	drm_display_close(drm->display);
+	host1x_bo_cache_exit(&drm->base.bo_cache);
 
 	close(drm->fd);
 	free(drm);
@@ -808,7 +1496,11 @@ struct host1x *host1x_drm_open(void)
 
 	drm->fd = fd;
 
+	host1x_bo_cache_init(&drm->base.bo_cache);
+
 	drm->base.bo_create = drm_bo_create;
+	drm->base.bo_import_fd = drm_bo_import_fd;
+	drm->base.bo_import_name = drm_bo_import_name;
 	drm->base.framebuffer_init = drm_framebuffer_init;
 	drm->base.close = drm_close;
 
@@ -0,0 +1,371 @@
+/*
+ * Copyright (c) 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+#include <linux/sync_file.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * Fences that the kernel can't export as a file descriptor are tracked by a
+ * helper thread instead, which signals an eventfd once all fences of a file
+ * descriptor have signaled. The thread is started when it is first needed
+ * and polls the pending fences at this interval (in milliseconds).
+ */
+#define HOST1X_FENCE_WAITER_INTERVAL 1
+
+struct host1x_fence_fd {
+	struct host1x_fence_fd *next;
+	struct host1x_fence *fences;
+	unsigned int first;
+	unsigned int count;
+	int fd;
+};
+
+struct host1x_fence_waiter {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool running;
+	bool stop;
+
+	struct host1x_fence_fd *pending;
+	pthread_t thread;
+
+	/* fences that the thread is currently waiting for */
+	struct host1x_fence *fences;
+	unsigned int max_fences;
+};
+
+static void host1x_fence_fd_signal(struct host1x_fence_fd *ffd)
+{
+	uint64_t value = host1x_get_time();
+
+	if (write(ffd->fd, &value, sizeof(value)) < 0)
+		fprintf(stderr, "failed to signal fence: %d\n", -errno);
+
+	close(ffd->fd);
+	free(ffd->fences);
+	free(ffd);
+}
+
+/*
+ * Drops the fences that have signaled from the front of the list. Query
+ * errors count as signaled so that nobody waits on a broken fence forever,
+ * the error will be reported when the fence itself is waited for.
+ */
+static bool host1x_fence_fd_done(struct host1x_fence_fd *ffd)
+{
+	while (ffd->first < ffd->count) {
+		if (host1x_fence_query(&ffd->fences[ffd->first]) == 0)
+			return false;
+
+		ffd->first++;
+	}
+
+	return true;
+}
+
+/* signals completed file descriptors and collects the remaining fences */
+static int host1x_fence_waiter_update(struct host1x_fence_waiter *waiter,
+				      unsigned int *countp)
+{
+	struct host1x_fence_fd **ffdp = &waiter->pending, *ffd;
+	unsigned int count = 0;
+
+	while ((ffd = *ffdp) != NULL) {
+		if (host1x_fence_fd_done(ffd)) {
+			*ffdp = ffd->next;
+			host1x_fence_fd_signal(ffd);
+			continue;
+		}
+
+		if (count == waiter->max_fences) {
+			unsigned int max = waiter->max_fences * 2 + 8;
+			struct host1x_fence *fences;
+
+			fences = realloc(waiter->fences, max * sizeof(*fences));
+			if (!fences)
+				return -ENOMEM;
+
+			waiter->max_fences = max;
+			waiter->fences = fences;
+		}
+
+		waiter->fences[count++] = ffd->fences[ffd->first];
+		ffdp = &ffd->next;
+	}
+
+	*countp = count;
+
+	return 0;
+}
+
+static void *host1x_fence_waiter_thread(void *data)
+{
+	struct host1x_fence_waiter *waiter = data;
+	unsigned int count;
+	int err;
+
+	pthread_mutex_lock(&waiter->lock);
+
+	while (!waiter->stop) {
+		err = host1x_fence_waiter_update(waiter, &count);
+		if (err < 0 || count == 0) {
+			pthread_cond_wait(&waiter->cond, &waiter->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&waiter->lock);
+
+		host1x_fence_wait_any(waiter->fences, count,
+				      HOST1X_FENCE_WAITER_INTERVAL, NULL);
+
+		pthread_mutex_lock(&waiter->lock);
+	}
+
+	pthread_mutex_unlock(&waiter->lock);
+
+	return NULL;
+}
+
+struct host1x_fence_waiter *host1x_fence_waiter_create(void)
+{
+	struct host1x_fence_waiter *waiter;
+
+	waiter = calloc(1, sizeof(*waiter));
+	if (!waiter)
+		return NULL;
+
+	pthread_mutex_init(&waiter->lock, NULL);
+	pthread_cond_init(&waiter->cond, NULL);
+
+	return waiter;
+}
+
+/* file descriptors that are still pending are signaled */
+void host1x_fence_waiter_free(struct host1x_fence_waiter *waiter)
+{
+	struct host1x_fence_fd *ffd;
+
+	if (!waiter)
+		return;
+
+	if (waiter->running) {
+		pthread_mutex_lock(&waiter->lock);
+		waiter->stop = true;
+		pthread_cond_signal(&waiter->cond);
+		pthread_mutex_unlock(&waiter->lock);
+
+		pthread_join(waiter->thread, NULL);
+	}
+
+	while ((ffd = waiter->pending) != NULL) {
+		waiter->pending = ffd->next;
+		host1x_fence_fd_signal(ffd);
+	}
+
+	pthread_cond_destroy(&waiter->cond);
+	pthread_mutex_destroy(&waiter->lock);
+	free(waiter->fences);
+	free(waiter);
+}
+
+static int host1x_fence_waiter_add(struct host1x_fence_waiter *waiter,
+				   struct host1x_fence *fences,
+				   unsigned int count, int fd)
+{
+	struct host1x_fence_fd *ffd;
+	int err = 0;
+
+	ffd = calloc(1, sizeof(*ffd));
+	if (!ffd)
+		return -ENOMEM;
+
+	ffd->fences = calloc(count, sizeof(*fences));
+	if (!ffd->fences) {
+		free(ffd);
+		return -ENOMEM;
+	}
+
+	memcpy(ffd->fences, fences, count * sizeof(*fences));
+	ffd->count = count;
+
+	/* the caller may close its file descriptor at any time */
+	ffd->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (ffd->fd < 0) {
+		err = -errno;
+		free(ffd->fences);
+		free(ffd);
+		return err;
+	}
+
+	pthread_mutex_lock(&waiter->lock);
+
+	if (!waiter->running) {
+		err = -pthread_create(&waiter->thread, NULL,
+				      host1x_fence_waiter_thread, waiter);
+		if (err == 0)
+			waiter->running = true;
+	}
+
+	if (err == 0) {
+		ffd->next = waiter->pending;
+		waiter->pending = ffd;
+		pthread_cond_signal(&waiter->cond);
+	}
+
+	pthread_mutex_unlock(&waiter->lock);
+
+	if (err < 0) {
+		close(ffd->fd);
+		free(ffd->fences);
+		free(ffd);
+	}
+
+	return err;
+}
+
+/*
+ * Returns a file descriptor that becomes readable once all of the fences
+ * have signaled, so that GPU completion can be handled by an event loop. The
+ * caller owns the file descriptor and needs to close it. A sync fence is
+ * returned if the kernel supports them, otherwise an eventfd. In the latter
+ * case the counter of the eventfd is set to the time at which the fences
+ * were seen to have signaled.
+ */
+int host1x_fence_get_fd(struct host1x *host1x, struct host1x_fence *fences,
+			unsigned int count, int *fdp)
+{
+	struct host1x_client *client = NULL;
+	struct host1x_fence *pending;
+	unsigned int i, num = 0;
+	int fd, err;
+
+	pending = calloc(count ? count : 1, sizeof(*pending));
+	if (!pending)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		err = host1x_fence_query(&fences[i]);
+		if (err < 0) {
+			free(pending);
+			return err;
+		}
+
+		if (err == 0) {
+			pending[num++] = fences[i];
+			client = fences[i].client;
+		}
+	}
+
+	if (client && client->export_fence) {
+		err = client->export_fence(client, pending, num, fdp);
+		if (err == 0 || (err != -ENOTTY && err != -EOPNOTSUPP)) {
+			free(pending);
+			return err;
+		}
+	}
+
+	fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd < 0) {
+		err = -errno;
+		free(pending);
+		return err;
+	}
+
+	if (num > 0) {
+		err = host1x_fence_waiter_add(host1x->waiter, pending, num, fd);
+	} else {
+		uint64_t value = host1x_get_time();
+
+		if (write(fd, &value, sizeof(value)) < 0)
+			err = -errno;
+		else
+			err = 0;
+	}
+
+	if (err < 0) {
+		close(fd);
+		free(pending);
+		return err;
+	}
+
+	free(pending);
+	*fdp = fd;
+
+	return 0;
+}
+
+/*
+ * Returns the time at which a signaled fence file descriptor returned by
+ * host1x_fence_get_fd() completed, in microseconds of CLOCK_MONOTONIC, or 0
+ * if that is unknown. Reading the time consumes an eventfd.
+ */
+uint64_t host1x_fence_fd_get_timestamp(int fd)
+{
+	struct sync_fence_info *fences;
+	struct sync_file_info info;
+	uint64_t timestamp = 0;
+	uint32_t i;
+
+	memset(&info, 0, sizeof(info));
+
+	if (ioctl(fd, SYNC_IOC_FILE_INFO, &info) < 0) {
+		if (read(fd, &timestamp, sizeof(timestamp)) < 0)
+			return 0;
+
+		return timestamp;
+	}
+
+	if (info.status != 1 || info.num_fences == 0)
+		return 0;
+
+	fences = calloc(info.num_fences, sizeof(*fences));
+	if (!fences)
+		return 0;
+
+	info.sync_fence_info = (uintptr_t)fences;
+
+	if (ioctl(fd, SYNC_IOC_FILE_INFO, &info) == 0) {
+		for (i = 0; i < info.num_fences; i++)
+			if (fences[i].timestamp_ns > timestamp)
+				timestamp = fences[i].timestamp_ns;
+	}
+
+	free(fences);
+
+	return timestamp / 1000;
+}
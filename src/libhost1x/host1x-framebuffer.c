@@ -22,7 +22,9 @@
  */
 
 #include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <png.h>
 
@@ -50,37 +52,84 @@ static void detile(void *target, struct host1x_framebuffer *fb,
 	}
 }
 
+/* expands RGB565 pixels to 8 bits per channel of RGB */
+static void expand_rgb565(uint8_t *target, const uint16_t *source,
+			  unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		uint16_t pixel = source[i];
+		uint8_t r = (pixel >> 11) & 0x1f;
+		uint8_t g = (pixel >> 5) & 0x3f;
+		uint8_t b = pixel & 0x1f;
+
+		target[i * 3 + 0] = (r << 3) | (r >> 2);
+		target[i * 3 + 1] = (g << 2) | (g >> 4);
+		target[i * 3 + 2] = (b << 3) | (b >> 2);
+	}
+}
+
 struct host1x_framebuffer *host1x_framebuffer_create(struct host1x *host1x,
 						     unsigned short width,
 						     unsigned short height,
 						     unsigned short depth,
 						     unsigned long flags)
+{
+	struct host1x_framebuffer *fb;
+	struct host1x_bo *bo;
+	unsigned int pitch;
+
+	/* XXX: depth buffer */
+	//depth += 16;
+
+	pitch = width * (depth / 8);
+
+	bo = host1x_bo_create(host1x, pitch * height, 1);
+	if (!bo)
+		return NULL;
+
+	fb = host1x_framebuffer_create_from_bo(host1x, bo, width, height, pitch,
+					       depth, flags);
+	if (!fb)
+		host1x_bo_free(bo);
+
+	return fb;
+}
+
+/*
+ * Wraps an existing buffer object, such as one imported from another
+ * device, in a framebuffer. On success the framebuffer takes ownership of
+ * the buffer object.
+ */
+struct host1x_framebuffer *
+host1x_framebuffer_create_from_bo(struct host1x *host1x, struct host1x_bo *bo,
+				  unsigned short width, unsigned short height,
+				  unsigned int pitch, unsigned short depth,
+				  unsigned long flags)
 {
 	struct host1x_framebuffer *fb;
 	int err;
 
+	if (pitch < width * (depth / 8) || pitch * height > bo->size)
+		return NULL;
+
 	fb = calloc(1, sizeof(*fb));
 	if (!fb)
 		return NULL;
 
-	/* XXX: depth buffer */
-	//depth += 16;
-
-	fb->pitch = width * (depth / 8);
+	fb->pitch = pitch;
 	fb->width = width;
 	fb->height = height;
 	fb->depth = depth;
-
-	fb->bo = host1x_bo_create(host1x, fb->pitch * height, 1);
-	if (!fb->bo) {
-		free(fb);
-		return NULL;
-	}
+	fb->flags = flags;
+	fb->bo = bo;
+	fb->fence = -1;
 
 	if (host1x->framebuffer_init) {
 		err = host1x->framebuffer_init(host1x, fb);
 		if (err < 0) {
-			host1x_framebuffer_free(fb);
+			free(fb);
 			fb = NULL;
 		}
 	}
@@ -90,21 +139,99 @@ struct host1x_framebuffer *host1x_framebuffer_create(struct host1x *host1x,
 
 void host1x_framebuffer_free(struct host1x_framebuffer *fb)
 {
+	if (fb->fence >= 0)
+		close(fb->fence);
+
 	host1x_bo_free(fb->bo);
 	free(fb);
 }
 
+struct host1x_bo *host1x_framebuffer_get_bo(struct host1x_framebuffer *fb)
+{
+	return fb->bo;
+}
+
+/*
+ * Attaches a fence file descriptor, such as one returned by
+ * host1x_fence_get_fd(), that signals once rendering to the framebuffer has
+ * completed. The framebuffer takes ownership of the file descriptor. It is
+ * consumed when the framebuffer is next shown, so that displays can wait
+ * for rendering without the CPU having to.
+ */
+void host1x_framebuffer_set_fence(struct host1x_framebuffer *fb, int fd)
+{
+	if (fb->fence >= 0)
+		close(fb->fence);
+
+	fb->submitted = host1x_get_time();
+	fb->completed = 0;
+	fb->fence = fd;
+}
+
+/* detaches the fence, the caller needs to close it */
+int host1x_framebuffer_take_fence(struct host1x_framebuffer *fb)
+{
+	int fd = fb->fence;
+
+	fb->fence = -1;
+
+	return fd;
+}
+
+/* used by displays that can't wait for fences by themselves */
+int host1x_framebuffer_wait_fence(struct host1x_framebuffer *fb)
+{
+	int fd = host1x_framebuffer_take_fence(fb);
+	struct pollfd fds;
+	int err;
+
+	if (fd < 0)
+		return 0;
+
+	fds.fd = fd;
+	fds.events = POLLIN;
+
+	do {
+		fds.revents = 0;
+		err = poll(&fds, 1, -1);
+	} while (err < 0 && errno == EINTR);
+
+	if (err < 0) {
+		err = -errno;
+	} else {
+		fb->completed = host1x_fence_fd_get_timestamp(fd);
+		if (!fb->completed)
+			fb->completed = host1x_get_time();
+	}
+
+	close(fd);
+
+	return err < 0 ? err : 0;
+}
+
 int host1x_framebuffer_save(struct host1x_framebuffer *fb, const char *path)
 {
 	png_structp png;
+	unsigned int i, stride;
 	png_bytep *rows;
 	png_infop info;
-	unsigned int i;
 	void *buffer;
+	int color;
 	FILE *fp;
 	int err;
 
-	if (fb->depth != 32) {
+	switch (fb->depth) {
+	case 16:
+		color = PNG_COLOR_TYPE_RGB;
+		stride = fb->width * 3;
+		break;
+
+	case 32:
+		color = PNG_COLOR_TYPE_RGBA;
+		stride = fb->pitch;
+		break;
+
+	default:
 		fprintf(stderr, "ERROR: %u bits per pixel not supported\n",
 			fb->depth);
 		return -EINVAL;
@@ -140,7 +267,7 @@ int host1x_framebuffer_save(struct host1x_framebuffer *fb, const char *path)
 	if (setjmp(png_jmpbuf(png)))
 		return -EIO;
 
-	png_set_IHDR(png, info, fb->width, fb->height, 8, PNG_COLOR_TYPE_RGBA,
+	png_set_IHDR(png, info, fb->width, fb->height, 8, color,
 		     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
 		     PNG_FILTER_TYPE_BASE);
 	png_write_info(png, info);
@@ -156,6 +283,21 @@ int host1x_framebuffer_save(struct host1x_framebuffer *fb, const char *path)
 
 	detile(buffer, fb, 16, 16);
 
+	if (fb->depth == 16) {
+		void *pixels = malloc(stride * fb->height);
+		if (!pixels) {
+			free(buffer);
+			return -ENOMEM;
+		}
+
+		for (i = 0; i < fb->height; i++)
+			expand_rgb565(pixels + i * stride,
+				      buffer + i * fb->pitch, fb->width);
+
+		free(buffer);
+		buffer = pixels;
+	}
+
 	rows = malloc(fb->height * sizeof(png_bytep));
 	if (!rows) {
 		fprintf(stderr, "out-of-memory\n");
@@ -163,7 +305,7 @@ int host1x_framebuffer_save(struct host1x_framebuffer *fb, const char *path)
 	}
 
 	for (i = 0; i < fb->height; i++)
-		rows[fb->height - i - 1] = buffer + i * fb->pitch;
+		rows[fb->height - i - 1] = buffer + i * stride;
 
 	png_write_image(png, rows);
 
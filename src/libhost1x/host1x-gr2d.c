@@ -33,14 +33,14 @@ static int host1x_gr2d_test(struct host1x_gr2d *gr2d)
 	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
 	struct host1x_pushbuf *pb;
 	struct host1x_job *job;
-	uint32_t fence;
+	struct host1x_fence fence;
 	int err = 0;
 
-	job = host1x_job_create(syncpt->id, 1);
+	job = host1x_job_create(syncpt->id);
 	if (!job)
 		return -ENOMEM;
 
-	pb = host1x_job_append(job, gr2d->commands, 0);
+	pb = host1x_job_append_ring(job, gr2d->commands);
 	if (!pb) {
 		host1x_job_free(job);
 		return -ENOMEM;
@@ -50,23 +50,13 @@ static int host1x_gr2d_test(struct host1x_gr2d *gr2d)
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x0001));
 	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
 
-	err = host1x_client_submit(gr2d->client, job);
-	if (err < 0) {
-		host1x_job_free(job);
-		return err;
-	}
-
+	err = host1x_client_submit_async(gr2d->client, job, &fence);
 	host1x_job_free(job);
 
-	err = host1x_client_flush(gr2d->client, &fence);
-	if (err < 0)
-		return err;
-
-	err = host1x_client_wait(gr2d->client, fence, -1);
 	if (err < 0)
 		return err;
 
-	return 0;
+	return host1x_fence_wait(&fence, -1);
 }
 
 static int host1x_gr2d_reset(struct host1x_gr2d *gr2d)
@@ -74,14 +64,14 @@ static int host1x_gr2d_reset(struct host1x_gr2d *gr2d)
 	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
 	struct host1x_pushbuf *pb;
 	struct host1x_job *job;
-	uint32_t fence;
+	struct host1x_fence fence;
 	int err;
 
-	job = host1x_job_create(syncpt->id, 1);
+	job = host1x_job_create(syncpt->id);
 	if (!job)
 		return -ENOMEM;
 
-	pb = host1x_job_append(job, gr2d->commands, 0);
+	pb = host1x_job_append_ring(job, gr2d->commands);
 	if (!pb) {
 		host1x_job_free(job);
 		return -ENOMEM;
@@ -127,40 +117,33 @@ static int host1x_gr2d_reset(struct host1x_gr2d *gr2d)
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x0001));
 	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
 
-	err = host1x_client_submit(gr2d->client, job);
-	if (err < 0) {
-		host1x_job_free(job);
-		return err;
-	}
-
+	err = host1x_client_submit_async(gr2d->client, job, &fence);
 	host1x_job_free(job);
 
-	err = host1x_client_flush(gr2d->client, &fence);
 	if (err < 0)
 		return err;
 
-	err = host1x_client_wait(gr2d->client, fence, -1);
-	if (err < 0)
-		return err;
-
-	return 0;
+	return host1x_fence_wait(&fence, -1);
 }
 
 int host1x_gr2d_init(struct host1x *host1x, struct host1x_gr2d *gr2d)
 {
 	int err;
 
-	gr2d->commands = host1x_bo_create(host1x, 8 * 4096, 2);
+	gr2d->commands = host1x_ring_create(host1x, 4, 8 * 4096);
 	if (!gr2d->commands)
 		return -ENOMEM;
 
-	err = host1x_bo_mmap(gr2d->commands, NULL);
-	if (err < 0)
-		return err;
-
 	gr2d->scratch = host1x_bo_create(host1x, 64, 3);
 	if (!gr2d->scratch) {
-		host1x_bo_free(gr2d->commands);
+		host1x_ring_free(gr2d->commands);
+		return -ENOMEM;
+	}
+
+	gr2d->batch = host1x_batch_create(gr2d->client, gr2d->commands, 2048);
+	if (!gr2d->batch) {
+		host1x_bo_free(gr2d->scratch);
+		host1x_ring_free(gr2d->commands);
 		return -ENOMEM;
 	}
 
@@ -175,8 +158,9 @@ int host1x_gr2d_init(struct host1x *host1x, struct host1x_gr2d *gr2d)
 
 	err = host1x_gr2d_reset(gr2d);
 	if (err < 0) {
+		host1x_batch_free(gr2d->batch);
 		host1x_bo_free(gr2d->scratch);
-		host1x_bo_free(gr2d->commands);
+		host1x_ring_free(gr2d->commands);
 		return err;
 	}
 
@@ -185,42 +169,34 @@ int host1x_gr2d_init(struct host1x *host1x, struct host1x_gr2d *gr2d)
 
 void host1x_gr2d_exit(struct host1x_gr2d *gr2d)
 {
-	host1x_bo_free(gr2d->commands);
+	host1x_batch_free(gr2d->batch);
+	host1x_ring_free(gr2d->commands);
 	host1x_bo_free(gr2d->scratch);
 }
 
 int host1x_gr2d_clear(struct host1x_gr2d *gr2d, struct host1x_framebuffer *fb,
-		      float red, float green, float blue, float alpha)
+		      float red, float green, float blue, float alpha,
+		      struct host1x_fence *fence)
 {
 	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
 	struct host1x_pushbuf *pb;
-	struct host1x_job *job;
-	uint32_t fence, color;
-	uint32_t pitch;
+	uint32_t color;
 	int err;
 
 	if (fb->depth == 16) {
 		color = ((uint32_t)(red   * 31) << 11) |
 			((uint32_t)(green * 63) <<  5) |
 			((uint32_t)(blue  * 31) <<  0);
-		pitch = fb->width * 2;
 	} else {
 		color = ((uint32_t)(alpha * 255) << 24) |
 			((uint32_t)(blue  * 255) << 16) |
 			((uint32_t)(green * 255) <<  8) |
 			((uint32_t)(red   * 255) <<  0);
-		pitch = fb->width * 4;
 	}
 
-	job = host1x_job_create(syncpt->id, 1);
-	if (!job)
-		return -ENOMEM;
-
-	pb = host1x_job_append(job, gr2d->commands, 0);
-	if (!pb) {
-		host1x_job_free(job);
+	pb = host1x_batch_begin(gr2d->batch);
+	if (!pb)
 		return -ENOMEM;
-	}
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0, 0x51, 0));
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_EXTEND(0, 0x01));
@@ -239,7 +215,7 @@ int host1x_gr2d_clear(struct host1x_gr2d *gr2d, struct host1x_framebuffer *fb,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x2b, 9));
 	host1x_pushbuf_relocate(pb, fb->bo, 0, 0);
 	host1x_pushbuf_push(pb, 0xdeadbeef);
-	host1x_pushbuf_push(pb, pitch);
+	host1x_pushbuf_push(pb, fb->pitch);
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x35, 1));
 	host1x_pushbuf_push(pb, color);
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x46, 1));
@@ -251,45 +227,35 @@ int host1x_gr2d_clear(struct host1x_gr2d *gr2d, struct host1x_framebuffer *fb,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 1));
 	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
 
-	err = host1x_client_submit(gr2d->client, job);
-	if (err < 0) {
-		host1x_job_free(job);
-		return err;
-	}
-
-	host1x_job_free(job);
-
-	err = host1x_client_flush(gr2d->client, &fence);
+	err = host1x_batch_end(gr2d->batch);
 	if (err < 0)
 		return err;
 
-	err = host1x_client_wait(gr2d->client, fence, -1);
-	if (err < 0)
-		return err;
-
-	return 0;
+	return host1x_batch_flush(gr2d->batch, fence);
 }
 
 int host1x_gr2d_blit(struct host1x_gr2d *gr2d, struct host1x_framebuffer *src,
 		     struct host1x_framebuffer *dst, unsigned int sx,
 		     unsigned int sy, unsigned int dx, unsigned int dy,
-		     unsigned int width, unsigned int height)
+		     unsigned int width, unsigned int height,
+		     struct host1x_fence *fence)
 {
 	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
 	struct host1x_pushbuf *pb;
-	struct host1x_job *job;
-	uint32_t fence;
+	uint32_t control;
 	int err;
 
-	job = host1x_job_create(syncpt->id, 1);
-	if (!job)
-		return -ENOMEM;
+	if (src->depth != dst->depth)
+		return -EINVAL;
 
-	pb = host1x_job_append(job, gr2d->commands, 0);
-	if (!pb) {
-		host1x_job_free(job);
+	if (dst->depth == 16)
+		control = 0x00110000;
+	else
+		control = 0x00120000;
+
+	pb = host1x_batch_begin(gr2d->batch);
+	if (!pb)
 		return -ENOMEM;
-	}
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0, 0x51, 0));
 
@@ -303,7 +269,7 @@ int host1x_gr2d_blit(struct host1x_gr2d *gr2d, struct host1x_framebuffer *src,
 	 * [20:20] source color depth (0: mono, 1: same)
 	 * [17:16] destination color depth (0: 8 bpp, 1: 16 bpp, 2: 32 bpp)
 	 */
-	host1x_pushbuf_push(pb, 0x00120000); /* controlmain */
+	host1x_pushbuf_push(pb, control); /* controlmain */
 	host1x_pushbuf_push(pb, 0x000000cc); /* ropfade */
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x046, 1));
@@ -327,21 +293,9 @@ int host1x_gr2d_blit(struct host1x_gr2d *gr2d, struct host1x_framebuffer *src,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 1));
 	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
 
-	err = host1x_client_submit(gr2d->client, job);
-	if (err < 0) {
-		host1x_job_free(job);
-		return err;
-	}
-
-	host1x_job_free(job);
-
-	err = host1x_client_flush(gr2d->client, &fence);
+	err = host1x_batch_end(gr2d->batch);
 	if (err < 0)
 		return err;
 
-	err = host1x_client_wait(gr2d->client, fence, -1);
-	if (err < 0)
-		return err;
-
-	return 0;
+	return host1x_batch_flush(gr2d->batch, fence);
 }
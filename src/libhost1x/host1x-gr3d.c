@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "nvhost-gr3d.h"
@@ -39,14 +40,14 @@ static int host1x_gr3d_test(struct host1x_gr3d *gr3d)
 	struct host1x_syncpt *syncpt = &gr3d->client->syncpts[0];
 	struct host1x_pushbuf *pb;
 	struct host1x_job *job;
-	uint32_t fence;
+	struct host1x_fence fence;
 	int err = 0;
 
-	job = host1x_job_create(syncpt->id, 1);
+	job = host1x_job_create(syncpt->id);
 	if (!job)
 		return -ENOMEM;
 
-	pb = host1x_job_append(job, gr3d->commands, 0);
+	pb = host1x_job_append_ring(job, gr3d->commands);
 	if (!pb) {
 		host1x_job_free(job);
 		return -ENOMEM;
@@ -56,42 +57,25 @@ static int host1x_gr3d_test(struct host1x_gr3d *gr3d)
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x0001));
 	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
 
-	err = host1x_client_submit(gr3d->client, job);
-	if (err < 0) {
-		host1x_job_free(job);
-		return err;
-	}
-
+	err = host1x_client_submit_async(gr3d->client, job, &fence);
 	host1x_job_free(job);
 
-	err = host1x_client_flush(gr3d->client, &fence);
-	if (err < 0)
-		return err;
-
-	err = host1x_client_wait(gr3d->client, fence, -1);
 	if (err < 0)
 		return err;
 
-	return 0;
+	return host1x_fence_wait(&fence, -1);
 }
 
-static int host1x_gr3d_reset(struct host1x_gr3d *gr3d)
+/*
+ * Records the register writes that bring gr3d into a known state. They are
+ * the same every time, so they are recorded into a fragment only once.
+ */
+static int host1x_gr3d_record_reset(struct host1x_pushbuf *pb,
+				    struct host1x_syncpt *syncpt)
 {
-	struct host1x_syncpt *syncpt = &gr3d->client->syncpts[0];
 	const unsigned int num_attributes = 16;
-	struct host1x_pushbuf *pb;
-	struct host1x_job *job;
 	unsigned int i;
-	uint32_t fence;
-	int err;
-
-	job = host1x_job_create(syncpt->id, 2);
-	if (!job)
-		return -ENOMEM;
-
-	pb = host1x_job_append(job, gr3d->commands, 0);
-	if (!pb)
-		return -ENOMEM;
+	uint32_t *ptr;
 
 	/*
 	  Command Buffer:
@@ -148,14 +132,13 @@ static int host1x_gr3d_reset(struct host1x_gr3d *gr3d)
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x207, 0x0001));
 	host1x_pushbuf_push(pb, 0x00000000);
 
+	host1x_pushbuf_prepare(pb, 1 + 256 * 4);
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x208, 256 * 4));
+	ptr = host1x_pushbuf_reserve(pb, 256 * 4);
+	if (!ptr)
+		return -ENOMEM;
 
-	for (i = 0; i < 256; i++) {
-		host1x_pushbuf_push(pb, 0x00000000);
-		host1x_pushbuf_push(pb, 0x00000000);
-		host1x_pushbuf_push(pb, 0x00000000);
-		host1x_pushbuf_push(pb, 0x00000000);
-	}
+	memset(ptr, 0, 256 * 4 * sizeof(*ptr));
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x209, 0x0003));
 	host1x_pushbuf_push(pb, 0x00000000);
@@ -326,12 +309,13 @@ static int host1x_gr3d_reset(struct host1x_gr3d *gr3d)
 	    commands: 2048
 	*/
 	/* write 256 64-bit fragment shader instructions (NOP?) */
+	host1x_pushbuf_prepare(pb, 1 + 256 * 2);
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x804, 0x0200));
+	ptr = host1x_pushbuf_reserve(pb, 256 * 2);
+	if (!ptr)
+		return -ENOMEM;
 
-	for (i = 0; i < 256; i++) {
-		host1x_pushbuf_push(pb, 0x00000000);
-		host1x_pushbuf_push(pb, 0x00000000);
-	}
+	memset(ptr, 0, 256 * 2 * sizeof(*ptr));
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x805, 0x0001));
 	host1x_pushbuf_push(pb, 0x00000000);
@@ -647,23 +631,46 @@ static int host1x_gr3d_reset(struct host1x_gr3d *gr3d)
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xe25, 0x0000));
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xa0a, 0x0000));
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x544, 0x0000));
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xe27, 0x0001));
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x0001));
-	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+	return host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xe27, 0x0001));
+}
 
-	err = host1x_client_submit(gr3d->client, job);
-	if (err < 0)
-		return err;
+static int host1x_gr3d_reset(struct host1x_gr3d *gr3d)
+{
+	struct host1x_syncpt *syncpt = &gr3d->client->syncpts[0];
+	struct host1x_pushbuf *pb;
+	struct host1x_fence fence;
+	struct host1x_job *job;
+	int err;
 
-	err = host1x_client_flush(gr3d->client, &fence);
-	if (err < 0)
+	/* the reset writes registers behind the back of the shadow */
+	host1x_shadow_invalidate(gr3d->client->shadow);
+
+	job = host1x_job_create(syncpt->id);
+	if (!job)
+		return -ENOMEM;
+
+	pb = host1x_job_append_ring(job, gr3d->commands);
+	if (!pb) {
+		host1x_job_free(job);
+		return -ENOMEM;
+	}
+
+	err = host1x_pushbuf_gather(pb, gr3d->reset);
+	if (err < 0) {
+		host1x_job_free(job);
 		return err;
+	}
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x0001));
+	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+
+	err = host1x_client_submit_async(gr3d->client, job, &fence);
+	host1x_job_free(job);
 
-	err = host1x_client_wait(gr3d->client, fence, -1);
 	if (err < 0)
 		return err;
 
-	return 0;
+	return host1x_fence_wait(&fence, -1);
 }
 
 void host1x_gr3d_viewport(struct host1x_pushbuf *pb, float x, float y,
@@ -697,44 +704,89 @@ int host1x_gr3d_init(struct host1x *host1x, struct host1x_gr3d *gr3d)
 {
 	int err;
 
-	gr3d->commands = host1x_bo_create(host1x, 32 * 4096, 2);
+	gr3d->commands = host1x_ring_create(host1x, 4, 32 * 4096);
 	if (!gr3d->commands)
 		return -ENOMEM;
 
-	err = host1x_bo_mmap(gr3d->commands, NULL);
-	if (err < 0) {
-		host1x_bo_free(gr3d->commands);
-		return err;
-	}
-
 	gr3d->attributes = host1x_bo_create(host1x, 12 * 4096, 4);
 	if (!gr3d->attributes) {
-		host1x_bo_free(gr3d->commands);
+		host1x_ring_free(gr3d->commands);
 		return -ENOMEM;
 	}
 
 	err = host1x_bo_mmap(gr3d->attributes, NULL);
 	if (err < 0) {
 		host1x_bo_free(gr3d->attributes);
-		host1x_bo_free(gr3d->commands);
+		host1x_ring_free(gr3d->commands);
 		return err;
 	}
 
+	gr3d->batch = host1x_batch_create(gr3d->client, gr3d->commands, 16384);
+	if (!gr3d->batch) {
+		host1x_bo_free(gr3d->attributes);
+		host1x_ring_free(gr3d->commands);
+		return -ENOMEM;
+	}
+
 	if (HOST1X_GR3D_TEST) {
 		err = host1x_gr3d_test(gr3d);
 		if (err < 0) {
 			fprintf(stderr, "host1x_gr3d_test() failed: %d\n",
 				err);
+			host1x_batch_free(gr3d->batch);
 			host1x_bo_free(gr3d->attributes);
-			host1x_bo_free(gr3d->commands);
+			host1x_ring_free(gr3d->commands);
 			return err;
 		}
 	}
 
-	err = host1x_gr3d_reset(gr3d);
+	/*
+	 * XXX: State written by other processes sharing the engine can't be
+	 * detected, so the shadow assumes that this is the only user.
+	 */
+	gr3d->client->shadow = host1x_shadow_create(0x1000);
+	if (!gr3d->client->shadow) {
+		host1x_batch_free(gr3d->batch);
+		host1x_bo_free(gr3d->attributes);
+		host1x_ring_free(gr3d->commands);
+		return -ENOMEM;
+	}
+
+	/* vertex program constants, indexed in units of vec4 */
+	err = host1x_shadow_add_memory(gr3d->client->shadow, 0x207, 0x208,
+				       1024, 4);
 	if (err < 0) {
+		host1x_shadow_free(gr3d->client->shadow);
+		host1x_batch_free(gr3d->batch);
 		host1x_bo_free(gr3d->attributes);
-		host1x_bo_free(gr3d->commands);
+		host1x_ring_free(gr3d->commands);
+		return err;
+	}
+
+	gr3d->reset = host1x_fragment_create(host1x,
+					     gr3d->client->syncpts[0].id);
+	if (!gr3d->reset) {
+		host1x_shadow_free(gr3d->client->shadow);
+		host1x_batch_free(gr3d->batch);
+		host1x_bo_free(gr3d->attributes);
+		host1x_ring_free(gr3d->commands);
+		return -ENOMEM;
+	}
+
+	err = host1x_gr3d_record_reset(host1x_fragment_begin(gr3d->reset),
+				       &gr3d->client->syncpts[0]);
+	if (err == 0)
+		err = host1x_fragment_end(gr3d->reset);
+
+	if (err == 0)
+		err = host1x_gr3d_reset(gr3d);
+
+	if (err < 0) {
+		host1x_fragment_free(gr3d->reset);
+		host1x_shadow_free(gr3d->client->shadow);
+		host1x_batch_free(gr3d->batch);
+		host1x_bo_free(gr3d->attributes);
+		host1x_ring_free(gr3d->commands);
 		return err;
 	}
 
@@ -743,12 +795,17 @@ int host1x_gr3d_init(struct host1x *host1x, struct host1x_gr3d *gr3d)
 
 void host1x_gr3d_exit(struct host1x_gr3d *gr3d)
 {
+	host1x_shadow_free(gr3d->client->shadow);
+	gr3d->client->shadow = NULL;
+	host1x_fragment_free(gr3d->reset);
+	host1x_batch_free(gr3d->batch);
 	host1x_bo_free(gr3d->attributes);
-	host1x_bo_free(gr3d->commands);
+	host1x_ring_free(gr3d->commands);
 }
 
 int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
-			 struct host1x_framebuffer *fb)
+			 struct host1x_framebuffer *fb,
+			 struct host1x_fence *fence)
 {
 	union {
 		uint32_t u;
@@ -757,17 +814,18 @@ int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
 	struct host1x_syncpt *syncpt = &gr3d->client->syncpts[0];
 	float *attr = gr3d->attributes->ptr;
 	struct host1x_pushbuf *pb;
-	unsigned int depth = 32;
-	struct host1x_job *job;
-	uint32_t format, pitch;
+	unsigned int depth = fb->depth;
+	uint32_t format;
 	uint16_t *indices;
-	uint32_t fence;
 	int err, i;
 
-	/* XXX: count syncpoint increments in command stream */
-	job = host1x_job_create(syncpt->id, 9);
-	if (!job)
-		return -ENOMEM;
+	/* the attributes may still be in use by the previous job */
+	err = host1x_fence_wait(&gr3d->batch->fence, -1);
+	if (err < 0)
+		return err;
+
+	/* the triangle is drawn with raw writes that bypass the shadow */
+	host1x_shadow_invalidate(gr3d->client->shadow);
 
 	/* colors */
 	/* red */
@@ -812,11 +870,7 @@ int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
 	*indices++ = 0x0001;
 	*indices++ = 0x0002;
 
-	err = host1x_bo_invalidate(gr3d->attributes, 0, 112);
-	if (err < 0) {
-		host1x_job_free(job);
-		return err;
-	}
+	host1x_bo_mark_dirty(gr3d->attributes, 0, 112);
 
 	/*
 	  Command Buffer:
@@ -824,11 +878,9 @@ int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
 	    commands: 103
 	*/
 
-	pb = host1x_job_append(job, gr3d->commands, 0);
-	if (!pb) {
-		host1x_job_free(job);
+	pb = host1x_batch_begin(gr3d->batch);
+	if (!pb)
 		return -ENOMEM;
-	}
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x404, 2));
 	host1x_pushbuf_push(pb, 0x00000000);
@@ -871,15 +923,13 @@ int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
 	host1x_pushbuf_push(pb, fb->height & 0xffff);
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe11, 0x01));
 
-	if (depth == 16) {
+	if (depth == 16)
 		format = HOST1X_GR3D_FORMAT_RGB565;
-		pitch = fb->width * 2;
-	} else {
+	else
 		format = HOST1X_GR3D_FORMAT_RGBA8888;
-		pitch = fb->width * 4;
-	}
 
-	host1x_pushbuf_push(pb, 0x04000000 | (pitch << 8) | format << 2 | 0x1);
+	host1x_pushbuf_push(pb, 0x04000000 | (fb->pitch << 8) | format << 2 |
+			    0x1);
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x903, 0x01));
 	host1x_pushbuf_push(pb, 0x00000002);
@@ -1077,21 +1127,9 @@ int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 0x01));
 	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
 
-	err = host1x_client_submit(gr3d->client, job);
-	if (err < 0) {
-		host1x_job_free(job);
-		return err;
-	}
-
-	host1x_job_free(job);
-
-	err = host1x_client_flush(gr3d->client, &fence);
+	err = host1x_batch_end(gr3d->batch);
 	if (err < 0)
 		return err;
 
-	err = host1x_client_wait(gr3d->client, fence, -1);
-	if (err < 0)
-		return err;
-
-	return 0;
+	return host1x_batch_flush(gr3d->batch, fence);
 }
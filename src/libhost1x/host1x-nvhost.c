@@ -58,6 +58,13 @@ static int nvhost_bo_flush(struct host1x_bo *bo, loff_t offset, size_t length)
 						 offset, length);
 }
 
+static int nvhost_bo_export_name(struct host1x_bo *bo, uint32_t *name)
+{
+	struct nvhost_bo *nbo = to_nvhost_bo(bo);
+
+	return nvmap_handle_get_id(nbo->nvmap, nbo->handle, name);
+}
+
 static void nvhost_bo_free(struct host1x_bo *bo)
 {
 	struct nvhost_bo *nbo = to_nvhost_bo(bo);
@@ -134,6 +141,41 @@ static struct host1x_bo *nvhost_bo_create(struct host1x *host1x, size_t size,
 	bo->base.mmap = nvhost_bo_mmap;
 	bo->base.invalidate = nvhost_bo_invalidate;
 	bo->base.flush = nvhost_bo_flush;
+	bo->base.export_name = nvhost_bo_export_name;
+	bo->base.free = nvhost_bo_free;
+
+	return &bo->base;
+}
+
+/*
+ * nvmap predates DMA-BUF, so buffers can only be shared using their global
+ * IDs on this backend.
+ */
+static struct host1x_bo *nvhost_bo_import_name(struct host1x *host1x,
+					       uint32_t name)
+{
+	struct nvhost *nvhost = to_nvhost(host1x);
+	struct nvhost_bo *bo;
+
+	bo = calloc(1, sizeof(*bo));
+	if (!bo)
+		return NULL;
+
+	bo->nvmap = nvhost->nvmap;
+
+	bo->handle = nvmap_handle_from_id(nvhost->nvmap, name);
+	if (!bo->handle) {
+		free(bo);
+		return NULL;
+	}
+
+	bo->base.handle = bo->handle->id;
+	bo->base.size = bo->handle->size;
+
+	bo->base.mmap = nvhost_bo_mmap;
+	bo->base.invalidate = nvhost_bo_invalidate;
+	bo->base.flush = nvhost_bo_flush;
+	bo->base.export_name = nvhost_bo_export_name;
 	bo->base.free = nvhost_bo_free;
 
 	return &bo->base;
@@ -145,6 +187,7 @@ static void host1x_nvhost_close(struct host1x *host1x)
 
 	nvhost_gr3d_close(nvhost->gr3d);
 	nvhost_gr2d_close(nvhost->gr2d);
+	host1x_bo_cache_exit(&nvhost->base.bo_cache);
 	nvhost_ctrl_close(nvhost->ctrl);
 	nvmap_close(nvhost->nvmap);
 }
@@ -157,6 +200,8 @@ struct host1x *host1x_nvhost_open(void)
 	if (!nvhost)
 		return NULL;
 
+	host1x_bo_cache_init(&nvhost->base.bo_cache);
+
 	nvhost->nvmap = nvmap_open();
 	if (!nvhost->nvmap)
 		return NULL;
@@ -166,6 +211,7 @@ struct host1x *host1x_nvhost_open(void)
 		return NULL;
 
 	nvhost->base.bo_create = nvhost_bo_create;
+	nvhost->base.bo_import_name = nvhost_bo_import_name;
 	nvhost->base.close = host1x_nvhost_close;
 
 	nvhost->gr2d = nvhost_gr2d_open(nvhost);
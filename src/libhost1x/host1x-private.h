@@ -24,16 +24,28 @@
 #ifndef GRATE_HOST1X_PRIVATE_H
 #define GRATE_HOST1X_PRIVATE_H 1
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "host1x.h"
 
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
 #define container_of(ptr, type, member) ({ \
 		const typeof(((type *)0)->member) *__mptr = (ptr); \
 		(type *)((char *)__mptr - offsetof(type, member)); \
 	})
 
+enum host1x_class {
+	HOST1X_CLASS_HOST1X = 0x01,
+	HOST1X_CLASS_GR2D = 0x51,
+	HOST1X_CLASS_GR2D_SB = 0x52,
+	HOST1X_CLASS_GR3D = 0x60,
+};
+
 struct host1x_framebuffer {
 	unsigned short width;
 	unsigned int pitch;
@@ -42,30 +54,156 @@ struct host1x_framebuffer {
 	unsigned long flags;
 	struct host1x_bo *bo;
 	uint32_t handle;
+	/* signals when rendering completes, -1 if there's nothing to wait for */
+	int fence;
+	/* when rendering was submitted and completed, in microseconds */
+	uint64_t submitted;
+	uint64_t completed;
 };
 
+int host1x_framebuffer_wait_fence(struct host1x_framebuffer *fb);
+int host1x_framebuffer_take_fence(struct host1x_framebuffer *fb);
+
 struct host1x_syncpt {
 	uint32_t id;
-	uint32_t value;
+	/*
+	 * Last value that was observed, a lower bound for the current one.
+	 * It is updated by submitting threads as well as by the fence waiter.
+	 */
+	_Atomic uint32_t value;
 };
 
+/* syncpoint values wrap around, so compare within a window of 2^31 */
+static inline bool host1x_syncpt_passed(uint32_t value, uint32_t thresh)
+{
+	return (int32_t)(value - thresh) >= 0;
+}
+
+static inline bool host1x_syncpt_expired(struct host1x_syncpt *syncpt,
+					 uint32_t thresh)
+{
+	uint32_t value = atomic_load_explicit(&syncpt->value,
+					      memory_order_relaxed);
+
+	return host1x_syncpt_passed(value, thresh);
+}
+
+/* syncpoints never move backwards, so neither does the cached value */
+static inline void host1x_syncpt_update(struct host1x_syncpt *syncpt,
+					uint32_t value)
+{
+	uint32_t old = atomic_load_explicit(&syncpt->value,
+					    memory_order_relaxed);
+
+	while (host1x_syncpt_passed(value, old) && value != old)
+		if (atomic_compare_exchange_weak_explicit(&syncpt->value, &old,
+							  value,
+							  memory_order_relaxed,
+							  memory_order_relaxed))
+			break;
+}
+
 struct host1x_bo {
+	struct host1x *host1x;
+	unsigned long flags;
 	uint32_t handle;
 	size_t size;
 	void *ptr;
 
+	/*
+	 * Fence of the last job that used the buffer object.
+	 *
+	 * XXX: jobs on different clients aren't ordered, so this is only
+	 * accurate if callers synchronize between clients.
+	 */
+	struct host1x_fence fence;
+
+	/* range of CPU writes that haven't been flushed yet */
+	unsigned long dirty_start;
+	unsigned long dirty_end;
+
+	/*
+	 * Buffer objects that are shared with other devices or processes
+	 * must not be recycled through the cache.
+	 */
+	bool shared;
+
+	/*
+	 * ID used to refer to the buffer object in capture files. It is only
+	 * valid within the capture of the same generation.
+	 */
+	uint32_t capture_id;
+	uint32_t capture_generation;
+
+	/* buffer object cache */
+	struct host1x_bo *prev;
+	struct host1x_bo *next;
+	time_t freed;
+
 	int (*mmap)(struct host1x_bo *bo);
 	int (*invalidate)(struct host1x_bo *bo, loff_t offset, size_t length);
 	int (*flush)(struct host1x_bo *bo, loff_t offset, size_t length);
+	int (*export_fd)(struct host1x_bo *bo, int *fd);
+	int (*export_name)(struct host1x_bo *bo, uint32_t *name);
 	void (*free)(struct host1x_bo *bo);
 };
 
+/* 4 KiB to 64 MiB, four buckets per power of two */
+#define HOST1X_BO_CACHE_BUCKETS 52
+
+struct host1x_bo_bucket {
+	struct host1x_bo *first;
+	struct host1x_bo *last;
+};
+
+struct host1x_bo_cache {
+	struct host1x_bo_bucket buckets[HOST1X_BO_CACHE_BUCKETS];
+	struct host1x_bo_cache_stats stats;
+	pthread_mutex_t lock;
+};
+
+void host1x_bo_cache_init(struct host1x_bo_cache *cache);
+void host1x_bo_cache_exit(struct host1x_bo_cache *cache);
+
+struct host1x_bo *host1x_bo_cache_get(struct host1x_bo_cache *cache,
+				      size_t *size, unsigned long flags);
+bool host1x_bo_cache_put(struct host1x_bo_cache *cache, struct host1x_bo *bo);
+void host1x_bo_cache_purge(struct host1x_bo_cache *cache);
+void host1x_bo_cache_get_stats(struct host1x_bo_cache *cache,
+			       struct host1x_bo_cache_stats *stats);
+
+struct host1x_shadow *host1x_shadow_create(unsigned int num_regs);
+void host1x_shadow_free(struct host1x_shadow *shadow);
+int host1x_shadow_add_memory(struct host1x_shadow *shadow, uint32_t index,
+			     uint32_t data, unsigned int size,
+			     unsigned int granularity);
+
+struct host1x_fence_waiter;
+
+struct host1x_fence_waiter *host1x_fence_waiter_create(void);
+void host1x_fence_waiter_free(struct host1x_fence_waiter *waiter);
+
+struct host1x_capture;
+
+int host1x_capture_job(struct host1x_capture *capture,
+		       struct host1x_client *client, struct host1x_job *job);
+
+int host1x_ring_alloc(struct host1x_ring *ring, struct host1x_pushbuf *pb,
+		      size_t *size, struct host1x_bo **bo,
+		      unsigned long *offset);
+void host1x_ring_fence(struct host1x_ring *ring, struct host1x_job *job,
+		       struct host1x_fence *fence);
+
 static inline unsigned long host1x_bo_get_offset(struct host1x_bo *bo,
 						 void *ptr)
 {
 	return (unsigned long)ptr - (unsigned long)bo->ptr;
 }
 
+int host1x_pushbuf_relocate_at(struct host1x_pushbuf *pb, uint32_t *word,
+			       struct host1x_bo *target, unsigned long offset,
+			       unsigned long shift);
+
 struct host1x_display {
 	unsigned int width;
 	unsigned int height;
@@ -74,8 +212,29 @@ struct host1x_display {
 			      struct host1x_overlay **overlayp);
 	int (*set)(struct host1x_display *display,
 		   struct host1x_framebuffer *fb, bool vsync);
+
+	/*
+	 * Optional. Queues a flip for the next vertical blank and returns
+	 * immediately. Completion is reported by handle_events(), which is
+	 * called whenever the file descriptor becomes readable.
+	 */
+	int (*flip)(struct host1x_display *display,
+		    struct host1x_framebuffer *fb);
+	int (*handle_events)(struct host1x_display *display);
+	int fd;
+
+	struct host1x_framebuffer *pending;
+	uint64_t queued;
+	struct host1x_flip last;
 };
 
+uint64_t host1x_get_time(void);
+uint64_t host1x_fence_fd_get_timestamp(int fd);
+
+void host1x_display_flip_done(struct host1x_display *display,
+			      unsigned int sequence, unsigned int sec,
+			      unsigned int usec);
+
 struct host1x_overlay {
 	int (*close)(struct host1x_overlay *overlay);
 	int (*set)(struct host1x_overlay *overlay,
@@ -87,17 +246,32 @@ struct host1x_overlay {
 struct host1x_client {
 	struct host1x_syncpt *syncpts;
 	unsigned int num_syncpts;
+	uint32_t class;
 
 	int (*submit)(struct host1x_client *client, struct host1x_job *job);
 	int (*flush)(struct host1x_client *client, uint32_t *fence);
-	int (*wait)(struct host1x_client *client, uint32_t fence,
-		    uint32_t timeout);
+	int (*wait)(struct host1x_client *client, uint32_t syncpt,
+		    uint32_t fence, uint32_t timeout);
+	int (*read_syncpt)(struct host1x_client *client, uint32_t syncpt,
+			   uint32_t *value);
+
+	/* optional, creates a file descriptor that signals with the fences */
+	int (*export_fence)(struct host1x_client *client,
+			    struct host1x_fence *fences, unsigned int count,
+			    int *fd);
+
+	/* register shadow, for clients that support eliding writes */
+	struct host1x_shadow *shadow;
 };
 
+struct host1x_syncpt *host1x_client_find_syncpt(struct host1x_client *client,
+						uint32_t id);
+
 struct host1x_gr2d {
 	struct host1x_client *client;
-	struct host1x_bo *commands;
+	struct host1x_ring *commands;
 	struct host1x_bo *scratch;
+	struct host1x_batch *batch;
 };
 
 int host1x_gr2d_init(struct host1x *host1x, struct host1x_gr2d *gr2d);
@@ -105,8 +279,10 @@ void host1x_gr2d_exit(struct host1x_gr2d *gr2d);
 
 struct host1x_gr3d {
 	struct host1x_client *client;
-	struct host1x_bo *commands;
+	struct host1x_ring *commands;
 	struct host1x_bo *attributes;
+	struct host1x_batch *batch;
+	struct host1x_fragment *reset;
 };
 
 int host1x_gr3d_init(struct host1x *host1x, struct host1x_gr3d *gr3d);
@@ -115,10 +291,18 @@ void host1x_gr3d_exit(struct host1x_gr3d *gr3d);
 struct host1x {
 	struct host1x_bo *(*bo_create)(struct host1x *host1x, size_t size,
 				       unsigned long flags);
+	struct host1x_bo *(*bo_import_fd)(struct host1x *host1x, int fd);
+	struct host1x_bo *(*bo_import_name)(struct host1x *host1x,
+					    uint32_t name);
 	int (*framebuffer_init)(struct host1x *host1x,
 				struct host1x_framebuffer *fb);
 	void (*close)(struct host1x *host1x);
 
+	struct host1x_bo_cache bo_cache;
+	struct host1x_capture *capture;
+	uint32_t capture_generation;
+	struct host1x_fence_waiter *waiter;
+
 	struct host1x_display *display;
 	struct host1x_gr2d *gr2d;
 	struct host1x_gr3d *gr3d;
@@ -126,5 +310,6 @@ struct host1x {
 
 struct host1x *host1x_nvhost_open(void);
 struct host1x *host1x_drm_open(void);
+struct host1x *host1x_soft_open(void);
 
 #endif
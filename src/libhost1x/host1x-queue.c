@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * Jobs are passed to the submission thread through an intrusive, lock-free
+ * multiple-producer single-consumer queue. Producers append by swapping the
+ * head pointer and then linking the previous head to the new node, so there
+ * is a short window during which a node has been appended but can't yet be
+ * reached from the tail. The consumer simply retries in that case.
+ *
+ * A stub node keeps the queue from ever becoming completely empty, which
+ * avoids having to synchronize producers and consumer on the last node.
+ */
+struct host1x_queue_node {
+	struct host1x_queue_node *_Atomic next;
+};
+
+struct host1x_recorder_slot {
+	struct host1x_queue_node node;
+	struct host1x_recorder *recorder;
+
+	struct host1x_ring *ring;
+	struct host1x_job *job;
+
+	/* set by the submission thread, valid once pending is cleared */
+	struct host1x_fence fence;
+	int error;
+
+	atomic_bool pending;
+};
+
+struct host1x_recorder {
+	struct host1x_queue *queue;
+	struct host1x_client *client;
+
+	struct host1x_recorder_slot *slots;
+	unsigned int num_slots;
+	unsigned int current;
+
+	/* the slot that is being recorded, if any */
+	struct host1x_recorder_slot *slot;
+	struct host1x_pushbuf *pb;
+
+	/* the most recently finished slot */
+	struct host1x_recorder_slot *last;
+	int error;
+};
+
+struct host1x_queue {
+	struct host1x *host1x;
+
+	struct host1x_queue_node *_Atomic head;
+	struct host1x_queue_node *tail;
+	struct host1x_queue_node stub;
+
+	/* appended by host1x_queue_free() to stop the thread */
+	struct host1x_queue_node exit;
+
+	/* counts the nodes that have been appended */
+	sem_t available;
+
+	/* signaled whenever a job has been submitted */
+	pthread_mutex_t lock;
+	pthread_cond_t submitted;
+
+	pthread_t thread;
+};
+
+static void host1x_queue_push(struct host1x_queue *queue,
+			      struct host1x_queue_node *node)
+{
+	struct host1x_queue_node *prev;
+
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	prev = atomic_exchange_explicit(&queue->head, node,
+					memory_order_acq_rel);
+	atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/*
+ * Returns the oldest node of the queue or NULL if the queue is empty or a
+ * producer hasn't finished appending the next node yet.
+ */
+static struct host1x_queue_node *host1x_queue_pop(struct host1x_queue *queue)
+{
+	struct host1x_queue_node *tail = queue->tail, *next, *head;
+
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+	if (tail == &queue->stub) {
+		if (!next)
+			return NULL;
+
+		queue->tail = next;
+		tail = next;
+		next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	}
+
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+
+	head = atomic_load_explicit(&queue->head, memory_order_acquire);
+	if (tail != head)
+		return NULL;
+
+	/* re-insert the stub so that the last node can be detached */
+	host1x_queue_push(queue, &queue->stub);
+
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+static void host1x_queue_submit(struct host1x_queue *queue,
+				struct host1x_recorder_slot *slot)
+{
+	struct host1x_recorder *recorder = slot->recorder;
+
+	slot->error = host1x_client_submit_async(recorder->client, slot->job,
+						 &slot->fence);
+
+	/*
+	 * The recorder may reuse the slot as soon as pending is cleared, so
+	 * this needs to be done with the lock held to not miss the wakeup.
+	 */
+	pthread_mutex_lock(&queue->lock);
+	atomic_store_explicit(&slot->pending, false, memory_order_release);
+	pthread_cond_broadcast(&queue->submitted);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+static void *host1x_queue_thread(void *data)
+{
+	struct host1x_queue *queue = data;
+	struct host1x_queue_node *node;
+
+	while (true) {
+		while (sem_wait(&queue->available) < 0)
+			;
+
+		/* the semaphore guarantees that a node is on its way */
+		while ((node = host1x_queue_pop(queue)) == NULL)
+			sched_yield();
+
+		if (node == &queue->exit)
+			break;
+
+		host1x_queue_submit(queue, container_of(node,
+					struct host1x_recorder_slot, node));
+	}
+
+	return NULL;
+}
+
+struct host1x_queue *host1x_queue_create(struct host1x *host1x)
+{
+	struct host1x_queue *queue;
+	int err;
+
+	queue = calloc(1, sizeof(*queue));
+	if (!queue)
+		return NULL;
+
+	queue->host1x = host1x;
+
+	atomic_init(&queue->stub.next, NULL);
+	atomic_init(&queue->head, &queue->stub);
+	queue->tail = &queue->stub;
+
+	if (sem_init(&queue->available, 0, 0) < 0) {
+		free(queue);
+		return NULL;
+	}
+
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->submitted, NULL);
+
+	err = pthread_create(&queue->thread, NULL, host1x_queue_thread, queue);
+	if (err != 0) {
+		pthread_cond_destroy(&queue->submitted);
+		pthread_mutex_destroy(&queue->lock);
+		sem_destroy(&queue->available);
+		free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+/*
+ * Jobs that have already been queued are submitted before the thread exits.
+ * All recorders must have been freed before the queue.
+ */
+void host1x_queue_free(struct host1x_queue *queue)
+{
+	if (!queue)
+		return;
+
+	host1x_queue_push(queue, &queue->exit);
+	sem_post(&queue->available);
+
+	pthread_join(queue->thread, NULL);
+
+	pthread_cond_destroy(&queue->submitted);
+	pthread_mutex_destroy(&queue->lock);
+	sem_destroy(&queue->available);
+	free(queue);
+}
+
+/* waits until the submission thread is done with a slot */
+static int host1x_recorder_wait(struct host1x_recorder *recorder,
+				struct host1x_recorder_slot *slot)
+{
+	struct host1x_queue *queue = recorder->queue;
+
+	if (atomic_load_explicit(&slot->pending, memory_order_acquire)) {
+		pthread_mutex_lock(&queue->lock);
+
+		while (atomic_load_explicit(&slot->pending,
+					    memory_order_acquire))
+			pthread_cond_wait(&queue->submitted, &queue->lock);
+
+		pthread_mutex_unlock(&queue->lock);
+	}
+
+	if (slot->error < 0) {
+		if (recorder->error == 0)
+			recorder->error = slot->error;
+
+		slot->error = 0;
+	}
+
+	return recorder->error;
+}
+
+/*
+ * A recorder cycles through depth slots, each with its own command ring and
+ * job, so that up to depth jobs can be waiting for submission while the next
+ * one is being recorded. The rings are size bytes large.
+ */
+struct host1x_recorder *host1x_recorder_create(struct host1x_queue *queue,
+					       struct host1x_client *client,
+					       unsigned int depth,
+					       size_t size)
+{
+	struct host1x_syncpt *syncpt = &client->syncpts[0];
+	struct host1x_recorder *recorder;
+	unsigned int i;
+
+	if (depth == 0)
+		return NULL;
+
+	recorder = calloc(1, sizeof(*recorder));
+	if (!recorder)
+		return NULL;
+
+	recorder->slots = calloc(depth, sizeof(*recorder->slots));
+	if (!recorder->slots) {
+		free(recorder);
+		return NULL;
+	}
+
+	recorder->queue = queue;
+	recorder->client = client;
+
+	for (i = 0; i < depth; i++) {
+		struct host1x_recorder_slot *slot = &recorder->slots[i];
+
+		slot->recorder = recorder;
+		atomic_init(&slot->pending, false);
+
+		slot->ring = host1x_ring_create(queue->host1x, 1, size);
+		if (!slot->ring) {
+			host1x_recorder_free(recorder);
+			return NULL;
+		}
+
+		recorder->num_slots++;
+
+		slot->job = host1x_job_create(syncpt->id);
+		if (!slot->job) {
+			host1x_recorder_free(recorder);
+			return NULL;
+		}
+	}
+
+	return recorder;
+}
+
+void host1x_recorder_free(struct host1x_recorder *recorder)
+{
+	unsigned int i;
+
+	if (!recorder)
+		return;
+
+	if (recorder->slot)
+		host1x_ring_fence(recorder->slot->ring, recorder->slot->job,
+				  NULL);
+
+	host1x_recorder_flush(recorder, NULL);
+
+	for (i = 0; i < recorder->num_slots; i++) {
+		host1x_job_free(recorder->slots[i].job);
+		host1x_ring_free(recorder->slots[i].ring);
+	}
+
+	free(recorder->slots);
+	free(recorder);
+}
+
+/*
+ * Returns the push buffer that the next job should be written to. This may
+ * block until the submission thread has caught up with the recorder. The job
+ * must be completed with host1x_recorder_end().
+ */
+struct host1x_pushbuf *host1x_recorder_begin(struct host1x_recorder *recorder)
+{
+	struct host1x_recorder_slot *slot;
+
+	if (recorder->slot)
+		return recorder->pb;
+
+	slot = &recorder->slots[recorder->current];
+
+	if (host1x_recorder_wait(recorder, slot) < 0)
+		return NULL;
+
+	host1x_job_reset(slot->job);
+
+	recorder->pb = host1x_job_append_ring(slot->job, slot->ring);
+	if (!recorder->pb)
+		return NULL;
+
+	recorder->slot = slot;
+
+	return recorder->pb;
+}
+
+/* hands the job over to the submission thread */
+int host1x_recorder_end(struct host1x_recorder *recorder)
+{
+	struct host1x_recorder_slot *slot = recorder->slot;
+	struct host1x_queue *queue = recorder->queue;
+
+	if (!slot)
+		return -EINVAL;
+
+	atomic_store_explicit(&slot->pending, true, memory_order_relaxed);
+	host1x_queue_push(queue, &slot->node);
+	sem_post(&queue->available);
+
+	recorder->current = (recorder->current + 1) % recorder->num_slots;
+	recorder->last = slot;
+	recorder->slot = NULL;
+	recorder->pb = NULL;
+
+	return 0;
+}
+
+/*
+ * Waits for all jobs of the recorder to be submitted. If a fence is passed
+ * it is set to track the completion of the last job, otherwise this waits
+ * for the jobs to complete. Submission errors are reported here and by
+ * host1x_recorder_begin().
+ */
+int host1x_recorder_flush(struct host1x_recorder *recorder,
+			  struct host1x_fence *fence)
+{
+	struct host1x_fence last;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < recorder->num_slots; i++)
+		host1x_recorder_wait(recorder, &recorder->slots[i]);
+
+	err = recorder->error;
+	recorder->error = 0;
+
+	if (err < 0)
+		return err;
+
+	if (recorder->last)
+		last = recorder->last->fence;
+	else
+		memset(&last, 0, sizeof(last));
+
+	if (fence) {
+		*fence = last;
+		return 0;
+	}
+
+	return host1x_fence_wait(&last, -1);
+}
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * A command ring hands out regions of a set of equally sized buffer objects
+ * in FIFO order. Regions are addressed by a virtual offset that increases
+ * monotonically; its value modulo the total size of the ring is the location
+ * within the buffer objects. Regions never straddle two buffer objects, the
+ * remainder of a buffer object is added to the region that would otherwise
+ * have crossed the boundary.
+ *
+ * Each region remains in use until the fence of the job that it was used by
+ * has signaled. Regions that belong to a job that hasn't been submitted yet
+ * cannot be reclaimed, so if the ring is exhausted by such regions, a buffer
+ * object is allocated outside of the ring and freed once it is retired.
+ *
+ * Several jobs can build their command streams in the same ring at once.
+ * Each region remembers the job that it was allocated for, and submitting
+ * or releasing a job only fences the regions of that job.
+ */
+#define HOST1X_RING_CHUNK_SIZE 4096
+
+struct host1x_ring_region {
+	unsigned long start;
+	unsigned long end;
+
+	/* only valid until the region is fenced */
+	struct host1x_job *job;
+	struct host1x_pushbuf *pb;
+
+	struct host1x_bo *bo;
+	unsigned long offset;
+	size_t size;
+	bool owned;
+
+	struct host1x_fence fence;
+	bool fenced;
+};
+
+struct host1x_ring {
+	struct host1x *host1x;
+
+	struct host1x_bo **bos;
+	unsigned int num_bos;
+	size_t size;
+
+	unsigned long head;
+	unsigned long tail;
+
+	struct host1x_ring_region *regions;
+	unsigned int first_region;
+	unsigned int num_regions;
+	unsigned int max_regions;
+	unsigned int num_unfenced;
+};
+
+static struct host1x_ring_region *host1x_ring_region(struct host1x_ring *ring,
+						     unsigned int index)
+{
+	index = (ring->first_region + index) % ring->max_regions;
+
+	return &ring->regions[index];
+}
+
+struct host1x_ring *host1x_ring_create(struct host1x *host1x,
+				       unsigned int num_bos, size_t size)
+{
+	struct host1x_ring *ring;
+	unsigned int i;
+	int err;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->bos = calloc(num_bos, sizeof(*ring->bos));
+	if (!ring->bos) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->host1x = host1x;
+	ring->size = size;
+
+	for (i = 0; i < num_bos; i++) {
+		ring->bos[i] = host1x_bo_create(host1x, size, 2);
+		if (!ring->bos[i]) {
+			host1x_ring_free(ring);
+			return NULL;
+		}
+
+		ring->num_bos++;
+
+		err = host1x_bo_mmap(ring->bos[i], NULL);
+		if (err < 0) {
+			host1x_ring_free(ring);
+			return NULL;
+		}
+	}
+
+	return ring;
+}
+
+/*
+ * Reclaim the oldest region, waiting for its job to complete if necessary.
+ */
+static int host1x_ring_retire(struct host1x_ring *ring)
+{
+	struct host1x_ring_region *region;
+	int err;
+
+	if (ring->num_regions == 0)
+		return -ENOSPC;
+
+	region = host1x_ring_region(ring, 0);
+
+	if (!region->fenced)
+		return -ENOSPC;
+
+	err = host1x_fence_wait(&region->fence, -1);
+	if (err < 0)
+		return err;
+
+	if (region->owned)
+		host1x_bo_free(region->bo);
+
+	ring->tail = region->end;
+	ring->first_region = (ring->first_region + 1) % ring->max_regions;
+	ring->num_regions--;
+
+	return 0;
+}
+
+void host1x_ring_free(struct host1x_ring *ring)
+{
+	unsigned int i;
+
+	if (!ring)
+		return;
+
+	/* jobs that are still open lose their regions */
+	for (i = 0; i < ring->num_regions; i++) {
+		struct host1x_ring_region *region = host1x_ring_region(ring, i);
+
+		if (!region->fenced) {
+			memset(&region->fence, 0, sizeof(region->fence));
+			region->fenced = true;
+		}
+	}
+
+	ring->num_unfenced = 0;
+
+	while (ring->num_regions > 0)
+		if (host1x_ring_retire(ring) < 0)
+			break;
+
+	for (i = 0; i < ring->num_bos; i++)
+		host1x_bo_free(ring->bos[i]);
+
+	free(ring->regions);
+	free(ring->bos);
+	free(ring);
+}
+
+static struct host1x_ring_region *host1x_ring_push(struct host1x_ring *ring)
+{
+	struct host1x_ring_region *regions;
+	unsigned int i, max;
+
+	if (ring->num_regions == ring->max_regions) {
+		max = ring->max_regions ? ring->max_regions * 2 : 16;
+
+		regions = malloc(max * sizeof(*regions));
+		if (!regions)
+			return NULL;
+
+		for (i = 0; i < ring->num_regions; i++)
+			regions[i] = *host1x_ring_region(ring, i);
+
+		free(ring->regions);
+		ring->regions = regions;
+		ring->max_regions = max;
+		ring->first_region = 0;
+	}
+
+	ring->num_regions++;
+	ring->num_unfenced++;
+
+	return host1x_ring_region(ring, ring->num_regions - 1);
+}
+
+static int host1x_ring_reserve(struct host1x_ring *ring,
+			      struct host1x_ring_region *region)
+{
+	unsigned long total = ring->num_bos * ring->size;
+	unsigned long position, pad = 0;
+	int err;
+
+	if (region->size > ring->size)
+		return -ENOSPC;
+
+	position = ring->head % ring->size;
+
+	if (position + region->size > ring->size)
+		pad = ring->size - position;
+
+	while (total - (ring->head - ring->tail) < pad + region->size) {
+		err = host1x_ring_retire(ring);
+		if (err < 0)
+			return err;
+	}
+
+	position = (ring->head + pad) % total;
+
+	region->start = ring->head;
+	region->end = ring->head + pad + region->size;
+	region->bo = ring->bos[position / ring->size];
+	region->offset = position % ring->size;
+
+	ring->head = region->end;
+
+	return 0;
+}
+
+static int host1x_ring_alloc_bo(struct host1x_ring *ring,
+				struct host1x_ring_region *region)
+{
+	int err;
+
+	region->bo = host1x_bo_create(ring->host1x, region->size, 2);
+	if (!region->bo)
+		return -ENOMEM;
+
+	err = host1x_bo_mmap(region->bo, NULL);
+	if (err < 0) {
+		host1x_bo_free(region->bo);
+		return err;
+	}
+
+	region->start = region->end = ring->head;
+	region->offset = 0;
+	region->owned = true;
+
+	return 0;
+}
+
+/*
+ * Allocate a region of at least the given size for a push buffer. The size
+ * is updated to the actual size of the region. The region is reserved until
+ * host1x_ring_fence() is called.
+ */
+int host1x_ring_alloc(struct host1x_ring *ring, struct host1x_pushbuf *pb,
+		      size_t *size, struct host1x_bo **bo,
+		      unsigned long *offset)
+{
+	struct host1x_ring_region *region;
+	int err;
+
+	region = host1x_ring_push(ring);
+	if (!region)
+		return -ENOMEM;
+
+	memset(region, 0, sizeof(*region));
+	region->size = HOST1X_RING_CHUNK_SIZE;
+
+	if (*size > region->size)
+		region->size = (*size + HOST1X_RING_CHUNK_SIZE - 1) &
+			       ~(HOST1X_RING_CHUNK_SIZE - 1);
+
+	region->job = pb->job;
+	region->pb = pb;
+
+	err = host1x_ring_reserve(ring, region);
+	if (err == -ENOSPC)
+		err = host1x_ring_alloc_bo(ring, region);
+
+	if (err < 0) {
+		ring->num_regions--;
+		ring->num_unfenced--;
+		return err;
+	}
+
+	*size = region->size;
+	*offset = region->offset;
+	*bo = region->bo;
+
+	return 0;
+}
+
+/*
+ * Associates the regions allocated for a job with the job's fence. Passing
+ * NULL releases the regions immediately, which is only safe if they haven't
+ * been submitted. Regions of other jobs that use the ring are left alone.
+ */
+void host1x_ring_fence(struct host1x_ring *ring, struct host1x_job *job,
+		       struct host1x_fence *fence)
+{
+	struct host1x_ring_region *region;
+	unsigned int i, others = 0;
+	struct host1x_pushbuf *pb;
+	unsigned long used;
+
+	for (i = ring->num_regions; i > 0 && others < ring->num_unfenced; i--) {
+		region = host1x_ring_region(ring, i - 1);
+
+		if (region->fenced)
+			continue;
+
+		if (region->job != job) {
+			others++;
+			continue;
+		}
+
+		/*
+		 * Give back the unused part of the region if it is the newest
+		 * one of the ring. The push buffer may have moved within the
+		 * region, see gathers.
+		 */
+		pb = region->pb;
+
+		if (i == ring->num_regions && !region->owned &&
+		    pb->bo == region->bo && pb->offset >= region->offset &&
+		    pb->offset < region->offset + region->size) {
+			used = (unsigned long)pb->ptr -
+			       (unsigned long)pb->bo->ptr - region->offset;
+			region->end -= region->size - used;
+			region->size = used;
+			ring->head = region->end;
+		}
+
+		if (fence)
+			region->fence = *fence;
+		else
+			memset(&region->fence, 0, sizeof(region->fence));
+
+		region->fenced = true;
+		region->job = NULL;
+		region->pb = NULL;
+		ring->num_unfenced--;
+	}
+}
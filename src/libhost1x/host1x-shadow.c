@@ -0,0 +1,523 @@
+/*
+ * Copyright (c) 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * A shadow remembers the values last written to the registers of a client,
+ * so that writes which wouldn't change anything can be left out of the
+ * command stream. Only registers without side-effects may be written through
+ * the shadow, and every write to them must go through the shadow. Writes
+ * that bypass it need to be announced with host1x_shadow_emit() or by
+ * invalidating the shadow.
+ *
+ * Memories are register pairs consisting of an index and a data port, such
+ * as the gr3d vertex program constants. They are shadowed in units of the
+ * given granularity, which is also the unit of the index register.
+ */
+struct host1x_shadow_memory {
+	uint32_t index;
+	uint32_t data;
+	unsigned int granularity;
+
+	uint32_t *values;
+	uint32_t *valid;
+	unsigned int size;
+};
+
+struct host1x_shadow {
+	uint32_t *values;
+	uint32_t *valid;
+	unsigned int num_regs;
+
+	struct host1x_shadow_memory *memories;
+	unsigned int num_memories;
+
+	unsigned long generation;
+	struct host1x_shadow_stats stats;
+};
+
+static inline bool test_bit(const uint32_t *bitmap, unsigned int bit)
+{
+	return bitmap[bit / 32] & (1u << (bit % 32));
+}
+
+static inline void set_bit(uint32_t *bitmap, unsigned int bit)
+{
+	bitmap[bit / 32] |= 1u << (bit % 32);
+}
+
+static inline void clear_bit(uint32_t *bitmap, unsigned int bit)
+{
+	bitmap[bit / 32] &= ~(1u << (bit % 32));
+}
+
+static inline size_t bitmap_size(unsigned int bits)
+{
+	return (bits + 31) / 32 * sizeof(uint32_t);
+}
+
+struct host1x_shadow *host1x_shadow_create(unsigned int num_regs)
+{
+	struct host1x_shadow *shadow;
+
+	shadow = calloc(1, sizeof(*shadow));
+	if (!shadow)
+		return NULL;
+
+	shadow->values = calloc(num_regs, sizeof(*shadow->values));
+	shadow->valid = calloc(1, bitmap_size(num_regs));
+
+	if (!shadow->values || !shadow->valid) {
+		host1x_shadow_free(shadow);
+		return NULL;
+	}
+
+	shadow->num_regs = num_regs;
+
+	return shadow;
+}
+
+void host1x_shadow_free(struct host1x_shadow *shadow)
+{
+	unsigned int i;
+
+	if (!shadow)
+		return;
+
+	for (i = 0; i < shadow->num_memories; i++) {
+		free(shadow->memories[i].values);
+		free(shadow->memories[i].valid);
+	}
+
+	free(shadow->memories);
+	free(shadow->values);
+	free(shadow->valid);
+	free(shadow);
+}
+
+int host1x_shadow_add_memory(struct host1x_shadow *shadow, uint32_t index,
+			     uint32_t data, unsigned int size,
+			     unsigned int granularity)
+{
+	struct host1x_shadow_memory *memory;
+
+	if (size % granularity != 0)
+		return -EINVAL;
+
+	memory = realloc(shadow->memories,
+			 (shadow->num_memories + 1) * sizeof(*memory));
+	if (!memory)
+		return -ENOMEM;
+
+	shadow->memories = memory;
+	memory += shadow->num_memories;
+
+	memset(memory, 0, sizeof(*memory));
+	memory->index = index;
+	memory->data = data;
+	memory->granularity = granularity;
+	memory->size = size;
+
+	memory->values = calloc(size, sizeof(*memory->values));
+	memory->valid = calloc(1, bitmap_size(size / granularity));
+
+	if (!memory->values || !memory->valid) {
+		free(memory->values);
+		free(memory->valid);
+		return -ENOMEM;
+	}
+
+	shadow->num_memories++;
+
+	return 0;
+}
+
+/*
+ * Forgets all register values, for example because the engine was reset or
+ * a job failed. The generation changes, which allows users to detect that
+ * state they keep track of themselves needs to be emitted again.
+ */
+void host1x_shadow_invalidate(struct host1x_shadow *shadow)
+{
+	unsigned int i;
+
+	if (!shadow)
+		return;
+
+	memset(shadow->valid, 0, bitmap_size(shadow->num_regs));
+
+	for (i = 0; i < shadow->num_memories; i++) {
+		struct host1x_shadow_memory *memory = &shadow->memories[i];
+		unsigned int units = memory->size / memory->granularity;
+
+		memset(memory->valid, 0, bitmap_size(units));
+	}
+
+	shadow->generation++;
+}
+
+unsigned long host1x_shadow_get_generation(struct host1x_shadow *shadow)
+{
+	return shadow->generation;
+}
+
+void host1x_shadow_get_stats(struct host1x_shadow *shadow,
+			     struct host1x_shadow_stats *stats)
+{
+	*stats = shadow->stats;
+}
+
+static bool host1x_shadow_changed(struct host1x_shadow *shadow,
+				  uint32_t offset, uint32_t value)
+{
+	if (offset >= shadow->num_regs)
+		return true;
+
+	return !test_bit(shadow->valid, offset) ||
+	       shadow->values[offset] != value;
+}
+
+static void host1x_shadow_store(struct host1x_shadow *shadow, uint32_t offset,
+				uint32_t value)
+{
+	if (offset < shadow->num_regs) {
+		shadow->values[offset] = value;
+		set_bit(shadow->valid, offset);
+	}
+}
+
+static void host1x_shadow_forget(struct host1x_shadow *shadow, uint32_t offset)
+{
+	if (offset < shadow->num_regs)
+		clear_bit(shadow->valid, offset);
+}
+
+/* writes count consecutive registers, all of which are emitted */
+static int host1x_shadow_emit_incr(struct host1x_shadow *shadow,
+				   struct host1x_pushbuf *pb, uint32_t offset,
+				   const uint32_t *values, unsigned int count)
+{
+	unsigned int i;
+	int err;
+
+	if (count == 1 && values[0] <= 0xffff) {
+		err = host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(offset,
+								values[0]));
+		if (err < 0)
+			return err;
+
+		shadow->stats.written++;
+	} else {
+		err = host1x_pushbuf_prepare(pb, 1 + count);
+		if (err < 0)
+			return err;
+
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(offset, count));
+		host1x_pushbuf_push_array(pb, values, count);
+
+		shadow->stats.written += 1 + count;
+	}
+
+	for (i = 0; i < count; i++)
+		host1x_shadow_store(shadow, offset + i, values[i]);
+
+	return 0;
+}
+
+int host1x_shadow_write(struct host1x_shadow *shadow,
+			struct host1x_pushbuf *pb, uint32_t offset,
+			uint32_t value)
+{
+	return host1x_shadow_write_incr(shadow, pb, offset, &value, 1);
+}
+
+/*
+ * Writes a block of consecutive registers, leaving out those that already
+ * hold the given values. Runs of changed registers that are only separated
+ * by a single unchanged one are merged, since the extra opcode would cost as
+ * much as rewriting the register.
+ */
+int host1x_shadow_write_incr(struct host1x_shadow *shadow,
+			     struct host1x_pushbuf *pb, uint32_t offset,
+			     const uint32_t *values, unsigned int count)
+{
+	unsigned int i = 0, start, end;
+	int err;
+
+	while (i < count) {
+		if (!host1x_shadow_changed(shadow, offset + i, values[i])) {
+			shadow->stats.elided++;
+			i++;
+			continue;
+		}
+
+		start = end = i++;
+
+		while (i < count) {
+			if (host1x_shadow_changed(shadow, offset + i,
+						  values[i])) {
+				end = i++;
+				continue;
+			}
+
+			if (i + 1 < count &&
+			    host1x_shadow_changed(shadow, offset + i + 1,
+						  values[i + 1])) {
+				i++;
+				continue;
+			}
+
+			break;
+		}
+
+		err = host1x_shadow_emit_incr(shadow, pb, offset + start,
+					      values + start,
+					      end - start + 1);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Like host1x_shadow_write_incr(), but writes the registers selected by the
+ * mask, relative to the offset, with values in the order of the mask bits.
+ */
+int host1x_shadow_write_mask(struct host1x_shadow *shadow,
+			     struct host1x_pushbuf *pb, uint32_t offset,
+			     uint16_t mask, const uint32_t *values)
+{
+	unsigned int i, j = 0;
+	int err;
+
+	for (i = 0; i < 16; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+
+		err = host1x_shadow_write(shadow, pb, offset + i, values[j++]);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static struct host1x_shadow_memory *
+host1x_shadow_find_memory(struct host1x_shadow *shadow, uint32_t data)
+{
+	unsigned int i;
+
+	for (i = 0; i < shadow->num_memories; i++)
+		if (shadow->memories[i].data == data)
+			return &shadow->memories[i];
+
+	return NULL;
+}
+
+static bool host1x_shadow_memory_changed(struct host1x_shadow_memory *memory,
+					 unsigned int unit,
+					 const uint32_t *values)
+{
+	unsigned int granularity = memory->granularity;
+
+	if (!test_bit(memory->valid, unit))
+		return true;
+
+	return memcmp(memory->values + unit * granularity, values,
+		      granularity * sizeof(*values)) != 0;
+}
+
+/*
+ * Uploads words to the memory that is written through the data register.
+ * Only runs of units that differ from the previous upload are emitted, each
+ * preceded by a write to the index register. start and count are in words
+ * and must be multiples of the granularity of the memory.
+ */
+int host1x_shadow_upload(struct host1x_shadow *shadow,
+			 struct host1x_pushbuf *pb, uint32_t data,
+			 unsigned int start, const uint32_t *values,
+			 unsigned int count)
+{
+	struct host1x_shadow_memory *memory;
+	unsigned int granularity, first, last, unit, end, words;
+	int err;
+
+	memory = host1x_shadow_find_memory(shadow, data);
+	if (!memory)
+		return -EINVAL;
+
+	granularity = memory->granularity;
+
+	if (start % granularity || count % granularity ||
+	    start + count > memory->size)
+		return -EINVAL;
+
+	first = start / granularity;
+	last = (start + count) / granularity;
+	unit = first;
+
+	while (unit < last) {
+		const uint32_t *ptr = values + (unit - first) * granularity;
+
+		if (!host1x_shadow_memory_changed(memory, unit, ptr)) {
+			shadow->stats.elided += granularity;
+			unit++;
+			continue;
+		}
+
+		for (end = unit + 1; end < last; end++)
+			if (!host1x_shadow_memory_changed(memory, end,
+					values + (end - first) * granularity))
+				break;
+
+		words = (end - unit) * granularity;
+
+		err = host1x_pushbuf_prepare(pb, 3 + words);
+		if (err < 0)
+			return err;
+
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(memory->index, 1));
+		host1x_pushbuf_push(pb, unit);
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(data, words));
+		host1x_pushbuf_push_array(pb, ptr, words);
+
+		memcpy(memory->values + unit * granularity, ptr,
+		       words * sizeof(*ptr));
+
+		for (; unit < end; unit++)
+			set_bit(memory->valid, unit);
+
+		shadow->stats.written += 3 + words;
+	}
+
+	/* the index register advances with every write to the data port */
+	host1x_shadow_forget(shadow, memory->index);
+
+	return 0;
+}
+
+/* forgets the values of all registers written by a command stream */
+static void host1x_shadow_forget_stream(struct host1x_shadow *shadow,
+					const uint32_t *words,
+					unsigned long count)
+{
+	unsigned long i = 0;
+	unsigned int j;
+	uint32_t offset;
+
+	while (i < count) {
+		uint32_t word = words[i++];
+
+		offset = (word >> 16) & 0xfff;
+
+		switch (word >> 28) {
+		case 0x1: /* INCR */
+			for (j = 0; j < (word & 0xffff); j++)
+				host1x_shadow_forget(shadow, offset + j);
+
+			i += word & 0xffff;
+			break;
+
+		case 0x2: /* NONINCR */
+			host1x_shadow_forget(shadow, offset);
+			i += word & 0xffff;
+			break;
+
+		case 0x3: /* MASK */
+			for (j = 0; j < 16; j++) {
+				if (word & (1 << j)) {
+					host1x_shadow_forget(shadow, offset + j);
+					i++;
+				}
+			}
+
+			break;
+
+		case 0x4: /* IMM */
+			host1x_shadow_forget(shadow, offset);
+			break;
+
+		default:
+			host1x_shadow_invalidate(shadow);
+			return;
+		}
+	}
+}
+
+/*
+ * Pushes a command stream that was built elsewhere, such as a compiled
+ * shader, and forgets the values of all registers that it writes. Streams
+ * that switch classes or jump elsewhere invalidate the whole shadow.
+ */
+int host1x_shadow_emit(struct host1x_shadow *shadow,
+		       struct host1x_pushbuf *pb, const uint32_t *words,
+		       unsigned int count)
+{
+	int err;
+
+	err = host1x_pushbuf_push_array(pb, words, count);
+	if (err < 0)
+		return err;
+
+	host1x_shadow_forget_stream(shadow, words, count);
+
+	return 0;
+}
+
+/* like host1x_shadow_emit(), but references the words of a fragment */
+int host1x_shadow_gather(struct host1x_shadow *shadow,
+			 struct host1x_pushbuf *pb,
+			 struct host1x_fragment *fragment)
+{
+	struct host1x_job *job = fragment->job;
+	unsigned int i;
+	int err;
+
+	err = host1x_pushbuf_gather(pb, fragment);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		struct host1x_pushbuf *source = job->pushbufs[i];
+
+		host1x_shadow_forget_stream(shadow,
+					    source->bo->ptr + source->offset,
+					    source->length);
+	}
+
+	return 0;
+}
+
+struct host1x_shadow *host1x_client_get_shadow(struct host1x_client *client)
+{
+	return client->shadow;
+}
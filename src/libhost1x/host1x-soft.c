@@ -0,0 +1,943 @@
+/*
+ * Copyright (c) 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * A host1x implementation that runs entirely on the CPU. Jobs are executed
+ * synchronously at submission time: the command streams are decoded into a
+ * register file per channel and syncpoints advance as the streams write to
+ * the syncpoint increment register. gr2d fills and copies are emulated in
+ * software, other engines only track their register state. This allows the
+ * CPU side of libhost1x and libgrate to be run and profiled on any machine.
+ */
+#define SOFT_NUM_SYNCPTS 32
+#define SOFT_NUM_REGS 0x1000
+#define SOFT_IOVA_BASE 0x40000000
+#define SOFT_PAGE_SIZE 4096
+
+/* interval at which waits poll the syncpoints, in microseconds */
+#define SOFT_WAIT_STEP 100
+
+/* host1x class registers */
+#define HOST1X_WAIT_SYNCPT 0x008
+
+/* gr2d registers */
+#define GR2D_TRIGGER 0x009
+#define GR2D_CONTROLMAIN 0x01f
+#define GR2D_DSTBA 0x02b
+#define GR2D_DSTST 0x02e
+#define GR2D_SRCBA 0x031
+#define GR2D_SRCST 0x033
+#define GR2D_SRCFGC 0x035
+#define GR2D_DSTSIZE 0x038
+#define GR2D_SRCPS 0x039
+#define GR2D_DSTPS 0x03a
+#define GR2D_TILEMODE 0x046
+
+struct soft;
+
+struct soft_bo {
+	struct host1x_bo base;
+	struct soft *soft;
+	uint32_t iova;
+
+	struct soft_bo *prev;
+	struct soft_bo *next;
+};
+
+static inline struct soft_bo *to_soft_bo(struct host1x_bo *bo)
+{
+	return container_of(bo, struct soft_bo, base);
+}
+
+enum soft_mode {
+	SOFT_MODE_IDLE,
+	SOFT_MODE_MASK,
+	SOFT_MODE_INCR,
+	SOFT_MODE_NONINCR,
+	SOFT_MODE_GATHER,
+};
+
+struct soft_channel {
+	struct host1x_client client;
+	struct host1x_syncpt syncpt;
+	struct soft *soft;
+	uint32_t engine;
+	uint32_t fence;
+
+	/* command stream decoder */
+	enum soft_mode mode;
+	uint32_t class;
+	uint32_t offset;
+	uint32_t mask;
+	uint32_t count;
+	uint32_t gather;
+
+	uint32_t regs[SOFT_NUM_REGS];
+};
+
+static inline struct soft_channel *to_soft_channel(struct host1x_client *client)
+{
+	return container_of(client, struct soft_channel, client);
+}
+
+struct soft_gr2d {
+	struct soft_channel channel;
+	struct host1x_gr2d base;
+};
+
+struct soft_gr3d {
+	struct soft_channel channel;
+	struct host1x_gr3d base;
+};
+
+struct soft {
+	struct host1x base;
+
+	/* buffer objects may be created and freed on any thread */
+	pthread_mutex_t lock;
+	struct soft_bo *bos;
+	uint32_t iova;
+	uint32_t handle;
+
+	/*
+	 * Current and expected final value of each syncpoint. The current
+	 * values are polled by fences on other threads.
+	 */
+	_Atomic uint32_t syncpts[SOFT_NUM_SYNCPTS];
+	uint32_t syncpts_max[SOFT_NUM_SYNCPTS];
+
+	struct soft_gr2d *gr2d;
+	struct soft_gr3d *gr3d;
+	struct soft_display *display;
+};
+
+static inline struct soft *to_soft(struct host1x *host1x)
+{
+	return container_of(host1x, struct soft, base);
+}
+
+static int soft_bo_mmap(struct host1x_bo *bo)
+{
+	return 0;
+}
+
+static void soft_bo_free(struct host1x_bo *bo)
+{
+	struct soft_bo *sbo = to_soft_bo(bo);
+	struct soft *soft = sbo->soft;
+
+	pthread_mutex_lock(&soft->lock);
+
+	if (sbo->prev)
+		sbo->prev->next = sbo->next;
+	else
+		soft->bos = sbo->next;
+
+	if (sbo->next)
+		sbo->next->prev = sbo->prev;
+
+	pthread_mutex_unlock(&soft->lock);
+
+	free(bo->ptr);
+	free(sbo);
+}
+
+static struct host1x_bo *soft_bo_create(struct host1x *host1x, size_t size,
+					unsigned long flags)
+{
+	struct soft *soft = to_soft(host1x);
+	size_t aligned = (size + SOFT_PAGE_SIZE - 1) & ~(SOFT_PAGE_SIZE - 1);
+	struct soft_bo *bo;
+	int err;
+
+	bo = calloc(1, sizeof(*bo));
+	if (!bo)
+		return NULL;
+
+	err = posix_memalign(&bo->base.ptr, SOFT_PAGE_SIZE, aligned);
+	if (err != 0) {
+		free(bo);
+		return NULL;
+	}
+
+	memset(bo->base.ptr, 0, aligned);
+
+	bo->soft = soft;
+	bo->base.size = size;
+	bo->base.mmap = soft_bo_mmap;
+	bo->base.free = soft_bo_free;
+
+	pthread_mutex_lock(&soft->lock);
+
+	/* I/O virtual addresses are never reused */
+	if (aligned > UINT32_MAX - soft->iova) {
+		pthread_mutex_unlock(&soft->lock);
+		free(bo->base.ptr);
+		free(bo);
+		return NULL;
+	}
+
+	bo->iova = soft->iova;
+	soft->iova += aligned;
+
+	bo->base.handle = ++soft->handle;
+
+	bo->next = soft->bos;
+	if (soft->bos)
+		soft->bos->prev = bo;
+
+	soft->bos = bo;
+
+	pthread_mutex_unlock(&soft->lock);
+
+	return &bo->base;
+}
+
+/*
+ * Translates an I/O virtual address into a CPU pointer, provided that the
+ * given number of bytes following it are backed by the same buffer object.
+ */
+static void *soft_iova_to_ptr(struct soft *soft, uint32_t iova, size_t size)
+{
+	struct soft_bo *bo;
+	void *ptr = NULL;
+
+	pthread_mutex_lock(&soft->lock);
+
+	for (bo = soft->bos; bo; bo = bo->next) {
+		if (iova < bo->iova || iova - bo->iova >= bo->base.size)
+			continue;
+
+		if (size <= bo->base.size - (iova - bo->iova))
+			ptr = bo->base.ptr + (iova - bo->iova);
+
+		break;
+	}
+
+	pthread_mutex_unlock(&soft->lock);
+
+	return ptr;
+}
+
+static void *soft_gr2d_pixel(void *base, uint32_t pitch, bool tiled,
+			     unsigned int x, unsigned int y)
+{
+	unsigned int tile;
+
+	if (!tiled)
+		return base + y * pitch + x;
+
+	/* tiles are 16 bytes wide and 16 rows high */
+	tile = (y / 16) * (pitch / 16) + x / 16;
+
+	return base + tile * 256 + (y % 16) * 16 + x % 16;
+}
+
+static size_t soft_gr2d_extent(uint32_t pitch, bool tiled, unsigned int x,
+			       unsigned int y, unsigned int width,
+			       unsigned int height)
+{
+	if (tiled)
+		return pitch * ((y + height + 15) & ~15);
+
+	return (y + height - 1) * pitch + x + width;
+}
+
+static int soft_gr2d_execute(struct soft_channel *channel)
+{
+	const uint32_t *regs = channel->regs;
+	uint32_t control = regs[GR2D_CONTROLMAIN];
+	unsigned int cpp = 1 << ((control >> 16) & 0x3);
+	unsigned int width = regs[GR2D_DSTSIZE] & 0xffff;
+	unsigned int height = regs[GR2D_DSTSIZE] >> 16;
+	unsigned int dx = (regs[GR2D_DSTPS] & 0xffff) * cpp;
+	unsigned int dy = regs[GR2D_DSTPS] >> 16;
+	unsigned int sx = (regs[GR2D_SRCPS] & 0xffff) * cpp;
+	unsigned int sy = regs[GR2D_SRCPS] >> 16;
+	bool dst_tiled = regs[GR2D_TILEMODE] & (1 << 20);
+	bool src_tiled = regs[GR2D_TILEMODE] & (1 << 0);
+	uint32_t color = regs[GR2D_SRCFGC];
+	void *dst, *src = NULL;
+	unsigned int x, y;
+	size_t size;
+
+	if (width == 0 || height == 0)
+		return 0;
+
+	size = soft_gr2d_extent(regs[GR2D_DSTST], dst_tiled, dx, dy,
+				width * cpp, height);
+
+	dst = soft_iova_to_ptr(channel->soft, regs[GR2D_DSTBA], size);
+	if (!dst) {
+		fprintf(stderr, "gr2d: invalid destination %08x\n",
+			regs[GR2D_DSTBA]);
+		return -EFAULT;
+	}
+
+	/* [6:6] solid source, fill with the foreground color */
+	if ((control & (1 << 6)) == 0) {
+		size = soft_gr2d_extent(regs[GR2D_SRCST], src_tiled, sx, sy,
+					width * cpp, height);
+
+		src = soft_iova_to_ptr(channel->soft, regs[GR2D_SRCBA], size);
+		if (!src) {
+			fprintf(stderr, "gr2d: invalid source %08x\n",
+				regs[GR2D_SRCBA]);
+			return -EFAULT;
+		}
+	}
+
+	/* XXX: overlapping copies are not handled like the hardware does */
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width * cpp; x += cpp) {
+			void *d = soft_gr2d_pixel(dst, regs[GR2D_DSTST],
+						  dst_tiled, dx + x, dy + y);
+
+			if (src) {
+				void *s = soft_gr2d_pixel(src, regs[GR2D_SRCST],
+							  src_tiled, sx + x,
+							  sy + y);
+				memcpy(d, s, cpp);
+			} else {
+				memcpy(d, &color, cpp);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int soft_channel_write(struct soft_channel *channel, uint32_t class,
+			      uint32_t offset, uint32_t value)
+{
+	struct soft *soft = channel->soft;
+	uint32_t id;
+
+	offset &= SOFT_NUM_REGS - 1;
+
+	/* the syncpoint increment register is at the same offset everywhere */
+	if (offset == 0) {
+		id = value & 0xff;
+
+		if (id >= SOFT_NUM_SYNCPTS) {
+			fprintf(stderr, "invalid syncpoint %u\n", id);
+			return -EINVAL;
+		}
+
+		soft->syncpts[id]++;
+		return 0;
+	}
+
+	if (class == HOST1X_CLASS_HOST1X) {
+		if (offset == HOST1X_WAIT_SYNCPT) {
+			uint32_t threshold = value & 0xffffff;
+			int32_t distance;
+
+			id = value >> 24;
+
+			if (id >= SOFT_NUM_SYNCPTS) {
+				fprintf(stderr, "invalid syncpoint %u\n", id);
+				return -EINVAL;
+			}
+
+			/* thresholds only have 24 bits */
+			distance = (soft->syncpts[id] - threshold) << 8;
+
+			/*
+			 * Jobs run to completion one after another, so a
+			 * wait that isn't satisfied yet never will be.
+			 */
+			if (distance < 0) {
+				fprintf(stderr, "wait for syncpoint %u > %u "
+					"never completes\n", id, threshold);
+				return -EDEADLK;
+			}
+		}
+
+		return 0;
+	}
+
+	channel->regs[offset] = value;
+
+	if ((class == HOST1X_CLASS_GR2D || class == HOST1X_CLASS_GR2D_SB) &&
+	    offset == (channel->regs[GR2D_TRIGGER] & 0xfff))
+		return soft_gr2d_execute(channel);
+
+	return 0;
+}
+
+static int soft_channel_execute(struct soft_channel *channel,
+				const uint32_t *words, unsigned long count,
+				bool gather);
+
+/* handles a payload word of the pending opcode */
+static int soft_channel_data(struct soft_channel *channel, uint32_t word,
+			     bool gather)
+{
+	const uint32_t *data;
+	unsigned int i;
+	int err = 0;
+
+	switch (channel->mode) {
+	case SOFT_MODE_MASK:
+		i = ffs(channel->mask) - 1;
+		channel->mask &= channel->mask - 1;
+
+		if (channel->mask == 0)
+			channel->mode = SOFT_MODE_IDLE;
+
+		return soft_channel_write(channel, channel->class,
+					  channel->offset + i, word);
+
+	case SOFT_MODE_INCR:
+	case SOFT_MODE_NONINCR:
+		if (--channel->count == 0)
+			channel->mode = SOFT_MODE_IDLE;
+
+		err = soft_channel_write(channel, channel->class,
+					 channel->offset, word);
+
+		if (channel->mode == SOFT_MODE_INCR)
+			channel->offset++;
+
+		return err;
+
+	case SOFT_MODE_GATHER:
+		channel->mode = SOFT_MODE_IDLE;
+
+		/* the hardware can't gather from within a gather */
+		if (gather)
+			return -EINVAL;
+
+		data = soft_iova_to_ptr(channel->soft, word,
+					channel->count * sizeof(uint32_t));
+		if (!data)
+			return -EFAULT;
+
+		/* [15:15] insert, [14:14] incrementing */
+		if (channel->gather & (1 << 15)) {
+			for (i = 0; i < channel->count && err == 0; i++) {
+				uint32_t offset = channel->offset;
+
+				if (channel->gather & (1 << 14))
+					offset += i;
+
+				err = soft_channel_write(channel, channel->class,
+							 offset, data[i]);
+			}
+
+			return err;
+		}
+
+		return soft_channel_execute(channel, data, channel->count,
+					    true);
+
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * Like the kernel's firewall, this expects every opcode to be complete within
+ * a command buffer, so the decoder must be idle again once all of the words
+ * have been executed.
+ */
+static int soft_channel_execute(struct soft_channel *channel,
+				const uint32_t *words, unsigned long count,
+				bool gather)
+{
+	unsigned long i;
+	int err = 0;
+
+	for (i = 0; i < count && err == 0; i++) {
+		uint32_t word = words[i];
+
+		if (channel->mode != SOFT_MODE_IDLE) {
+			err = soft_channel_data(channel, word, gather);
+			continue;
+		}
+
+		channel->offset = (word >> 16) & 0xfff;
+
+		switch (word >> 28) {
+		case 0x0: /* SETCL */
+			channel->class = (word >> 6) & 0x3ff;
+			channel->mask = word & 0x3f;
+			channel->mode = SOFT_MODE_MASK;
+			break;
+
+		case 0x1: /* INCR */
+			channel->count = word & 0xffff;
+			channel->mode = SOFT_MODE_INCR;
+			break;
+
+		case 0x2: /* NONINCR */
+			channel->count = word & 0xffff;
+			channel->mode = SOFT_MODE_NONINCR;
+			break;
+
+		case 0x3: /* MASK */
+			channel->mask = word & 0xffff;
+			channel->mode = SOFT_MODE_MASK;
+			break;
+
+		case 0x4: /* IMM */
+			err = soft_channel_write(channel, channel->class,
+						 channel->offset,
+						 word & 0xffff);
+			break;
+
+		case 0x5: /* RESTART */
+		case 0xe: /* EXTEND */
+			break;
+
+		case 0x6: /* GATHER */
+			channel->count = word & 0x3fff;
+			channel->gather = word;
+			channel->mode = SOFT_MODE_GATHER;
+			break;
+
+		default:
+			fprintf(stderr, "unsupported opcode: %08x\n", word);
+			return -EINVAL;
+		}
+
+		/* opcodes without payload */
+		if ((channel->mode == SOFT_MODE_MASK && channel->mask == 0) ||
+		    (channel->mode != SOFT_MODE_MASK && channel->count == 0))
+			channel->mode = SOFT_MODE_IDLE;
+	}
+
+	if (err == 0 && channel->mode != SOFT_MODE_IDLE) {
+		fprintf(stderr, "opcode continues past the end of the buffer\n");
+		return -EINVAL;
+	}
+
+	return err;
+}
+
+static int soft_channel_submit(struct host1x_client *client,
+			       struct host1x_job *job)
+{
+	struct soft_channel *channel = to_soft_channel(client);
+	struct soft *soft = channel->soft;
+	unsigned int i, j;
+	int err;
+
+	if (job->syncpt >= SOFT_NUM_SYNCPTS)
+		return -EINVAL;
+
+	soft->syncpts_max[job->syncpt] += job->syncpt_incrs;
+	channel->fence = soft->syncpts_max[job->syncpt];
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		struct host1x_pushbuf *pb = job->pushbufs[i];
+
+		/* patch the relocations in place, like the kernel does */
+		for (j = 0; j < pb->num_relocs; j++) {
+			struct host1x_pushbuf_reloc *reloc = &pb->relocs[j];
+			uint32_t *word = pb->bo->ptr + reloc->source_offset;
+			struct soft_bo *target = to_soft_bo(reloc->target);
+
+			*word = (target->iova + reloc->target_offset) >>
+				reloc->shift;
+		}
+	}
+
+	/* every job starts out in the class of its channel */
+	channel->class = channel->engine;
+	channel->mode = SOFT_MODE_IDLE;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		struct host1x_pushbuf *pb = job->pushbufs[i];
+
+		err = soft_channel_execute(channel, pb->bo->ptr + pb->offset,
+					   pb->length, false);
+		if (err < 0) {
+			fprintf(stderr, "command buffer %u/%u failed: %d\n",
+				i + 1, job->num_pushbufs, err);
+
+			/* complete the job, like the kernel does on timeout */
+			soft->syncpts[job->syncpt] = channel->fence;
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int soft_channel_flush(struct host1x_client *client, uint32_t *fence)
+{
+	struct soft_channel *channel = to_soft_channel(client);
+
+	*fence = channel->fence;
+
+	return 0;
+}
+
+static int soft_channel_read_syncpt(struct host1x_client *client,
+				    uint32_t syncpt, uint32_t *value)
+{
+	struct soft_channel *channel = to_soft_channel(client);
+
+	if (syncpt >= SOFT_NUM_SYNCPTS)
+		return -EINVAL;
+
+	*value = channel->soft->syncpts[syncpt];
+
+	return 0;
+}
+
+/*
+ * Jobs complete during submission, so a pending fence can only be signaled
+ * by a submission on another thread. Sleep in small steps until that happens
+ * or the timeout expires.
+ */
+static int soft_channel_wait(struct host1x_client *client, uint32_t syncpt,
+			     uint32_t fence, uint32_t timeout)
+{
+	struct soft_channel *channel = to_soft_channel(client);
+	struct timespec step = { 0, SOFT_WAIT_STEP * 1000 };
+	unsigned long elapsed = 0;
+	uint32_t value;
+
+	if (syncpt >= SOFT_NUM_SYNCPTS)
+		return -EINVAL;
+
+	while (true) {
+		value = channel->soft->syncpts[syncpt];
+
+		if (host1x_syncpt_passed(value, fence))
+			return 0;
+
+		if (timeout != ~0u && elapsed >= timeout * 1000ul)
+			return -EAGAIN;
+
+		nanosleep(&step, NULL);
+		elapsed += SOFT_WAIT_STEP;
+	}
+}
+
+static void soft_channel_init(struct soft *soft, struct soft_channel *channel,
+			      uint32_t class, uint32_t syncpt)
+{
+	channel->soft = soft;
+	channel->engine = class;
+	channel->class = class;
+
+	channel->syncpt.id = syncpt;
+	atomic_init(&channel->syncpt.value, 0);
+
+	channel->client.syncpts = &channel->syncpt;
+	channel->client.num_syncpts = 1;
+	channel->client.class = class;
+	channel->client.submit = soft_channel_submit;
+	channel->client.flush = soft_channel_flush;
+	channel->client.wait = soft_channel_wait;
+	channel->client.read_syncpt = soft_channel_read_syncpt;
+}
+
+static int soft_gr2d_create(struct soft_gr2d **gr2dp, struct soft *soft)
+{
+	struct soft_gr2d *gr2d;
+	int err;
+
+	gr2d = calloc(1, sizeof(*gr2d));
+	if (!gr2d)
+		return -ENOMEM;
+
+	soft_channel_init(soft, &gr2d->channel, HOST1X_CLASS_GR2D, 1);
+	gr2d->base.client = &gr2d->channel.client;
+
+	err = host1x_gr2d_init(&soft->base, &gr2d->base);
+	if (err < 0) {
+		free(gr2d);
+		return err;
+	}
+
+	*gr2dp = gr2d;
+
+	return 0;
+}
+
+static void soft_gr2d_close(struct soft_gr2d *gr2d)
+{
+	if (gr2d)
+		host1x_gr2d_exit(&gr2d->base);
+
+	free(gr2d);
+}
+
+static int soft_gr3d_create(struct soft_gr3d **gr3dp, struct soft *soft)
+{
+	struct soft_gr3d *gr3d;
+	int err;
+
+	gr3d = calloc(1, sizeof(*gr3d));
+	if (!gr3d)
+		return -ENOMEM;
+
+	soft_channel_init(soft, &gr3d->channel, HOST1X_CLASS_GR3D, 2);
+	gr3d->base.client = &gr3d->channel.client;
+
+	err = host1x_gr3d_init(&soft->base, &gr3d->base);
+	if (err < 0) {
+		free(gr3d);
+		return err;
+	}
+
+	*gr3dp = gr3d;
+
+	return 0;
+}
+
+static void soft_gr3d_close(struct soft_gr3d *gr3d)
+{
+	if (gr3d)
+		host1x_gr3d_exit(&gr3d->base);
+
+	free(gr3d);
+}
+
+/*
+ * An optional display without any output, which is only there to pace
+ * flips. Its vertical blanks are generated by a periodic timer that runs at
+ * the refresh rate given in the HOST1X_SOFT_DISPLAY environment variable.
+ */
+struct soft_display {
+	struct host1x_display base;
+	unsigned int sequence;
+
+	/* vertical blank n happens at start + n * period nanoseconds */
+	uint64_t start;
+	uint64_t period;
+	/* the last vertical blank before the pending flip was queued */
+	unsigned int queued;
+};
+
+static inline struct soft_display *
+to_soft_display(struct host1x_display *display)
+{
+	return container_of(display, struct soft_display, base);
+}
+
+static int soft_display_create_overlay(struct host1x_display *display,
+				       struct host1x_overlay **overlayp)
+{
+	return -EOPNOTSUPP;
+}
+
+static int soft_display_flip(struct host1x_display *display,
+			     struct host1x_framebuffer *fb)
+{
+	struct soft_display *soft = to_soft_display(display);
+	uint64_t count;
+	int err;
+
+	err = host1x_framebuffer_wait_fence(fb);
+	if (err < 0)
+		return err;
+
+	/* blanks that have already passed don't complete the flip */
+	if (read(display->fd, &count, sizeof(count)) == sizeof(count))
+		soft->sequence += count;
+
+	soft->queued = soft->sequence;
+
+	return 0;
+}
+
+static int soft_display_handle_events(struct host1x_display *display)
+{
+	struct soft_display *soft = to_soft_display(display);
+	unsigned int sequence;
+	uint64_t count, time;
+	ssize_t err;
+
+	err = read(display->fd, &count, sizeof(count));
+	if (err < 0)
+		return errno == EAGAIN ? 0 : -errno;
+
+	soft->sequence += count;
+
+	/* the flip completed at the first blank after it was queued */
+	if (display->pending) {
+		sequence = soft->queued + 1;
+		time = (soft->start + sequence * soft->period) / 1000;
+
+		host1x_display_flip_done(display, sequence, time / 1000000,
+					 time % 1000000);
+	}
+
+	return 0;
+}
+
+static int soft_display_set(struct host1x_display *display,
+			    struct host1x_framebuffer *fb, bool vsync)
+{
+	int err;
+
+	if (!vsync)
+		return host1x_framebuffer_wait_fence(fb);
+
+	err = host1x_display_flip(display, fb);
+	if (err < 0)
+		return err;
+
+	return host1x_display_wait_flip(display, 1000, NULL);
+}
+
+static int soft_display_create(struct soft_display **displayp,
+			       unsigned int rate)
+{
+	struct itimerspec period;
+	struct soft_display *display;
+
+	if (rate == 0)
+		return -EINVAL;
+
+	display = calloc(1, sizeof(*display));
+	if (!display)
+		return -ENOMEM;
+
+	display->base.fd = timerfd_create(CLOCK_MONOTONIC,
+					  TFD_NONBLOCK | TFD_CLOEXEC);
+	if (display->base.fd < 0) {
+		free(display);
+		return -errno;
+	}
+
+	memset(&period, 0, sizeof(period));
+	period.it_interval.tv_sec = 1 / rate;
+	period.it_interval.tv_nsec = rate > 1 ? 1000000000 / rate : 0;
+	period.it_value = period.it_interval;
+
+	if (timerfd_settime(display->base.fd, 0, &period, NULL) < 0) {
+		close(display->base.fd);
+		free(display);
+		return -errno;
+	}
+
+	/* XXX: off by the time it took to arm the timer */
+	display->start = host1x_get_time() * 1000;
+	display->period = 1000000000ull / rate;
+
+	display->base.width = 640;
+	display->base.height = 480;
+	display->base.create_overlay = soft_display_create_overlay;
+	display->base.set = soft_display_set;
+	display->base.flip = soft_display_flip;
+	display->base.handle_events = soft_display_handle_events;
+
+	*displayp = display;
+
+	return 0;
+}
+
+static void soft_display_close(struct soft_display *display)
+{
+	if (display)
+		close(display->base.fd);
+
+	free(display);
+}
+
+static void soft_close(struct host1x *host1x)
+{
+	struct soft *soft = to_soft(host1x);
+
+	soft_display_close(soft->display);
+	soft_gr3d_close(soft->gr3d);
+	soft_gr2d_close(soft->gr2d);
+	host1x_bo_cache_exit(&soft->base.bo_cache);
+	pthread_mutex_destroy(&soft->lock);
+
+	free(soft);
+}
+
+struct host1x *host1x_soft_open(void)
+{
+	const char *rate;
+	struct soft *soft;
+	int err;
+
+	soft = calloc(1, sizeof(*soft));
+	if (!soft)
+		return NULL;
+
+	host1x_bo_cache_init(&soft->base.bo_cache);
+	pthread_mutex_init(&soft->lock, NULL);
+
+	soft->iova = SOFT_IOVA_BASE;
+
+	soft->base.bo_create = soft_bo_create;
+	soft->base.close = soft_close;
+
+	err = soft_gr2d_create(&soft->gr2d, soft);
+	if (err < 0) {
+		fprintf(stderr, "soft_gr2d_create() failed: %d\n", err);
+		soft_close(&soft->base);
+		return NULL;
+	}
+
+	err = soft_gr3d_create(&soft->gr3d, soft);
+	if (err < 0) {
+		fprintf(stderr, "soft_gr3d_create() failed: %d\n", err);
+		soft_close(&soft->base);
+		return NULL;
+	}
+
+	soft->base.gr2d = &soft->gr2d->base;
+	soft->base.gr3d = &soft->gr3d->base;
+
+	rate = getenv("HOST1X_SOFT_DISPLAY");
+	if (rate) {
+		err = soft_display_create(&soft->display, atoi(rate));
+		if (err < 0) {
+			fprintf(stderr, "soft_display_create() failed: %d\n",
+				err);
+			soft_close(&soft->base);
+			return NULL;
+		}
+
+		soft->base.display = &soft->display->base;
+	}
+
+	return &soft->base;
+}
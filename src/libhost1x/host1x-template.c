@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+#define HOST1X_TEMPLATE_NO_PATCH (~0ul)
+
+struct host1x_template_reloc {
+	unsigned long offset;
+	unsigned long shift;
+};
+
+/*
+ * Templates are recorded by watching a push buffer while the command stream
+ * is built the regular way. The words must all end up in the same segment,
+ * otherwise recording fails and is tried again on the next occasion.
+ */
+struct host1x_template {
+	uint32_t *words;
+	unsigned long length;
+
+	struct host1x_template_reloc *relocs;
+	unsigned int num_relocs;
+
+	/* offsets of the words to patch, indexed by slot */
+	unsigned long *patches;
+	unsigned int num_patches;
+
+	uint32_t syncpt_incrs;
+	bool valid;
+
+	/* state of the recording in progress */
+	struct host1x_pushbuf *pb;
+	struct host1x_bo *bo;
+	unsigned long offset;
+	uint32_t *start;
+	unsigned long first_reloc;
+	uint32_t first_incr;
+	int error;
+};
+
+struct host1x_template *host1x_template_create(void)
+{
+	return calloc(1, sizeof(struct host1x_template));
+}
+
+void host1x_template_free(struct host1x_template *tmpl)
+{
+	if (tmpl) {
+		free(tmpl->patches);
+		free(tmpl->relocs);
+		free(tmpl->words);
+	}
+
+	free(tmpl);
+}
+
+/* discards the recorded stream, so that the template can be recorded again */
+void host1x_template_reset(struct host1x_template *tmpl)
+{
+	unsigned int i;
+
+	for (i = 0; i < tmpl->num_patches; i++)
+		tmpl->patches[i] = HOST1X_TEMPLATE_NO_PATCH;
+
+	tmpl->num_relocs = 0;
+	tmpl->length = 0;
+	tmpl->syncpt_incrs = 0;
+	tmpl->valid = false;
+	tmpl->pb = NULL;
+}
+
+bool host1x_template_is_valid(struct host1x_template *tmpl)
+{
+	return tmpl->valid;
+}
+
+static bool host1x_template_same_segment(struct host1x_template *tmpl,
+					 struct host1x_pushbuf *pb)
+{
+	return pb == tmpl->pb && pb->bo == tmpl->bo &&
+	       pb->offset == tmpl->offset;
+}
+
+/*
+ * Starts recording the words that are pushed from now on. Any previously
+ * recorded stream is discarded.
+ */
+void host1x_template_begin(struct host1x_template *tmpl,
+			   struct host1x_pushbuf *pb)
+{
+	host1x_template_reset(tmpl);
+
+	tmpl->pb = pb;
+	tmpl->bo = pb->bo;
+	tmpl->offset = pb->offset;
+	tmpl->start = pb->ptr;
+	tmpl->first_reloc = pb->num_relocs;
+	tmpl->first_incr = pb->job->syncpt_incrs;
+	tmpl->error = pb->data_words > 0 ? -EINVAL : 0;
+}
+
+/*
+ * Marks the next word pushed as one that is replaced by the value given for
+ * the slot when the template is stamped out.
+ */
+int host1x_template_patch(struct host1x_template *tmpl,
+			  struct host1x_pushbuf *pb, unsigned int slot)
+{
+	unsigned long *patches;
+	unsigned int i;
+	int err;
+
+	if (tmpl->error < 0)
+		return tmpl->error;
+
+	if (slot >= tmpl->num_patches) {
+		patches = realloc(tmpl->patches, (slot + 1) * sizeof(*patches));
+		if (!patches) {
+			tmpl->error = -ENOMEM;
+			return -ENOMEM;
+		}
+
+		for (i = tmpl->num_patches; i <= slot; i++)
+			patches[i] = HOST1X_TEMPLATE_NO_PATCH;
+
+		tmpl->num_patches = slot + 1;
+		tmpl->patches = patches;
+	}
+
+	/* the patched word needs to be in the same segment */
+	err = host1x_pushbuf_prepare(pb, 1);
+	if (err < 0)
+		return err;
+
+	if (!host1x_template_same_segment(tmpl, pb)) {
+		tmpl->error = -EAGAIN;
+		return tmpl->error;
+	}
+
+	tmpl->patches[slot] = pb->ptr - tmpl->start;
+
+	return 0;
+}
+
+int host1x_template_end(struct host1x_template *tmpl,
+			struct host1x_pushbuf *pb)
+{
+	unsigned long base, length, i;
+	struct host1x_template_reloc *relocs;
+	uint32_t *words;
+
+	if (tmpl->error < 0)
+		return tmpl->error;
+
+	if (!host1x_template_same_segment(tmpl, pb))
+		return -EAGAIN;
+
+	if (pb->data_words > 0)
+		return -EINVAL;
+
+	length = pb->ptr - tmpl->start;
+
+	words = realloc(tmpl->words, length * sizeof(*words));
+	if (length > 0 && !words)
+		return -ENOMEM;
+
+	tmpl->words = words;
+
+	relocs = realloc(tmpl->relocs, (pb->num_relocs - tmpl->first_reloc) *
+				       sizeof(*relocs));
+	if (pb->num_relocs > tmpl->first_reloc && !relocs)
+		return -ENOMEM;
+
+	tmpl->relocs = relocs;
+
+	memcpy(tmpl->words, tmpl->start, length * sizeof(*words));
+	tmpl->length = length;
+
+	base = host1x_bo_get_offset(pb->bo, tmpl->start);
+
+	for (i = tmpl->first_reloc; i < pb->num_relocs; i++) {
+		struct host1x_pushbuf_reloc *reloc = &pb->relocs[i];
+
+		relocs[tmpl->num_relocs].offset = (reloc->source_offset - base) /
+						  sizeof(uint32_t);
+		relocs[tmpl->num_relocs].shift = reloc->shift;
+		tmpl->num_relocs++;
+	}
+
+	tmpl->syncpt_incrs = pb->job->syncpt_incrs - tmpl->first_incr;
+	tmpl->valid = true;
+	tmpl->pb = NULL;
+
+	return 0;
+}
+
+/*
+ * Copies the template into the push buffer. Patch slots take their values
+ * from the patches array and the relocations, in the order in which they
+ * were recorded, point at the given targets.
+ */
+int host1x_pushbuf_stamp(struct host1x_pushbuf *pb,
+			 struct host1x_template *tmpl, const uint32_t *patches,
+			 const struct host1x_template_target *targets)
+{
+	uint32_t *ptr;
+	unsigned int i;
+	int err;
+
+	if (!tmpl->valid || pb->data_words > 0)
+		return -EINVAL;
+
+	ptr = __host1x_pushbuf_reserve(pb, tmpl->length);
+	if (!ptr)
+		return -ENOMEM;
+
+	memcpy(ptr, tmpl->words, tmpl->length * sizeof(*ptr));
+
+	for (i = 0; i < tmpl->num_patches; i++)
+		if (tmpl->patches[i] != HOST1X_TEMPLATE_NO_PATCH)
+			ptr[tmpl->patches[i]] = patches[i];
+
+	for (i = 0; i < tmpl->num_relocs; i++) {
+		struct host1x_template_reloc *reloc = &tmpl->relocs[i];
+
+		err = host1x_pushbuf_relocate_at(pb, ptr + reloc->offset,
+						 targets[i].bo,
+						 targets[i].offset,
+						 reloc->shift);
+		if (err < 0)
+			return err;
+	}
+
+	pb->job->syncpt_incrs += tmpl->syncpt_incrs;
+
+	return 0;
+}
@@ -22,45 +22,98 @@
  */
 
 #include <errno.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "host1x.h"
 #include "host1x-private.h"
 
+#define HOST1X_PUSHBUF_SEGMENT_SIZE (8 * 4096)
+
+static const struct host1x_backend {
+	const char *name;
+	const char *description;
+	struct host1x *(*open)(void);
+} host1x_backends[] = {
+	{ "drm", "Tegra DRM interface", host1x_drm_open },
+	{ "nvhost", "L4T interface", host1x_nvhost_open },
+	{ "soft", "software implementation", host1x_soft_open },
+};
+
+/* all jobs are recorded to the file named by HOST1X_CAPTURE, if set */
+static void host1x_open_capture(struct host1x *host1x)
+{
+	const char *path = getenv("HOST1X_CAPTURE");
+	int err;
+
+	if (!path)
+		return;
+
+	err = host1x_capture_start(host1x, path);
+	if (err < 0)
+		fprintf(stderr, "failed to capture to %s: %d\n", path, err);
+}
+
+/*
+ * Backends are tried in order until one of them can be opened. The software
+ * implementation always works, so it is only used if no hardware is found.
+ * A specific backend can be selected by setting HOST1X_BACKEND to its name.
+ */
 struct host1x *host1x_open(void)
 {
+	const char *name = getenv("HOST1X_BACKEND");
 	struct host1x *host1x;
+	unsigned int i;
 
-	printf("Looking for Tegra DRM interface...");
-	fflush(stdout);
+	for (i = 0; i < ARRAY_SIZE(host1x_backends); i++) {
+		const struct host1x_backend *backend = &host1x_backends[i];
 
-	host1x = host1x_drm_open();
-	if (host1x) {
-		printf("found\n");
-		return host1x;
-	}
+		if (name && strcmp(name, backend->name) != 0)
+			continue;
+
+		printf("Looking for %s...", backend->description);
+		fflush(stdout);
+
+		host1x = backend->open();
+		if (host1x) {
+			printf("found\n");
+
+			host1x->waiter = host1x_fence_waiter_create();
+			if (!host1x->waiter) {
+				host1x->close(host1x);
+				return NULL;
+			}
 
-	printf("not found\n");
-	printf("Looking for L4T interface...");
-	fflush(stdout);
+			host1x_open_capture(host1x);
+			return host1x;
+		}
 
-	host1x = host1x_nvhost_open();
-	if (host1x) {
-		printf("found\n");
-		return host1x;
+		printf("not found\n");
 	}
 
-	printf("not found\n");
 	return NULL;
 }
 
 void host1x_close(struct host1x *host1x)
 {
+	host1x_capture_stop(host1x);
+	host1x_fence_waiter_free(host1x->waiter);
 	host1x->close(host1x);
 }
 
+/* returns the time in microseconds of CLOCK_MONOTONIC */
+uint64_t host1x_get_time(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
 struct host1x_display *host1x_get_display(struct host1x *host1x)
 {
 	return host1x->display;
@@ -76,6 +129,18 @@ struct host1x_gr3d *host1x_get_gr3d(struct host1x *host1x)
 	return host1x->gr3d;
 }
 
+struct host1x_client *host1x_get_client(struct host1x *host1x,
+				       uint32_t class)
+{
+	if (host1x->gr2d && host1x->gr2d->client->class == class)
+		return host1x->gr2d->client;
+
+	if (host1x->gr3d && host1x->gr3d->client->class == class)
+		return host1x->gr3d->client;
+
+	return NULL;
+}
+
 int host1x_display_get_resolution(struct host1x_display *display,
 				  unsigned int *width, unsigned int *height)
 {
@@ -91,6 +156,110 @@ int host1x_display_set(struct host1x_display *display,
 	return display->set(display, fb, vsync);
 }
 
+/*
+ * Queues a flip to the framebuffer at the next vertical blank without
+ * waiting for it. Only one flip can be pending at a time.
+ */
+int host1x_display_flip(struct host1x_display *display,
+			struct host1x_framebuffer *fb)
+{
+	int err;
+
+	if (!display->flip)
+		return -EOPNOTSUPP;
+
+	if (display->pending)
+		return -EBUSY;
+
+	err = display->flip(display, fb);
+	if (err < 0)
+		return err;
+
+	display->queued = host1x_get_time();
+	display->pending = fb;
+
+	return 0;
+}
+
+bool host1x_display_flip_pending(struct host1x_display *display)
+{
+	return display->pending != NULL;
+}
+
+/*
+ * Processes display events until no flip is pending anymore or the timeout,
+ * in milliseconds, expires. A negative timeout waits forever and zero only
+ * handles events that have already arrived. On success the most recently
+ * completed flip is returned.
+ */
+int host1x_display_wait_flip(struct host1x_display *display, int timeout,
+			     struct host1x_flip *flip)
+{
+	struct pollfd fds;
+	int err;
+
+	while (display->pending) {
+		fds.fd = display->fd;
+		fds.events = POLLIN;
+		fds.revents = 0;
+
+		err = poll(&fds, 1, timeout);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -errno;
+		}
+
+		if (err == 0)
+			return -ETIMEDOUT;
+
+		err = display->handle_events(display);
+		if (err < 0)
+			return err;
+	}
+
+	if (flip)
+		*flip = display->last;
+
+	return 0;
+}
+
+/*
+ * Forgets about a pending flip whose completion can't be waited for, after
+ * the display failed to handle its events, so that flips can be queued
+ * again.
+ */
+void host1x_display_cancel_flip(struct host1x_display *display)
+{
+	display->pending = NULL;
+}
+
+/* becomes readable when display events are waiting to be handled */
+int host1x_display_get_fd(struct host1x_display *display)
+{
+	return display->flip ? display->fd : -1;
+}
+
+/* called by backends from handle_events() when a flip has completed */
+void host1x_display_flip_done(struct host1x_display *display,
+			      unsigned int sequence, unsigned int sec,
+			      unsigned int usec)
+{
+	struct host1x_framebuffer *fb = display->pending;
+
+	display->last.fb = fb;
+	display->last.sequence = sequence;
+	display->last.submitted = fb->submitted;
+	display->last.completed = fb->completed;
+	display->last.queued = display->queued;
+	display->last.timestamp = (uint64_t)sec * 1000000 + usec;
+	display->pending = NULL;
+
+	fb->submitted = 0;
+	fb->completed = 0;
+}
+
 int host1x_overlay_create(struct host1x_overlay **overlayp,
 			  struct host1x_display *display)
 {
@@ -113,12 +282,139 @@ int host1x_overlay_set(struct host1x_overlay *overlay,
 struct host1x_bo *host1x_bo_create(struct host1x *host1x, size_t size,
 				   unsigned long flags)
 {
-	return host1x->bo_create(host1x, size, flags);
+	struct host1x_bo *bo;
+
+	bo = host1x_bo_cache_get(&host1x->bo_cache, &size, flags);
+	if (bo)
+		return bo;
+
+	bo = host1x->bo_create(host1x, size, flags);
+	if (bo) {
+		bo->host1x = host1x;
+		bo->flags = flags;
+	}
+
+	return bo;
 }
 
 void host1x_bo_free(struct host1x_bo *bo)
 {
-	bo->free(bo);
+	if (!host1x_bo_cache_put(&bo->host1x->bo_cache, bo))
+		bo->free(bo);
+}
+
+/*
+ * CPU writes need to be flushed from the caches before the hardware can see
+ * them. Rather than flushing after every write, the written ranges of each
+ * buffer object are merged and flushed once when a job that uses the buffer
+ * object is submitted.
+ */
+void host1x_bo_mark_dirty(struct host1x_bo *bo, loff_t offset, size_t length)
+{
+	unsigned long start = offset, end = offset + length;
+
+	if (end > bo->size)
+		end = bo->size;
+
+	if (start >= end)
+		return;
+
+	if (bo->dirty_start == bo->dirty_end) {
+		bo->dirty_start = start;
+		bo->dirty_end = end;
+		return;
+	}
+
+	if (start < bo->dirty_start)
+		bo->dirty_start = start;
+
+	if (end > bo->dirty_end)
+		bo->dirty_end = end;
+}
+
+static int host1x_bo_flush_dirty(struct host1x_bo *bo)
+{
+	unsigned long start = bo->dirty_start, end = bo->dirty_end;
+
+	if (start == end)
+		return 0;
+
+	bo->dirty_start = bo->dirty_end = 0;
+
+	if (!bo->flush)
+		return 0;
+
+	return bo->flush(bo, start, end - start);
+}
+
+int host1x_bo_export_fd(struct host1x_bo *bo, int *fd)
+{
+	int err;
+
+	if (!bo->export_fd)
+		return -ENOSYS;
+
+	err = bo->export_fd(bo, fd);
+	if (err < 0)
+		return err;
+
+	bo->shared = true;
+
+	return 0;
+}
+
+struct host1x_bo *host1x_bo_import_fd(struct host1x *host1x, int fd)
+{
+	struct host1x_bo *bo;
+
+	if (!host1x->bo_import_fd)
+		return NULL;
+
+	bo = host1x->bo_import_fd(host1x, fd);
+	if (bo) {
+		bo->host1x = host1x;
+		bo->shared = true;
+	}
+
+	return bo;
+}
+
+int host1x_bo_export_name(struct host1x_bo *bo, uint32_t *name)
+{
+	int err;
+
+	if (!bo->export_name)
+		return -ENOSYS;
+
+	err = bo->export_name(bo, name);
+	if (err < 0)
+		return err;
+
+	bo->shared = true;
+
+	return 0;
+}
+
+struct host1x_bo *host1x_bo_import_name(struct host1x *host1x, uint32_t name)
+{
+	struct host1x_bo *bo;
+
+	if (!host1x->bo_import_name)
+		return NULL;
+
+	bo = host1x->bo_import_name(host1x, name);
+	if (bo) {
+		bo->host1x = host1x;
+		bo->shared = true;
+	}
+
+	return bo;
+}
+
+void host1x_get_bo_cache_stats(struct host1x *host1x,
+			       struct host1x_bo_cache_stats *stats)
+{
+	host1x_bo_cache_get_stats(&host1x->bo_cache, stats);
 }
 
 int host1x_bo_mmap(struct host1x_bo *bo, void **ptr)
@@ -143,7 +439,107 @@ int host1x_bo_invalidate(struct host1x_bo *bo, loff_t offset, size_t length)
 	return 0;
 }
 
-struct host1x_job *host1x_job_create(uint32_t syncpt, uint32_t increments)
+/*
+ * Jobs allocate all of their bookkeeping (push buffers, push buffer arrays
+ * and relocation arrays) from a simple bump allocator. Resetting the arena
+ * makes all of the memory available again without returning it to the
+ * system, so that a job that is reused doesn't cause any heap traffic once
+ * the arena has grown large enough.
+ */
+#define HOST1X_ARENA_CHUNK_SIZE 4096
+
+struct host1x_arena_chunk {
+	struct host1x_arena_chunk *next;
+	size_t size;
+	size_t used;
+
+	unsigned long long data[];
+};
+
+static struct host1x_arena_chunk *host1x_arena_chunk_new(size_t size)
+{
+	struct host1x_arena_chunk *chunk;
+
+	chunk = malloc(sizeof(*chunk) + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+static void *host1x_arena_alloc(struct host1x_arena *arena, size_t size)
+{
+	struct host1x_arena_chunk *chunk = arena->chunks;
+	void *ptr;
+
+	size = (size + sizeof(chunk->data[0]) - 1) & ~(sizeof(chunk->data[0]) - 1);
+
+	if (!chunk || chunk->size - chunk->used < size) {
+		size_t length = HOST1X_ARENA_CHUNK_SIZE;
+
+		if (chunk && chunk->size * 2 > length)
+			length = chunk->size * 2;
+
+		if (size > length)
+			length = size;
+
+		chunk = host1x_arena_chunk_new(length);
+		if (!chunk)
+			return NULL;
+
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	ptr = (void *)chunk->data + chunk->used;
+	chunk->used += size;
+
+	return ptr;
+}
+
+static void host1x_arena_free(struct host1x_arena *arena)
+{
+	struct host1x_arena_chunk *chunk = arena->chunks, *next;
+
+	while (chunk) {
+		next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	arena->chunks = NULL;
+}
+
+/*
+ * If the arena had to grow, replace all chunks by a single one that is
+ * large enough to satisfy the same allocations next time around.
+ */
+static void host1x_arena_reset(struct host1x_arena *arena)
+{
+	struct host1x_arena_chunk *chunk;
+	size_t size = 0;
+
+	if (!arena->chunks)
+		return;
+
+	if (!arena->chunks->next) {
+		arena->chunks->used = 0;
+		return;
+	}
+
+	for (chunk = arena->chunks; chunk; chunk = chunk->next)
+		size += chunk->size;
+
+	host1x_arena_free(arena);
+
+	arena->chunks = host1x_arena_chunk_new(size);
+}
+
+struct host1x_job *host1x_job_create(uint32_t syncpt)
 {
 	struct host1x_job *job;
 
@@ -152,96 +548,868 @@ struct host1x_job *host1x_job_create(uint32_t syncpt, uint32_t increments)
 		return NULL;
 
 	job->syncpt = syncpt;
-	job->syncpt_incrs = increments;
 
 	return job;
 }
 
-void host1x_job_free(struct host1x_job *job)
+static void host1x_job_release(struct host1x_job *job)
 {
 	unsigned int i;
 
 	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pb = &job->pushbufs[i];
-		free(pb->relocs);
+		struct host1x_pushbuf *pb = job->pushbufs[i];
+
+		if (pb->owned)
+			host1x_bo_free(pb->bo);
 	}
 
-	free(job->pushbufs);
+	/* hand back ring space of a job that was never submitted */
+	if (job->ring)
+		host1x_ring_fence(job->ring, job, NULL);
+}
+
+void host1x_job_free(struct host1x_job *job)
+{
+	host1x_job_release(job);
+	host1x_arena_free(&job->arena);
 	free(job);
 }
 
+/*
+ * Prepare a job for reuse. Memory allocated by the job is kept around so
+ * that building a similar job again doesn't need to allocate.
+ */
+void host1x_job_reset(struct host1x_job *job)
+{
+	host1x_job_release(job);
+	host1x_arena_reset(&job->arena);
+
+	job->syncpt_incrs = 0;
+	job->pushbufs = NULL;
+	job->num_pushbufs = 0;
+	job->max_pushbufs = 0;
+	job->waitchks = NULL;
+	job->num_waitchks = 0;
+	job->max_waitchks = 0;
+	job->ring = NULL;
+}
+
+static int host1x_job_queue(struct host1x_job *job, struct host1x_pushbuf *pb)
+{
+	struct host1x_pushbuf **pushbufs;
+
+	if (job->num_pushbufs == job->max_pushbufs) {
+		unsigned int max = job->max_pushbufs ? job->max_pushbufs * 2 : 4;
+
+		pushbufs = host1x_arena_alloc(&job->arena,
+					      max * sizeof(*pushbufs));
+		if (!pushbufs)
+			return -ENOMEM;
+
+		if (job->num_pushbufs > 0)
+			memcpy(pushbufs, job->pushbufs,
+			       job->num_pushbufs * sizeof(*pushbufs));
+
+		job->pushbufs = pushbufs;
+		job->max_pushbufs = max;
+	}
+
+	job->pushbufs[job->num_pushbufs++] = pb;
+
+	return 0;
+}
+
 struct host1x_pushbuf *host1x_job_append(struct host1x_job *job,
 					 struct host1x_bo *bo,
 					 unsigned long offset)
 {
 	struct host1x_pushbuf *pb;
-	size_t size;
+	int err;
 
 	if (!bo->ptr)
 		return NULL;
 
-	size = (job->num_pushbufs + 1) * sizeof(*pb);
-
-	pb = realloc(job->pushbufs, size);
+	pb = host1x_arena_alloc(&job->arena, sizeof(*pb));
 	if (!pb)
 		return NULL;
 
-	job->pushbufs = pb;
-
-	pb = &job->pushbufs[job->num_pushbufs++];
 	memset(pb, 0, sizeof(*pb));
 
+	err = host1x_job_queue(job, pb);
+	if (err < 0)
+		return NULL;
+
 	pb->ptr = bo->ptr + offset;
+	pb->end = bo->ptr + bo->size;
 	pb->offset = offset;
+	pb->job = job;
 	pb->bo = bo;
 
 	return pb;
 }
 
-int host1x_pushbuf_push(struct host1x_pushbuf *pb, uint32_t word)
+/*
+ * Jobs built on a command ring take the push buffer contents from regions of
+ * the ring. The job must be submitted using host1x_client_submit_async() so
+ * that the regions are kept until the job has completed.
+ */
+struct host1x_pushbuf *host1x_job_append_ring(struct host1x_job *job,
+					      struct host1x_ring *ring)
 {
-	*pb->ptr++ = word;
-	pb->length++;
+	struct host1x_pushbuf *pb;
+	int err;
 
-	return 0;
+	pb = host1x_arena_alloc(&job->arena, sizeof(*pb));
+	if (!pb)
+		return NULL;
+
+	memset(pb, 0, sizeof(*pb));
+
+	err = host1x_job_queue(job, pb);
+	if (err < 0)
+		return NULL;
+
+	pb->job = job;
+	job->ring = ring;
+
+	err = host1x_pushbuf_grow(pb, 0);
+	if (err < 0) {
+		job->num_pushbufs--;
+		return NULL;
+	}
+
+	return pb;
 }
 
-int host1x_pushbuf_relocate(struct host1x_pushbuf *pb, struct host1x_bo *target,
-			    unsigned long offset, unsigned long shift)
+static int host1x_pushbuf_alloc(struct host1x_pushbuf *pb, size_t *size,
+				struct host1x_bo **bop, unsigned long *offset)
 {
-	struct host1x_pushbuf_reloc *reloc;
-	size_t size;
+	struct host1x_job *job = pb->job;
+	struct host1x_bo *bo;
+	int err;
 
-	size = (pb->num_relocs + 1) * sizeof(*reloc);
+	if (job->ring)
+		return host1x_ring_alloc(job->ring, pb, size, bop, offset);
 
-	reloc = realloc(pb->relocs, size);
-	if (!reloc)
-		return -ENOMEM;
+	if (*size < HOST1X_PUSHBUF_SEGMENT_SIZE)
+		*size = HOST1X_PUSHBUF_SEGMENT_SIZE;
 
-	pb->relocs = reloc;
+	bo = host1x_bo_create(pb->bo->host1x, *size, 2);
+	if (!bo)
+		return -ENOMEM;
 
-	reloc = &pb->relocs[pb->num_relocs++];
+	err = host1x_bo_mmap(bo, NULL);
+	if (err < 0) {
+		host1x_bo_free(bo);
+		return err;
+	}
 
-	reloc->source_offset = host1x_bo_get_offset(pb->bo, pb->ptr);
-	reloc->target_handle = target->handle;
-	reloc->target_offset = offset;
-	reloc->shift = shift;
+	*offset = 0;
+	*bop = bo;
 
 	return 0;
 }
 
-int host1x_client_submit(struct host1x_client *client, struct host1x_job *job)
+/*
+ * Called when the current segment of a push buffer cannot hold the given
+ * number of words. The words written so far are kept in place as a separate
+ * command buffer of the job while the push buffer continues in a freshly
+ * allocated segment that is queued at the end of the job.
+ */
+int host1x_pushbuf_grow(struct host1x_pushbuf *pb, unsigned int words)
 {
-	return client->submit(client, job);
-}
+	struct host1x_job *job = pb->job;
+	size_t size = words * sizeof(uint32_t);
+	struct host1x_pushbuf *segment;
+	unsigned long offset;
+	struct host1x_bo *bo;
+	bool owned = !job->ring;
+	unsigned int i;
+	int err;
 
-int host1x_client_flush(struct host1x_client *client, uint32_t *fence)
-{
-	return client->flush(client, fence);
-}
+	err = host1x_pushbuf_alloc(pb, &size, &bo, &offset);
+	if (err < 0)
+		return err;
 
-int host1x_client_wait(struct host1x_client *client, uint32_t fence,
-		       uint32_t timeout)
-{
-	return client->wait(client, fence, timeout);
+	if (pb->length > 0) {
+		segment = host1x_arena_alloc(&job->arena, sizeof(*segment));
+		if (!segment) {
+			if (owned)
+				host1x_bo_free(bo);
+
+			return -ENOMEM;
+		}
+
+		err = host1x_job_queue(job, pb);
+		if (err < 0) {
+			if (owned)
+				host1x_bo_free(bo);
+
+			return err;
+		}
+
+		*segment = *pb;
+
+		for (i = 0; i < job->num_pushbufs - 1; i++) {
+			if (job->pushbufs[i] == pb) {
+				job->pushbufs[i] = segment;
+				break;
+			}
+		}
+
+		pb->relocs = NULL;
+		pb->num_relocs = 0;
+		pb->max_relocs = 0;
+	} else if (pb->owned) {
+		host1x_bo_free(pb->bo);
+	}
+
+	pb->ptr = bo->ptr + offset;
+	pb->end = bo->ptr + offset + size;
+	pb->offset = offset;
+	pb->length = 0;
+	pb->owned = owned;
+	pb->bo = bo;
+
+	return 0;
+}
+
+static void host1x_pushbuf_count_syncpt(struct host1x_pushbuf *pb,
+					uint32_t value)
+{
+	if ((value & 0xff) == pb->job->syncpt)
+		pb->job->syncpt_incrs++;
+}
+
+static void host1x_pushbuf_decode_opcode(struct host1x_pushbuf *pb,
+					 uint32_t word)
+{
+	unsigned int offset = (word >> 16) & 0xfff;
+
+	pb->data_words = host1x_opcode_get_count(word);
+	pb->syncpt_words = 0;
+
+	if (offset != 0)
+		return;
+
+	switch (word >> 28) {
+	case 0x0: /* SETCL */
+	case 0x3: /* MASK */
+		if (word & 0x1)
+			pb->syncpt_words = 1;
+
+		break;
+
+	case 0x1: /* INCR */
+		if (pb->data_words > 0)
+			pb->syncpt_words = 1;
+
+		break;
+
+	case 0x2: /* NONINCR */
+		pb->syncpt_words = pb->data_words;
+		break;
+
+	case 0x4: /* IMM */
+		host1x_pushbuf_count_syncpt(pb, word & 0xffff);
+		break;
+	}
+}
+
+/*
+ * Follow the opcodes written to a push buffer and count the writes to the
+ * syncpoint increment register, which is at offset 0 in every class, that
+ * refer to the job's syncpoint. This is what determines the number of
+ * increments the job is submitted with.
+ */
+void host1x_pushbuf_decode(struct host1x_pushbuf *pb, const uint32_t *words,
+			   unsigned long count)
+{
+	unsigned long skip;
+
+	while (count > 0) {
+		if (pb->data_words == 0) {
+			host1x_pushbuf_decode_opcode(pb, *words);
+			words++;
+			count--;
+		} else if (pb->syncpt_words > 0) {
+			host1x_pushbuf_count_syncpt(pb, *words);
+			pb->syncpt_words--;
+			pb->data_words--;
+			words++;
+			count--;
+		} else {
+			skip = pb->data_words < count ? pb->data_words : count;
+			pb->data_words -= skip;
+			words += skip;
+			count -= skip;
+		}
+	}
+}
+
+/*
+ * Records a relocation for a word that was already written to the current
+ * segment of the push buffer.
+ */
+int host1x_pushbuf_relocate_at(struct host1x_pushbuf *pb, uint32_t *word,
+			       struct host1x_bo *target, unsigned long offset,
+			       unsigned long shift)
+{
+	struct host1x_pushbuf_reloc *reloc;
+
+	if (pb->num_relocs == pb->max_relocs) {
+		unsigned long max = pb->max_relocs ? pb->max_relocs * 2 : 8;
+
+		reloc = host1x_arena_alloc(&pb->job->arena,
+					   max * sizeof(*reloc));
+		if (!reloc)
+			return -ENOMEM;
+
+		if (pb->num_relocs > 0)
+			memcpy(reloc, pb->relocs,
+			       pb->num_relocs * sizeof(*reloc));
+
+		pb->relocs = reloc;
+		pb->max_relocs = max;
+	}
+
+	reloc = &pb->relocs[pb->num_relocs++];
+
+	reloc->target = target;
+	reloc->source_offset = host1x_bo_get_offset(pb->bo, word);
+	reloc->target_handle = target->handle;
+	reloc->target_offset = offset;
+	reloc->shift = shift;
+
+	return 0;
+}
+
+int host1x_pushbuf_relocate(struct host1x_pushbuf *pb, struct host1x_bo *target,
+			    unsigned long offset, unsigned long shift)
+{
+	int err;
+
+	/* the relocated word needs to be in the same segment */
+	err = host1x_pushbuf_prepare(pb, 1);
+	if (err < 0)
+		return err;
+
+	return host1x_pushbuf_relocate_at(pb, pb->ptr, target, offset, shift);
+}
+
+/*
+ * Makes the channel stop until a fence has been reached before it executes
+ * the commands that follow. The wait is performed by host1x itself, which
+ * requires switching to the host1x class and back to the given one, so work
+ * for different clients can be submitted back to back and still execute in
+ * order without the CPU having to wait in between.
+ */
+int host1x_pushbuf_wait(struct host1x_pushbuf *pb, struct host1x_fence *fence,
+			uint32_t class)
+{
+	struct host1x_job *job = pb->job;
+	struct host1x_job_waitchk *waitchk;
+	int err;
+
+	/* the wait needs to be in the same segment as the recorded offset */
+	err = host1x_pushbuf_prepare(pb, 4);
+	if (err < 0)
+		return err;
+
+	if (job->num_waitchks == job->max_waitchks) {
+		unsigned int max = job->max_waitchks ? job->max_waitchks * 2 : 4;
+
+		waitchk = host1x_arena_alloc(&job->arena,
+					     max * sizeof(*waitchk));
+		if (!waitchk)
+			return -ENOMEM;
+
+		if (job->num_waitchks > 0)
+			memcpy(waitchk, job->waitchks,
+			       job->num_waitchks * sizeof(*waitchk));
+
+		job->waitchks = waitchk;
+		job->max_waitchks = max;
+	}
+
+	waitchk = &job->waitchks[job->num_waitchks++];
+
+	waitchk->bo = pb->bo;
+	waitchk->offset = host1x_bo_get_offset(pb->bo, pb->ptr + 2);
+	waitchk->syncpt = fence->syncpt;
+	waitchk->thresh = fence->value;
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0x000, HOST1X_CLASS_HOST1X,
+						    0x00));
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x008, 0x01));
+	host1x_pushbuf_push(pb, fence->syncpt << 24 |
+				(fence->value & 0xffffff));
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0x000, class, 0x00));
+
+	return 0;
+}
+
+/*
+ * Flushes the CPU writes to all buffer objects used by a job. Each buffer
+ * object is flushed at most once, no matter how many push buffers or
+ * relocations refer to it.
+ */
+static int host1x_job_flush(struct host1x_job *job)
+{
+	unsigned int i, j;
+	int err;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		struct host1x_pushbuf *pb = job->pushbufs[i];
+
+		if (!pb->shared)
+			host1x_bo_mark_dirty(pb->bo, pb->offset,
+					     pb->length * 4);
+	}
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		struct host1x_pushbuf *pb = job->pushbufs[i];
+
+		err = host1x_bo_flush_dirty(pb->bo);
+		if (err < 0)
+			return err;
+
+		for (j = 0; j < pb->num_relocs; j++) {
+			err = host1x_bo_flush_dirty(pb->relocs[j].target);
+			if (err < 0)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+struct host1x_fragment *host1x_fragment_create(struct host1x *host1x,
+					       uint32_t syncpt)
+{
+	struct host1x_fragment *fragment;
+	struct host1x_pushbuf *pb;
+	struct host1x_bo *bo;
+	int err;
+
+	fragment = calloc(1, sizeof(*fragment));
+	if (!fragment)
+		return NULL;
+
+	fragment->job = host1x_job_create(syncpt);
+	if (!fragment->job) {
+		free(fragment);
+		return NULL;
+	}
+
+	/* the first segment is allocated the same way as later ones */
+	bo = host1x_bo_create(host1x, HOST1X_PUSHBUF_SEGMENT_SIZE, 2);
+	if (!bo) {
+		host1x_fragment_free(fragment);
+		return NULL;
+	}
+
+	err = host1x_bo_mmap(bo, NULL);
+	if (err < 0) {
+		host1x_bo_free(bo);
+		host1x_fragment_free(fragment);
+		return NULL;
+	}
+
+	pb = host1x_job_append(fragment->job, bo, 0);
+	if (!pb) {
+		host1x_bo_free(bo);
+		host1x_fragment_free(fragment);
+		return NULL;
+	}
+
+	pb->owned = true;
+	fragment->pb = pb;
+
+	return fragment;
+}
+
+/*
+ * Jobs that reference the fragment must have completed before it is freed,
+ * which is ensured by waiting for the last job that used any of its buffer
+ * objects.
+ */
+void host1x_fragment_free(struct host1x_fragment *fragment)
+{
+	struct host1x_job *job;
+	unsigned int i;
+
+	if (!fragment)
+		return;
+
+	job = fragment->job;
+
+	for (i = 0; i < job->num_pushbufs; i++)
+		host1x_fence_wait(&job->pushbufs[i]->bo->fence, -1);
+
+	host1x_job_free(job);
+	free(fragment);
+}
+
+struct host1x_pushbuf *host1x_fragment_begin(struct host1x_fragment *fragment)
+{
+	if (fragment->sealed)
+		return NULL;
+
+	return fragment->pb;
+}
+
+/*
+ * Finishes recording a fragment. Its contents are flushed to the device
+ * once and must not be modified afterwards.
+ */
+int host1x_fragment_end(struct host1x_fragment *fragment)
+{
+	struct host1x_job *job = fragment->job;
+	unsigned int i;
+	int err;
+
+	if (fragment->pb->data_words > 0)
+		return -EINVAL;
+
+	err = host1x_job_flush(job);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < job->num_pushbufs; i++)
+		job->pushbufs[i]->shared = true;
+
+	fragment->sealed = true;
+
+	return 0;
+}
+
+unsigned long host1x_fragment_get_length(struct host1x_fragment *fragment)
+{
+	struct host1x_job *job = fragment->job;
+	unsigned long length = 0;
+	unsigned int i;
+
+	for (i = 0; i < job->num_pushbufs; i++)
+		length += job->pushbufs[i]->length;
+
+	return length;
+}
+
+/*
+ * Makes the contents of a fragment part of the job at the current position
+ * of the push buffer. The words written to the push buffer so far become a
+ * command buffer of their own, followed by those of the fragment, and the
+ * push buffer continues in the remaining space of its segment.
+ *
+ * XXX: The host1x GATHER opcode could do this from within the stream, but
+ * neither the nvhost nor the DRM interfaces allow command buffers to fetch
+ * from other buffer objects, so the fragment is passed as separate command
+ * buffers instead, which costs no command stream words at all.
+ */
+int host1x_pushbuf_gather(struct host1x_pushbuf *pb,
+			  struct host1x_fragment *fragment)
+{
+	struct host1x_job *source = fragment->job, *job = pb->job;
+	struct host1x_pushbuf *segment, *copy;
+	unsigned int i, index;
+	int err;
+
+	if (!fragment->sealed || pb->data_words > 0)
+		return -EINVAL;
+
+	if (source->syncpt != job->syncpt && source->syncpt_incrs > 0)
+		return -EINVAL;
+
+	for (index = 0; index < job->num_pushbufs; index++)
+		if (job->pushbufs[index] == pb)
+			break;
+
+	if (index == job->num_pushbufs)
+		return -EINVAL;
+
+	if (pb->length > 0) {
+		segment = host1x_arena_alloc(&job->arena, sizeof(*segment));
+		if (!segment)
+			return -ENOMEM;
+
+		*segment = *pb;
+		segment->end = segment->ptr;
+		segment->owned = false;
+		job->pushbufs[index] = segment;
+	} else {
+		/* the push buffer is moved behind the fragment */
+		memmove(&job->pushbufs[index], &job->pushbufs[index + 1],
+			(job->num_pushbufs - index - 1) * sizeof(pb));
+		job->num_pushbufs--;
+	}
+
+	for (i = 0; i < source->num_pushbufs; i++) {
+		if (source->pushbufs[i]->length == 0)
+			continue;
+
+		copy = host1x_arena_alloc(&job->arena, sizeof(*copy));
+		if (!copy)
+			return -ENOMEM;
+
+		*copy = *source->pushbufs[i];
+		copy->job = job;
+		copy->owned = false;
+
+		err = host1x_job_queue(job, copy);
+		if (err < 0)
+			return err;
+	}
+
+	err = host1x_job_queue(job, pb);
+	if (err < 0)
+		return err;
+
+	job->syncpt_incrs += source->syncpt_incrs;
+
+	pb->offset += pb->length * sizeof(uint32_t);
+	pb->length = 0;
+	pb->relocs = NULL;
+	pb->num_relocs = 0;
+	pb->max_relocs = 0;
+
+	return 0;
+}
+
+int host1x_client_flush(struct host1x_client *client, uint32_t *fence)
+{
+	return client->flush(client, fence);
+}
+
+int host1x_client_wait(struct host1x_client *client, uint32_t fence,
+		       uint32_t timeout)
+{
+	return client->wait(client, client->syncpts[0].id, fence, timeout);
+}
+
+struct host1x_syncpt *host1x_client_find_syncpt(struct host1x_client *client,
+						uint32_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < client->num_syncpts; i++)
+		if (client->syncpts[i].id == id)
+			return &client->syncpts[i];
+
+	return NULL;
+}
+
+int host1x_client_submit_async(struct host1x_client *client,
+			       struct host1x_job *job,
+			       struct host1x_fence *fence)
+{
+	unsigned int i, j;
+	uint32_t value;
+	int err;
+
+	err = host1x_job_flush(job);
+	if (err < 0)
+		return err;
+
+	if (job->num_pushbufs > 0) {
+		struct host1x *host1x = job->pushbufs[0]->bo->host1x;
+
+		if (host1x && host1x->capture) {
+			err = host1x_capture_job(host1x->capture, client, job);
+			if (err < 0)
+				return err;
+		}
+	}
+
+	/*
+	 * The register writes that the shadow assumes were made are lost if
+	 * the job doesn't make it to the hardware.
+	 */
+	err = client->submit(client, job);
+	if (err < 0) {
+		host1x_shadow_invalidate(client->shadow);
+		return err;
+	}
+
+	err = client->flush(client, &value);
+	if (err < 0) {
+		host1x_shadow_invalidate(client->shadow);
+		return err;
+	}
+
+	fence->client = client;
+	fence->syncpt = job->syncpt;
+	fence->value = value;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		struct host1x_pushbuf *pb = job->pushbufs[i];
+
+		pb->bo->fence = *fence;
+
+		for (j = 0; j < pb->num_relocs; j++)
+			pb->relocs[j].target->fence = *fence;
+	}
+
+	if (job->ring)
+		host1x_ring_fence(job->ring, job, fence);
+
+	return 0;
+}
+
+/*
+ * Submits a job and waits for it to complete. This goes through the same
+ * steps as an asynchronous submission, so jobs submitted either way can be
+ * mixed freely.
+ */
+int host1x_client_submit(struct host1x_client *client, struct host1x_job *job)
+{
+	struct host1x_fence fence;
+	int err;
+
+	err = host1x_client_submit_async(client, job, &fence);
+	if (err < 0)
+		return err;
+
+	return host1x_fence_wait(&fence, -1);
+}
+
+/*
+ * Returns 1 if the fence has been signaled, 0 if it is still pending or a
+ * negative error code if the syncpoint could not be read.
+ */
+int host1x_fence_query(struct host1x_fence *fence)
+{
+	struct host1x_client *client = fence->client;
+	struct host1x_syncpt *syncpt;
+	uint32_t value;
+	int err;
+
+	if (!client)
+		return 1;
+
+	/* fences that are known to have passed don't need a syscall */
+	syncpt = host1x_client_find_syncpt(client, fence->syncpt);
+	if (syncpt && host1x_syncpt_expired(syncpt, fence->value))
+		return 1;
+
+	err = client->read_syncpt(client, fence->syncpt, &value);
+	if (err < 0)
+		return err;
+
+	if (syncpt)
+		host1x_syncpt_update(syncpt, value);
+
+	return host1x_syncpt_passed(value, fence->value);
+}
+
+int host1x_fence_wait(struct host1x_fence *fence, uint32_t timeout)
+{
+	struct host1x_client *client = fence->client;
+	int err;
+
+	err = host1x_fence_query(fence);
+	if (err != 0)
+		return err < 0 ? err : 0;
+
+	if (timeout == 0)
+		return -ETIMEDOUT;
+
+	err = client->wait(client, fence->syncpt, fence->value, timeout);
+	if (err == -EAGAIN)
+		return -ETIMEDOUT;
+
+	return err;
+}
+
+/* pending fences are polled at this interval while waiting for any of them */
+#define HOST1X_FENCE_POLL_INTERVAL 1
+
+static uint32_t host1x_fence_elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static uint32_t host1x_fence_remaining(struct timespec *start,
+				       uint32_t timeout)
+{
+	uint32_t elapsed;
+
+	if (timeout == ~0u)
+		return timeout;
+
+	elapsed = host1x_fence_elapsed(start);
+	if (elapsed >= timeout)
+		return 0;
+
+	return timeout - elapsed;
+}
+
+int host1x_fence_wait_any(struct host1x_fence *fences, unsigned int count,
+			  uint32_t timeout, unsigned int *index)
+{
+	unsigned int i, next = 0;
+	struct timespec start;
+	uint32_t remaining;
+	int err;
+
+	if (count == 0)
+		return -EINVAL;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (true) {
+		for (i = 0; i < count; i++) {
+			err = host1x_fence_query(&fences[i]);
+			if (err < 0)
+				return err;
+
+			if (err > 0) {
+				if (index)
+					*index = i;
+
+				return 0;
+			}
+		}
+
+		remaining = host1x_fence_remaining(&start, timeout);
+		if (remaining == 0)
+			return -ETIMEDOUT;
+
+		if (remaining > HOST1X_FENCE_POLL_INTERVAL)
+			remaining = HOST1X_FENCE_POLL_INTERVAL;
+
+		/*
+		 * Sleep on one of the fences at a time, the others will be
+		 * picked up by the next round of queries.
+		 */
+		err = host1x_fence_wait(&fences[next], remaining);
+		if (err < 0 && err != -ETIMEDOUT)
+			return err;
+
+		next = (next + 1) % count;
+	}
+}
+
+int host1x_fence_wait_all(struct host1x_fence *fences, unsigned int count,
+			  uint32_t timeout)
+{
+	struct timespec start;
+	unsigned int i;
+	int err;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < count; i++) {
+		err = host1x_fence_wait(&fences[i],
+					host1x_fence_remaining(&start, timeout));
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
 }
@@ -51,6 +51,7 @@ struct nvhost_gr2d *nvhost_gr2d_open(struct nvhost *nvhost)
 		return NULL;
 	}
 
+	gr2d->client.base.class = HOST1X_CLASS_GR2D;
 	gr2d->base.client = &gr2d->client.base;
 
 	err = host1x_gr2d_init(&nvhost->base, &gr2d->base);
@@ -51,6 +51,7 @@ struct nvhost_gr3d *nvhost_gr3d_open(struct nvhost *nvhost)
 		return NULL;
 	}
 
+	gr3d->client.base.class = HOST1X_CLASS_GR3D;
 	gr3d->base.client = &gr3d->client.base;
 
 	err = host1x_gr3d_init(&nvhost->base, &gr3d->base);
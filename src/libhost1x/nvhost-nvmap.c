@@ -157,6 +157,63 @@ struct nvmap_handle *nvmap_handle_create(struct nvmap *nvmap, size_t size)
 	return handle;
 }
 
+#define NVMAP_HANDLE_PARAM_SIZE 1
+
+struct nvmap_handle *nvmap_handle_from_id(struct nvmap *nvmap, uint32_t id)
+{
+	struct nvmap_create_handle args;
+	struct nvmap_handle_param param;
+	struct nvmap_handle *handle;
+	int err;
+
+	handle = calloc(1, sizeof(*handle));
+	if (!handle)
+		return NULL;
+
+	memset(&args, 0, sizeof(args));
+	args.id = id;
+
+	err = ioctl(nvmap->fd, NVMAP_IOCTL_FROM_ID, &args);
+	if (err < 0) {
+		free(handle);
+		return NULL;
+	}
+
+	handle->id = args.handle;
+
+	memset(&param, 0, sizeof(param));
+	param.handle = handle->id;
+	param.param = NVMAP_HANDLE_PARAM_SIZE;
+
+	err = ioctl(nvmap->fd, NVMAP_IOCTL_PARAM, &param);
+	if (err < 0) {
+		nvmap_handle_free(nvmap, handle);
+		return NULL;
+	}
+
+	handle->size = param.result;
+
+	return handle;
+}
+
+int nvmap_handle_get_id(struct nvmap *nvmap, struct nvmap_handle *handle,
+			uint32_t *id)
+{
+	struct nvmap_create_handle args;
+	int err;
+
+	memset(&args, 0, sizeof(args));
+	args.handle = handle->id;
+
+	err = ioctl(nvmap->fd, NVMAP_IOCTL_GET_ID, &args);
+	if (err < 0)
+		return -errno;
+
+	*id = args.id;
+
+	return 0;
+}
+
 void nvmap_handle_free(struct nvmap *nvmap, struct nvmap_handle *handle)
 {
 	int err;
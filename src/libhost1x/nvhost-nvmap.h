@@ -47,6 +47,9 @@ nvmap_handle_get_offset(struct nvmap_handle *handle, void *ptr)
 }
 
 struct nvmap_handle *nvmap_handle_create(struct nvmap *nvmap, size_t size);
+struct nvmap_handle *nvmap_handle_from_id(struct nvmap *nvmap, uint32_t id);
+int nvmap_handle_get_id(struct nvmap *nvmap, struct nvmap_handle *handle,
+			uint32_t *id);
 void nvmap_handle_free(struct nvmap *nvmap, struct nvmap_handle *handle);
 int nvmap_handle_alloc(struct nvmap *nvmap, struct nvmap_handle *handle,
 		       unsigned long heap_mask, unsigned long flags,
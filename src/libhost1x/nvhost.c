@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -53,6 +54,18 @@ struct nvhost_ctrl_syncpt_waitex_args {
 	uint32_t value;
 };
 
+struct nvhost_ctrl_sync_fence_info {
+	uint32_t id;
+	uint32_t thresh;
+};
+
+struct nvhost_ctrl_sync_fence_create_args {
+	uint32_t num_pts;
+	uint64_t pts;
+	uint64_t name;
+	int32_t fence_fd;
+};
+
 #define NVHOST_IOCTL_MAGIC 'H'
 
 #define NVHOST_IOCTL_CTRL_SYNCPT_READ _IOWR(NVHOST_IOCTL_MAGIC, 1, struct nvhost_ctrl_syncpt_read_args)
@@ -60,6 +73,7 @@ struct nvhost_ctrl_syncpt_waitex_args {
 #define NVHOST_IOCTL_CTRL_SYNCPT_WAIT _IOW(NVHOST_IOCTL_MAGIC, 3, struct nvhost_ctrl_syncpt_wait_args)
 #define NVHOST_IOCTL_CTRL_SYNCPT_WAITEX _IOWR(NVHOST_IOCTL_MAGIC, 6, struct nvhost_ctrl_syncpt_waitex_args)
 #define NVHOST_IOCTL_CTRL_GET_VERSION _IOR(NVHOST_IOCTL_MAGIC, 7, struct nvhost_get_param_args)
+#define NVHOST_IOCTL_CTRL_SYNC_FENCE_CREATE _IOWR(NVHOST_IOCTL_MAGIC, 11, struct nvhost_ctrl_sync_fence_create_args)
 
 struct nvhost_ctrl *nvhost_ctrl_open(void)
 {
@@ -149,6 +163,7 @@ static int nvhost_client_syncpt_init(struct nvhost_client *client)
 	struct nvhost_get_param_args args;
 	struct host1x_syncpt *syncpt;
 	unsigned int i, j;
+	uint32_t value;
 	int err;
 
 	memset(&args, 0, sizeof(args));
@@ -172,14 +187,16 @@ static int nvhost_client_syncpt_init(struct nvhost_client *client)
 			syncpt = &base->syncpts[j++];
 			syncpt->id = i;
 
-			err = nvhost_ctrl_read_syncpt(ctrl, i, &syncpt->value);
+			err = nvhost_ctrl_read_syncpt(ctrl, i, &value);
 			if (err < 0) {
 				fprintf(stderr, "failed to read syncpt: %d\n",
 					err);
 				continue;
 			}
 
-			//printf("  %u: %u\n", i, syncpt->value);
+			atomic_init(&syncpt->value, value);
+
+			//printf("  %u: %u\n", i, value);
 		}
 	}
 
@@ -203,27 +220,130 @@ struct nvhost_reloc_shift {
 	uint32_t shift;
 };
 
+struct nvhost_waitchk {
+	uint32_t mem;
+	uint32_t offset;
+	uint32_t syncpt_id;
+	uint32_t thresh;
+};
+
+/* grows the payload buffer geometrically so that it can hold size bytes */
+static int nvhost_client_reserve(struct nvhost_client *client, size_t size)
+{
+	size_t max = client->max_payload;
+	void *payload;
+
+	if (client->payload && size <= max)
+		return 0;
+
+	while (max < size || max == 0)
+		max = max * 2 + 4096;
+
+	payload = realloc(client->payload, max);
+	if (!payload)
+		return -ENOMEM;
+
+	client->max_payload = max;
+	client->payload = payload;
+
+	return 0;
+}
+
+static int nvhost_write(int fd, const void *buffer, size_t size)
+{
+	ssize_t err;
+
+	while (size > 0) {
+		err = write(fd, buffer, size);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -errno;
+		}
+
+		if (err == 0)
+			return -EIO;
+
+		buffer += err;
+		size -= err;
+	}
+
+	return 0;
+}
+
+/*
+ * After the submit header the kernel parses the command buffers, the
+ * relocations, the wait checks and the relocation shifts from the channel's
+ * write stream in that order, so all of them are serialized into a single
+ * buffer that is passed to one write() call.
+ */
 static int nvhost_client_submit(struct host1x_client *client,
 				struct host1x_job *job)
 {
 	struct nvhost_client *nvhost = to_nvhost_client(client);
+	struct nvhost_reloc_shift *shifts;
 	struct nvhost_submit_hdr_ext args;
+	struct nvhost_waitchk *waitchks;
+	struct nvhost_cmdbuf *cmdbufs;
+	struct nvhost_reloc *relocs;
 	unsigned long num_relocs = 0;
-	unsigned int i, j;
+	uint32_t waitchk_mask = 0;
+	unsigned int i, j, k = 0;
+	size_t size;
 	int err;
 
 	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pb = &job->pushbufs[i];
+		struct host1x_pushbuf *pb = job->pushbufs[i];
+
+		num_relocs += pb->num_relocs;
+	}
+
+	size = job->num_pushbufs * sizeof(*cmdbufs) +
+	       num_relocs * (sizeof(*relocs) + sizeof(*shifts)) +
+	       job->num_waitchks * sizeof(*waitchks);
+
+	err = nvhost_client_reserve(nvhost, size);
+	if (err < 0)
+		return err;
+
+	cmdbufs = nvhost->payload;
+	relocs = (struct nvhost_reloc *)&cmdbufs[job->num_pushbufs];
+	waitchks = (struct nvhost_waitchk *)&relocs[num_relocs];
+	shifts = (struct nvhost_reloc_shift *)&waitchks[job->num_waitchks];
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		struct host1x_pushbuf *pb = job->pushbufs[i];
 		struct nvhost_bo *bo = to_nvhost_bo(pb->bo);
-		struct nvmap_handle *handle = bo->handle;
-		unsigned long length = pb->length * 4;
 
-		err = nvmap_handle_writeback_invalidate(nvhost->nvmap, handle,
-							pb->offset, length);
-		if (err < 0) {
+		cmdbufs[i].mem = bo->handle->id;
+		cmdbufs[i].offset = pb->offset;
+		cmdbufs[i].words = pb->length;
+
+		for (j = 0; j < pb->num_relocs; j++, k++) {
+			struct host1x_pushbuf_reloc *r = &pb->relocs[j];
+
+			relocs[k].cmdbuf_mem = bo->handle->id;
+			relocs[k].cmdbuf_offset = r->source_offset;
+			relocs[k].target_mem = r->target_handle;
+			relocs[k].target_offset = r->target_offset;
+			shifts[k].shift = r->shift;
 		}
+	}
 
-		num_relocs += pb->num_relocs;
+	for (i = 0; i < job->num_waitchks; i++) {
+		struct host1x_job_waitchk *w = &job->waitchks[i];
+		struct nvhost_bo *bo = to_nvhost_bo(w->bo);
+
+		/* the kernel takes a 32-bit mask of the waited for syncpoints */
+		if (w->syncpt >= 32)
+			return -EINVAL;
+
+		waitchks[i].mem = bo->handle->id;
+		waitchks[i].offset = w->offset;
+		waitchks[i].syncpt_id = w->syncpt;
+		waitchks[i].thresh = w->thresh;
+		waitchk_mask |= 1u << w->syncpt;
 	}
 
 	memset(&args, 0, sizeof(args));
@@ -232,9 +352,8 @@ static int nvhost_client_submit(struct host1x_client *client,
 	args.num_cmdbufs = job->num_pushbufs;
 	args.num_relocs = num_relocs;
 	args.submit_version = 2;
-	/* XXX: implement wait checks */
-	args.num_waitchks = 0;
-	args.waitchk_mask = 0;
+	args.num_waitchks = job->num_waitchks;
+	args.waitchk_mask = waitchk_mask;
 
 	err = ioctl(nvhost->fd, NVHOST_IOCTL_CHANNEL_SUBMIT_EXT, &args);
 	if (err < 0) {
@@ -243,55 +362,10 @@ static int nvhost_client_submit(struct host1x_client *client,
 		return -errno;
 	}
 
-	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pb = &job->pushbufs[i];
-		struct nvhost_bo *bo = to_nvhost_bo(pb->bo);
-		struct nvhost_cmdbuf cmdbuf;
-
-		memset(&cmdbuf, 0, sizeof(cmdbuf));
-		cmdbuf.mem = bo->handle->id;
-		cmdbuf.offset = pb->offset;
-		cmdbuf.words = pb->length;
-
-		err = write(nvhost->fd, &cmdbuf, sizeof(cmdbuf));
-		if (err < 0) {
-		}
-	}
-
-	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pb = &job->pushbufs[i];
-
-		for (j = 0; j < pb->num_relocs; j++) {
-			struct host1x_pushbuf_reloc *r = &pb->relocs[j];
-			struct nvhost_bo *bo = to_nvhost_bo(pb->bo);
-			struct nvhost_reloc reloc;
-
-			memset(&reloc, 0, sizeof(reloc));
-			reloc.cmdbuf_mem = bo->handle->id;
-			reloc.cmdbuf_offset = r->source_offset;
-			reloc.target_mem = r->target_handle;
-			reloc.target_offset = r->target_offset;
-
-			err = write(nvhost->fd, &reloc, sizeof(reloc));
-			if (err < 0) {
-			}
-		}
-	}
-
-	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pb = &job->pushbufs[i];
-
-		for (j = 0; j < pb->num_relocs; j++) {
-			struct host1x_pushbuf_reloc *reloc = &pb->relocs[j];
-			struct nvhost_reloc_shift shift;
-
-			memset(&shift, 0, sizeof(shift));
-			shift.shift = reloc->shift;
-
-			err = write(nvhost->fd, &shift, sizeof(shift));
-			if (err < 0) {
-			}
-		}
+	err = nvhost_write(nvhost->fd, nvhost->payload, size);
+	if (err < 0) {
+		fprintf(stderr, "failed to write submission: %d\n", err);
+		return err;
 	}
 
 	return 0;
@@ -312,16 +386,19 @@ static int nvhost_client_flush(struct host1x_client *client, uint32_t *fencep)
 	return 0;
 }
 
-static int nvhost_client_wait(struct host1x_client *client, uint32_t fence,
-			      uint32_t timeout)
+static int nvhost_client_wait(struct host1x_client *client, uint32_t id,
+			      uint32_t fence, uint32_t timeout)
 {
+	struct host1x_syncpt *syncpt = host1x_client_find_syncpt(client, id);
 	struct nvhost_client *nvhost = to_nvhost_client(client);
-	struct host1x_syncpt *syncpt = &client->syncpts[0];
 	struct nvhost_ctrl_syncpt_waitex_args args;
 	int err;
 
+	if (syncpt && host1x_syncpt_expired(syncpt, fence))
+		return 0;
+
 	memset(&args, 0, sizeof(args));
-	args.id = syncpt->id;
+	args.id = id;
 	args.thresh = fence;
 	args.timeout = timeout;
 
@@ -329,6 +406,9 @@ static int nvhost_client_wait(struct host1x_client *client, uint32_t fence,
 	if (err < 0)
 		return -errno;
 
+	if (syncpt)
+		host1x_syncpt_update(syncpt, args.value);
+
 	if (args.value != args.thresh)
 		fprintf(stderr, "syncpt %u: value:%u != thresh:%u\n",
 			args.id, args.value, args.thresh);
@@ -336,6 +416,54 @@ static int nvhost_client_wait(struct host1x_client *client, uint32_t fence,
 	return 0;
 }
 
+static int nvhost_client_read_syncpt(struct host1x_client *client,
+				     uint32_t syncpt, uint32_t *value)
+{
+	struct nvhost_client *nvhost = to_nvhost_client(client);
+
+	return nvhost_ctrl_read_syncpt(nvhost->ctrl, syncpt, value);
+}
+
+/*
+ * Kernels with Android sync support can turn syncpoint thresholds into a
+ * sync fence file descriptor. Older kernels fail with -ENOTTY.
+ */
+static int nvhost_client_export_fence(struct host1x_client *client,
+				      struct host1x_fence *fences,
+				      unsigned int count, int *fd)
+{
+	struct nvhost_client *nvhost = to_nvhost_client(client);
+	struct nvhost_ctrl_sync_fence_create_args args;
+	struct nvhost_ctrl_sync_fence_info *pts;
+	unsigned int i;
+	int err;
+
+	pts = calloc(count, sizeof(*pts));
+	if (!pts)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		pts[i].id = fences[i].syncpt;
+		pts[i].thresh = fences[i].value;
+	}
+
+	memset(&args, 0, sizeof(args));
+	args.num_pts = count;
+	args.pts = (uintptr_t)pts;
+	args.name = (uintptr_t)"host1x";
+
+	err = ioctl(nvhost->ctrl->fd, NVHOST_IOCTL_CTRL_SYNC_FENCE_CREATE,
+		    &args);
+	free(pts);
+
+	if (err < 0)
+		return -errno;
+
+	*fd = args.fence_fd;
+
+	return 0;
+}
+
 int nvhost_client_init(struct nvhost_client *client, struct nvmap *nvmap,
 		       struct nvhost_ctrl *ctrl, int fd)
 {
@@ -369,11 +497,14 @@ int nvhost_client_init(struct nvhost_client *client, struct nvmap *nvmap,
 	client->base.submit = nvhost_client_submit;
 	client->base.flush = nvhost_client_flush;
 	client->base.wait = nvhost_client_wait;
+	client->base.read_syncpt = nvhost_client_read_syncpt;
+	client->base.export_fence = nvhost_client_export_fence;
 
 	return 0;
 }
 
 void nvhost_client_exit(struct nvhost_client *client)
 {
+	free(client->payload);
 	close(client->fd);
 }
@@ -51,6 +51,10 @@ struct nvhost_client {
 	struct nvhost_ctrl *ctrl;
 	struct nvmap *nvmap;
 	int fd;
+
+	/* data written after each submit header, reused across submits */
+	void *payload;
+	size_t max_payload;
 };
 
 static inline struct nvhost_client *to_nvhost_client(struct host1x_client *client)
@@ -139,19 +139,38 @@ void host1x_stream_dump(struct host1x_stream *stream, FILE *fp)
 			break;
 
 		case HOST1X_OPCODE_RESTART:
-			fprintf(fp, "HOST1X_OPCODE_RESTART\n");
+			fprintf(fp, "HOST1X_OPCODE_RESTART 0x%08x\n",
+				(*stream->ptr & 0x0fffffff) << 4);
+			stream->ptr++;
 			break;
 
 		case HOST1X_OPCODE_GATHER:
-			fprintf(fp, "HOST1X_OPCODE_GATHER\n");
+			offset = (*stream->ptr >> 16) & 0xfff;
+			count = *stream->ptr & 0x3fff;
+
+			fprintf(fp, "HOST1X_OPCODE_GATHER  0x%03x, 0x%04x%s%s\n",
+				offset, count,
+				(*stream->ptr & BIT(15)) ? " insert" : "",
+				(*stream->ptr & BIT(14)) ? " incr" : "");
+
+			stream->ptr++;
+
+			/* the base address of the gathered words follows */
+			if (stream->ptr < stream->end)
+				fprintf(fp, "      0x%08x\n", *stream->ptr++);
+
 			break;
 
 		case HOST1X_OPCODE_EXTEND:
-			fprintf(fp, "HOST1X_OPCODE_EXTEND\n");
+			fprintf(fp, "HOST1X_OPCODE_EXTEND  0x%x, 0x%06x\n",
+				(*stream->ptr >> 24) & 0xf,
+				*stream->ptr & 0xffffff);
+			stream->ptr++;
 			break;
 
 		case HOST1X_OPCODE_CHDONE:
 			fprintf(fp, "HOST1X_OPCODE_CHDONE\n");
+			stream->ptr++;
 			break;
 
 		default:
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Measures how long the GPU sits idle per frame in a fill-bound scene that
+ * is cleared on gr2d and then covered by several layers of full-screen
+ * quads on gr3d. The time that each engine takes on its own is measured
+ * first, and any frame time beyond that of the busier engine is counted as
+ * idle. Frames are then rendered once with the CPU waiting after each step
+ * and once with the frame scheduler of pipelined framebuffers, which clears
+ * the next back buffer on gr2d while gr3d is drawing. Run without --vsync
+ * so that the display doesn't limit the frame rate.
+ */
+
+#include <string.h>
+
+#include "grate.h"
+
+#define NUM_FRAMES 300
+#define NUM_LAYERS 8
+
+static const char *vertex_shader[] = {
+	"attribute vec4 position;\n",
+	"attribute vec4 color;\n",
+	"varying vec4 vcolor;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_Position = position;\n",
+	"    vcolor = color;\n",
+	"}"
+};
+
+static const char *fragment_shader[] = {
+	"precision mediump float;\n",
+	"varying vec4 vcolor;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = vcolor;\n",
+	"}"
+};
+
+static const float vertices[] = {
+	-1.0f, -1.0f, 0.0f, 1.0f,
+	 1.0f, -1.0f, 0.0f, 1.0f,
+	 1.0f,  1.0f, 0.0f, 1.0f,
+	-1.0f,  1.0f, 0.0f, 1.0f,
+};
+
+static const float colors[] = {
+	1.0f, 0.0f, 0.0f, 0.5f,
+	0.0f, 1.0f, 0.0f, 0.5f,
+	0.0f, 0.0f, 1.0f, 0.5f,
+	1.0f, 1.0f, 0.0f, 0.5f,
+};
+
+static const unsigned short indices[] = {
+	0, 1, 2,
+	0, 2, 3,
+};
+
+enum mode {
+	MODE_CLEAR,
+	MODE_DRAW,
+	MODE_SERIAL,
+	MODE_PIPELINED,
+};
+
+/* renders NUM_FRAMES frames and returns the time per frame in milliseconds */
+static double run(struct grate *grate, struct grate_framebuffer *fb,
+		  enum mode mode, struct grate_bo *bo, unsigned long offset)
+{
+	struct grate_profile *profile;
+	unsigned int i, j;
+	double time;
+
+	grate_bind_framebuffer(grate, fb);
+
+	profile = grate_profile_start(grate);
+	if (!profile)
+		return 0.0;
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		if (mode != MODE_DRAW) {
+			grate_clear(grate);
+
+			if (mode != MODE_PIPELINED)
+				grate_flush(grate);
+		}
+
+		if (mode != MODE_CLEAR) {
+			for (j = 0; j < NUM_LAYERS; j++)
+				grate_draw_elements(grate, GRATE_TRIANGLES, 2,
+						    6, bo, offset);
+
+			if (mode != MODE_PIPELINED)
+				grate_flush(grate);
+		}
+
+		grate_swap_buffers(grate);
+	}
+
+	grate_flush(grate);
+
+	time = grate_profile_get_time(profile);
+	grate_profile_free(profile);
+
+	return time * 1000 / NUM_FRAMES;
+}
+
+static void report(const char *name, double frame, double busy)
+{
+	printf("%-9s %8.3f ms/frame %8.3f ms idle/frame\n", name, frame,
+	       frame > busy ? frame - busy : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct grate_framebuffer *fb, *pipelined;
+	double clear, draw, busy, frame;
+	struct grate_program *program;
+	struct grate_shader *vs, *fs;
+	struct grate_options options;
+	unsigned long offset = 0;
+	struct grate *grate;
+	struct grate_bo *bo;
+	void *buffer;
+	int location;
+
+	if (!grate_parse_command_line(&options, argc, argv))
+		return 1;
+
+	grate = grate_init(&options);
+	if (!grate)
+		return 1;
+
+	bo = grate_bo_create(grate, 4096, 0);
+	if (!bo) {
+		grate_exit(grate);
+		return 1;
+	}
+
+	buffer = grate_bo_map(bo);
+	if (!buffer) {
+		grate_bo_free(bo);
+		grate_exit(grate);
+		return 1;
+	}
+
+	fb = grate_framebuffer_create(grate, options.width, options.height,
+				      options.format, GRATE_TRIPLE_BUFFERED);
+	pipelined = grate_framebuffer_create(grate, options.width,
+					     options.height, options.format,
+					     GRATE_TRIPLE_BUFFERED |
+					     GRATE_PIPELINED);
+	if (!fb || !pipelined) {
+		fprintf(stderr, "grate_framebuffer_create() failed\n");
+		return 1;
+	}
+
+	grate_clear_color(grate, 0.0f, 0.0f, 0.0f, 1.0f);
+
+	vs = grate_shader_new(grate, GRATE_SHADER_VERTEX, vertex_shader,
+			      ARRAY_SIZE(vertex_shader));
+	fs = grate_shader_new(grate, GRATE_SHADER_FRAGMENT, fragment_shader,
+			      ARRAY_SIZE(fragment_shader));
+	if (!vs || !fs) {
+		fprintf(stderr, "failed to compile shaders\n");
+		return 1;
+	}
+
+	program = grate_program_new(grate, vs, fs);
+	if (!program) {
+		fprintf(stderr, "grate_program_new() failed\n");
+		return 1;
+	}
+
+	grate_program_link(program);
+
+	grate_viewport(grate, 0.0f, 0.0f, options.width, options.height);
+	grate_use_program(grate, program);
+
+	location = grate_get_attribute_location(grate, "position");
+	if (location < 0) {
+		fprintf(stderr, "\"position\": attribute not found\n");
+		return 1;
+	}
+
+	memcpy(buffer + offset, vertices, sizeof(vertices));
+	grate_attribute_pointer(grate, location, sizeof(float), 4, 4, bo,
+				offset);
+	offset += sizeof(vertices);
+
+	location = grate_get_attribute_location(grate, "color");
+	if (location < 0) {
+		fprintf(stderr, "\"color\": attribute not found\n");
+		return 1;
+	}
+
+	memcpy(buffer + offset, colors, sizeof(colors));
+	grate_attribute_pointer(grate, location, sizeof(float), 4, 4, bo,
+				offset);
+	offset += sizeof(colors);
+
+	memcpy(buffer + offset, indices, sizeof(indices));
+
+	clear = run(grate, fb, MODE_CLEAR, bo, offset);
+	draw = run(grate, fb, MODE_DRAW, bo, offset);
+	busy = clear > draw ? clear : draw;
+
+	printf("%-9s %8.3f ms/frame\n", "clear", clear);
+	printf("%-9s %8.3f ms/frame\n", "draw", draw);
+
+	frame = run(grate, fb, MODE_SERIAL, bo, offset);
+	report("serial", frame, busy);
+
+	frame = run(grate, pipelined, MODE_PIPELINED, bo, offset);
+	report("pipelined", frame, busy);
+
+	grate_exit(grate);
+	return 0;
+}
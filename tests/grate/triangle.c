@@ -97,7 +97,7 @@ int main(int argc, char *argv[])
 	}
 
 	fb = grate_framebuffer_create(grate, options.width, options.height,
-				      GRATE_RGBA8888, GRATE_DOUBLE_BUFFERED);
+				      options.format, GRATE_DOUBLE_BUFFERED);
 	if (!fb)
 		return 1;
 
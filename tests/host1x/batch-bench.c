@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Compares the number of kernel submissions needed to render a frame made
+ * up of many small draws, once with a job per draw and once with all draws
+ * of a frame collected in a batch. The channel is faked, so this measures
+ * the submission count and the CPU overhead of building the jobs only.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host1x.h"
+#include "common.h"
+
+#define NUM_FRAMES 1000
+#define NUM_DRAWS 64
+#define NUM_WORDS 128
+
+static int emit_draw(struct host1x_pushbuf *pb, uint32_t syncpt)
+{
+	unsigned int i;
+	int err;
+
+	err = host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x100, NUM_WORDS - 3));
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < NUM_WORDS - 3; i++) {
+		err = host1x_pushbuf_push(pb, i);
+		if (err < 0)
+			return err;
+	}
+
+	err = host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 1));
+	if (err < 0)
+		return err;
+
+	return host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt);
+}
+
+int main(int argc, char *argv[])
+{
+	struct host1x host1x = { .bo_create = fake_bo_create };
+	struct timespec start, end;
+	struct host1x_fence fence;
+	struct fake_client fake;
+	struct host1x_batch *batch;
+	struct host1x_pushbuf *pb;
+	struct host1x_ring *ring;
+	struct host1x_job *job;
+	unsigned int i, j;
+	int err;
+
+	fake_client_init(&fake, 1);
+	host1x_bo_cache_init(&host1x.bo_cache);
+
+	ring = host1x_ring_create(&host1x, 4, 32 * 4096);
+	if (!ring) {
+		fprintf(stderr, "host1x_ring_create() failed\n");
+		return 1;
+	}
+
+	job = host1x_job_create(fake.syncpt.id);
+	if (!job) {
+		fprintf(stderr, "host1x_job_create() failed\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		for (j = 0; j < NUM_DRAWS; j++) {
+			host1x_job_reset(job);
+
+			pb = host1x_job_append_ring(job, ring);
+			if (!pb) {
+				fprintf(stderr, "host1x_job_append_ring() failed\n");
+				return 1;
+			}
+
+			err = emit_draw(pb, fake.syncpt.id);
+			if (err < 0) {
+				fprintf(stderr, "emit_draw() failed: %d\n", err);
+				return 1;
+			}
+
+			err = host1x_client_submit_async(&fake.base, job,
+							 &fence);
+			if (err < 0) {
+				fprintf(stderr, "host1x_client_submit_async() failed: %d\n",
+					err);
+				return 1;
+			}
+		}
+
+		host1x_fence_wait(&fence, -1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report("job", fake.submits, "submits", NUM_FRAMES,
+	       timespec_diff(&start, &end));
+
+	host1x_job_free(job);
+
+	batch = host1x_batch_create(&fake.base, ring, 16384);
+	if (!batch) {
+		fprintf(stderr, "host1x_batch_create() failed\n");
+		return 1;
+	}
+
+	fake.submits = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		for (j = 0; j < NUM_DRAWS; j++) {
+			pb = host1x_batch_begin(batch);
+			if (!pb) {
+				fprintf(stderr, "host1x_batch_begin() failed\n");
+				return 1;
+			}
+
+			err = emit_draw(pb, fake.syncpt.id);
+			if (err < 0) {
+				fprintf(stderr, "emit_draw() failed: %d\n", err);
+				return 1;
+			}
+
+			err = host1x_batch_end(batch);
+			if (err < 0) {
+				fprintf(stderr, "host1x_batch_end() failed: %d\n",
+					err);
+				return 1;
+			}
+		}
+
+		err = host1x_batch_flush(batch, NULL);
+		if (err < 0) {
+			fprintf(stderr, "host1x_batch_flush() failed: %d\n", err);
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report("batch", fake.submits, "submits", NUM_FRAMES,
+	       timespec_diff(&start, &end));
+
+	host1x_batch_free(batch);
+	host1x_ring_free(ring);
+	host1x_bo_cache_exit(&host1x.bo_cache);
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Allocates and frees buffer objects through the cache, backed by plain
+ * memory, and checks which allocations are served from the cache.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host1x.h"
+#include "common.h"
+
+static unsigned int errors;
+
+static void expect_size(struct host1x_bo *bo, size_t size, const char *what)
+{
+	if (bo->size != size) {
+		fprintf(stderr, "%s: %zu bytes, expected %zu\n", what, bo->size,
+			size);
+		errors++;
+	}
+}
+
+static void expect_bo(struct host1x_bo *bo, struct host1x_bo *expected,
+		      bool same, const char *what)
+{
+	if ((bo == expected) != same) {
+		fprintf(stderr, "%s: buffer object was %s\n", what,
+			same ? "not reused" : "reused");
+		errors++;
+	}
+}
+
+static void expect_stats(struct host1x *host1x, unsigned long hits,
+			 unsigned long misses, unsigned long evictions,
+			 unsigned long num_bos, const char *what)
+{
+	struct host1x_bo_cache_stats stats;
+
+	host1x_get_bo_cache_stats(host1x, &stats);
+
+	if (stats.hits != hits || stats.misses != misses ||
+	    stats.evictions != evictions || stats.num_bos != num_bos) {
+		fprintf(stderr, "%s: %lu hits, %lu misses, %lu evictions, "
+			"%lu cached, expected %lu, %lu, %lu, %lu\n", what,
+			stats.hits, stats.misses, stats.evictions,
+			stats.num_bos, hits, misses, evictions, num_bos);
+		errors++;
+	}
+}
+
+static struct host1x_bo *bo_create(struct host1x *host1x, size_t size,
+				   unsigned long flags)
+{
+	struct host1x_bo *bo;
+
+	bo = host1x_bo_create(host1x, size, flags);
+	if (!bo) {
+		fprintf(stderr, "host1x_bo_create() failed\n");
+		exit(1);
+	}
+
+	return bo;
+}
+
+/* makes the buffer objects in the cache look like they were freed long ago */
+static void age(struct host1x *host1x)
+{
+	struct host1x_bo *bo;
+	unsigned int i;
+
+	for (i = 0; i < HOST1X_BO_CACHE_BUCKETS; i++)
+		for (bo = host1x->bo_cache.buckets[i].first; bo; bo = bo->next)
+			bo->freed -= 60;
+}
+
+int main(int argc, char *argv[])
+{
+	struct host1x host1x = { .bo_create = fake_bo_create };
+	struct host1x_bo *bo, *other, *small;
+	struct fake_client fake;
+
+	fake_client_init(&fake, 1);
+	host1x_bo_cache_init(&host1x.bo_cache);
+
+	/* misses are rounded up to the bucket size */
+	bo = bo_create(&host1x, 100, 0);
+	expect_size(bo, 4096, "smallest bucket");
+	host1x_bo_free(bo);
+
+	small = bo_create(&host1x, 5000, 0);
+	expect_size(small, 8192, "second bucket");
+	host1x_bo_free(small);
+
+	bo = bo_create(&host1x, (1 << 20) + 1, 0);
+	expect_size(bo, (1 << 20) + (1 << 18), "quarter step");
+	host1x_bo_free(bo);
+
+	expect_stats(&host1x, 0, 3, 0, 3, "rounding");
+
+	/* anything that fits into the bucket is served from it */
+	other = bo_create(&host1x, 6000, 0);
+	expect_size(other, 8192, "hit");
+	expect_bo(other, small, true, "hit");
+	expect_stats(&host1x, 1, 3, 0, 2, "hit");
+
+	/* but only with the same flags */
+	bo = bo_create(&host1x, 4096, 2);
+	expect_stats(&host1x, 1, 4, 0, 2, "different flags");
+	host1x_bo_free(bo);
+
+	/* buffer objects that are still in use aren't handed out */
+	other->fence.client = &fake.base;
+	other->fence.syncpt = fake.syncpt.id;
+	other->fence.value = 1;
+	host1x_bo_free(other);
+
+	bo = bo_create(&host1x, 8192, 0);
+	expect_bo(bo, other, false, "busy");
+	expect_stats(&host1x, 1, 5, 0, 4, "busy");
+	host1x_bo_free(bo);
+
+	/* idle ones come first, the fence is only queried once none is left */
+	bo = bo_create(&host1x, 8192, 0);
+	expect_bo(bo, other, false, "first idle");
+
+	fake.completed = 1;
+
+	small = bo_create(&host1x, 8192, 0);
+	expect_bo(small, other, true, "passed");
+
+	if (small->fence.client) {
+		fprintf(stderr, "fence of recycled buffer object not reset\n");
+		errors++;
+	}
+
+	expect_stats(&host1x, 3, 5, 0, 3, "passed");
+	host1x_bo_free(small);
+	host1x_bo_free(bo);
+
+	/* shared buffer objects and odd sizes bypass the cache */
+	bo = host1x.bo_create(&host1x, 4096, 0);
+	bo->host1x = &host1x;
+	bo->shared = true;
+	host1x_bo_free(bo);
+
+	bo = host1x.bo_create(&host1x, 5000, 0);
+	bo->host1x = &host1x;
+	host1x_bo_free(bo);
+
+	expect_stats(&host1x, 3, 5, 0, 5, "uncached");
+
+	/* buffer objects that haven't been used for a while are released */
+	age(&host1x);
+	bo = bo_create(&host1x, 4096, 2);
+	expect_stats(&host1x, 3, 6, 5, 0, "eviction");
+	host1x_bo_free(bo);
+
+	host1x_bo_cache_exit(&host1x.bo_cache);
+
+	printf("%u errors\n", errors);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+int fake_client_submit(struct host1x_client *client, struct host1x_job *job)
+{
+	struct fake_client *fake = to_fake_client(client);
+
+	fake->submitted += job->syncpt_incrs;
+	fake->submits++;
+
+	return 0;
+}
+
+static int fake_client_flush(struct host1x_client *client, uint32_t *fence)
+{
+	*fence = to_fake_client(client)->submitted;
+	return 0;
+}
+
+static int fake_client_wait(struct host1x_client *client, uint32_t syncpt,
+			    uint32_t fence, uint32_t timeout)
+{
+	if (syncpt != client->syncpts[0].id)
+		return -EINVAL;
+
+	to_fake_client(client)->completed = fence;
+	return 0;
+}
+
+static int fake_client_read_syncpt(struct host1x_client *client,
+				   uint32_t syncpt, uint32_t *value)
+{
+	*value = to_fake_client(client)->completed;
+	return 0;
+}
+
+void fake_client_init(struct fake_client *fake, uint32_t syncpt)
+{
+	memset(fake, 0, sizeof(*fake));
+	fake->syncpt.id = syncpt;
+	fake->base.syncpts = &fake->syncpt;
+	fake->base.num_syncpts = 1;
+	fake->base.submit = fake_client_submit;
+	fake->base.flush = fake_client_flush;
+	fake->base.wait = fake_client_wait;
+	fake->base.read_syncpt = fake_client_read_syncpt;
+}
+
+static int fake_bo_mmap(struct host1x_bo *bo)
+{
+	return 0;
+}
+
+static void fake_bo_free(struct host1x_bo *bo)
+{
+	free(bo->ptr);
+	free(bo);
+}
+
+struct host1x_bo *fake_bo_create(struct host1x *host1x, size_t size,
+				 unsigned long flags)
+{
+	struct host1x_bo *bo;
+
+	bo = calloc(1, sizeof(*bo));
+	if (!bo)
+		return NULL;
+
+	bo->ptr = malloc(size);
+	if (!bo->ptr) {
+		free(bo);
+		return NULL;
+	}
+
+	bo->size = size;
+	bo->mmap = fake_bo_mmap;
+	bo->free = fake_bo_free;
+
+	return bo;
+}
+
+double timespec_diff(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+	       (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+/* prints the count of something and the time that it took per frame */
+void report(const char *name, double count, const char *unit,
+	    unsigned long frames, double seconds)
+{
+	printf("%-8s %8.2f %s/frame %8.3f us/frame\n", name, count / frames,
+	       unit, seconds * 1000000 / frames);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef GRATE_TESTS_HOST1X_COMMON_H
+#define GRATE_TESTS_HOST1X_COMMON_H 1
+
+#include <stdint.h>
+#include <time.h>
+
+#include "host1x.h"
+#include "../../src/libhost1x/host1x-private.h"
+
+/*
+ * A channel that doesn't execute anything. Jobs complete as soon as they are
+ * waited for. Tests that need to look at the jobs override the callbacks.
+ */
+struct fake_client {
+	struct host1x_client base;
+	struct host1x_syncpt syncpt;
+	uint32_t submitted;
+	uint32_t completed;
+	unsigned long submits;
+};
+
+static inline struct fake_client *to_fake_client(struct host1x_client *client)
+{
+	return container_of(client, struct fake_client, base);
+}
+
+void fake_client_init(struct fake_client *fake, uint32_t syncpt);
+int fake_client_submit(struct host1x_client *client, struct host1x_job *job);
+
+/* buffer objects backed by plain memory, for use as host1x.bo_create */
+struct host1x_bo *fake_bo_create(struct host1x *host1x, size_t size,
+				 unsigned long flags);
+
+double timespec_diff(const struct timespec *start, const struct timespec *end);
+void report(const char *name, double count, const char *unit,
+	    unsigned long frames, double seconds);
+
+#endif
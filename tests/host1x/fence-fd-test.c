@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Turns a fence into a file descriptor and checks that the file descriptor
+ * only becomes readable once the fence has signaled. Use HOST1X_BACKEND=soft
+ * to run this without hardware.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "host1x.h"
+#include "../../src/libhost1x/host1x-private.h"
+
+static int increment(struct host1x_client *client, struct host1x_ring *ring)
+{
+	struct host1x_syncpt *syncpt = &client->syncpts[0];
+	struct host1x_fence fence;
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	int err;
+
+	job = host1x_job_create(syncpt->id);
+	if (!job)
+		return -ENOMEM;
+
+	pb = host1x_job_append_ring(job, ring);
+	if (!pb) {
+		host1x_job_free(job);
+		return -ENOMEM;
+	}
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0x000, client->class, 0x00));
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x0001));
+	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+
+	err = host1x_client_submit_async(client, job, &fence);
+	host1x_job_free(job);
+
+	return err;
+}
+
+static int readable(int fd, int timeout)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return poll(&pfd, 1, timeout);
+}
+
+int main(int argc, char *argv[])
+{
+	struct host1x_client *client;
+	struct host1x_fence fence;
+	struct host1x_ring *ring;
+	struct host1x *host1x;
+	unsigned int errors = 0;
+	uint32_t value;
+	int err, fd;
+
+	host1x = host1x_open();
+	if (!host1x) {
+		fprintf(stderr, "host1x_open() failed\n");
+		return 1;
+	}
+
+	client = host1x_get_client(host1x, 0x51);
+	if (!client) {
+		fprintf(stderr, "gr2d not available\n");
+		return 1;
+	}
+
+	ring = host1x_ring_create(host1x, 1, 4096);
+	if (!ring) {
+		fprintf(stderr, "host1x_ring_create() failed\n");
+		return 1;
+	}
+
+	err = client->read_syncpt(client, client->syncpts[0].id, &value);
+	if (err < 0) {
+		fprintf(stderr, "failed to read syncpoint: %d\n", err);
+		return 1;
+	}
+
+	/* a fence that signals with the next increment */
+	fence.client = client;
+	fence.syncpt = client->syncpts[0].id;
+	fence.value = value + 1;
+
+	err = host1x_fence_get_fd(host1x, &fence, 1, &fd);
+	if (err < 0) {
+		fprintf(stderr, "host1x_fence_get_fd() failed: %d\n", err);
+		return 1;
+	}
+
+	if (readable(fd, 10) != 0) {
+		fprintf(stderr, "pending fence is readable\n");
+		errors++;
+	}
+
+	err = increment(client, ring);
+	if (err < 0) {
+		fprintf(stderr, "failed to increment syncpoint: %d\n", err);
+		return 1;
+	}
+
+	if (readable(fd, 1000) != 1) {
+		fprintf(stderr, "signaled fence is not readable\n");
+		errors++;
+	}
+
+	close(fd);
+
+	/* signaled fences give a file descriptor that is readable right away */
+	err = host1x_fence_get_fd(host1x, &fence, 1, &fd);
+	if (err < 0) {
+		fprintf(stderr, "host1x_fence_get_fd() failed: %d\n", err);
+		return 1;
+	}
+
+	if (readable(fd, 0) != 1) {
+		fprintf(stderr, "signaled fence is not readable\n");
+		errors++;
+	}
+
+	close(fd);
+
+	host1x_ring_free(ring);
+	host1x_close(host1x);
+
+	printf("%u errors\n", errors);
+
+	return errors ? 1 : 0;
+}
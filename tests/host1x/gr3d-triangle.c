@@ -37,6 +37,7 @@ int main(int argc, char *argv[])
 	struct host1x_display *display = NULL;
 	struct host1x_overlay *overlay = NULL;
 	struct host1x_framebuffer *fb, *copy;
+	struct host1x_fence fences[2];
 	unsigned int width = 256;
 	unsigned int height = 256;
 	struct host1x_gr2d *gr2d;
@@ -96,24 +97,32 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	err = host1x_gr2d_clear(gr2d, fb, 0.0f, 0.0f, 0.0f, 1.0f);
+	err = host1x_gr2d_clear(gr2d, fb, 0.0f, 0.0f, 0.0f, 1.0f, NULL);
 	if (err < 0) {
 		fprintf(stderr, "host1x_gr2d_clear() failed: %d\n", err);
 		return 1;
 	}
 
-	err = host1x_gr3d_triangle(gr3d, fb);
+	/* the triangle and the clear of the copy can run concurrently */
+	err = host1x_gr3d_triangle(gr3d, fb, &fences[0]);
 	if (err < 0) {
 		fprintf(stderr, "host1x_gr3d_triangle() failed: %d\n", err);
 		return 1;
 	}
 
-	err = host1x_gr2d_clear(gr2d, copy, 1.0f, 1.0f, 0.0f, 1.0f);
+	err = host1x_gr2d_clear(gr2d, copy, 1.0f, 1.0f, 0.0f, 1.0f,
+				&fences[1]);
 	if (err < 0) {
 		fprintf(stderr, "host1x_gr2d_clear() failed: %d\n", err);
 		return 1;
 	}
 
+	err = host1x_fence_wait_all(fences, 2, -1);
+	if (err < 0) {
+		fprintf(stderr, "host1x_fence_wait_all() failed: %d\n", err);
+		return 1;
+	}
+
 	if (display) {
 		if (overlay) {
 			err = host1x_overlay_set(overlay, fb, 0, 0, width, height, false);
@@ -128,7 +137,8 @@ int main(int argc, char *argv[])
 			else
 				sleep(1);
 
-			err = host1x_gr2d_blit(gr2d, fb, copy, 0, 0, 0, 0, width, height);
+			err = host1x_gr2d_blit(gr2d, fb, copy, 0, 0, 0, 0, width, height,
+					       NULL);
 			if (err < 0)
 				fprintf(stderr, "host1x_gr2d_blit() failed: %d\n", err);
 			else
@@ -148,7 +158,8 @@ int main(int argc, char *argv[])
 			else
 				sleep(1);
 
-			err = host1x_gr2d_blit(gr2d, fb, copy, 0, 0, 0, 0, width, height);
+			err = host1x_gr2d_blit(gr2d, fb, copy, 0, 0, 0, 0, width, height,
+					       NULL);
 			if (err < 0)
 				fprintf(stderr, "host1x_gr2d_blit() failed: %d\n", err);
 			else
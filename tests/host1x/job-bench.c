@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Measures the allocator traffic caused by building one job per frame, once
+ * with a fresh job every frame and once with a single job that is recycled
+ * using host1x_job_reset(). No hardware is needed: the command stream goes
+ * to a buffer object backed by plain memory that is never submitted.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host1x.h"
+#include "../../src/libhost1x/host1x-private.h"
+
+#include "common.h"
+
+#define NUM_FRAMES 10000
+#define NUM_WORDS 1024
+#define NUM_RELOCS 16
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long num_allocs;
+
+void *malloc(size_t size)
+{
+	num_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	num_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	num_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+static int build_frame(struct host1x_job *job, struct host1x_bo *commands,
+		       struct host1x_bo *target)
+{
+	struct host1x_pushbuf *pb;
+	unsigned int i;
+	int err;
+
+	pb = host1x_job_append(job, commands, 0);
+	if (!pb)
+		return -ENOMEM;
+
+	for (i = 0; i < NUM_WORDS; i++) {
+		if (i % (NUM_WORDS / NUM_RELOCS) == 0) {
+			err = host1x_pushbuf_relocate(pb, target, 0, 0);
+			if (err < 0)
+				return err;
+		}
+
+		err = host1x_pushbuf_push(pb, 0xdeadbeef);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct host1x_bo commands, target;
+	struct timespec start, end;
+	struct host1x_job *job;
+	unsigned long allocs;
+	unsigned int i;
+	int err;
+
+	memset(&commands, 0, sizeof(commands));
+	commands.size = 32 * 4096;
+	commands.ptr = malloc(commands.size);
+
+	memset(&target, 0, sizeof(target));
+	target.size = 4096;
+	target.ptr = malloc(target.size);
+
+	if (!commands.ptr || !target.ptr) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	allocs = num_allocs;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		job = host1x_job_create(1);
+		if (!job) {
+			fprintf(stderr, "host1x_job_create() failed\n");
+			return 1;
+		}
+
+		err = build_frame(job, &commands, &target);
+		if (err < 0) {
+			fprintf(stderr, "build_frame() failed: %d\n", err);
+			return 1;
+		}
+
+		host1x_job_free(job);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report("create", num_allocs - allocs, "allocations", NUM_FRAMES,
+	       timespec_diff(&start, &end));
+
+	job = host1x_job_create(1);
+	if (!job) {
+		fprintf(stderr, "host1x_job_create() failed\n");
+		return 1;
+	}
+
+	allocs = num_allocs;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		host1x_job_reset(job);
+
+		err = build_frame(job, &commands, &target);
+		if (err < 0) {
+			fprintf(stderr, "build_frame() failed: %d\n", err);
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report("reset", num_allocs - allocs, "allocations", NUM_FRAMES,
+	       timespec_diff(&start, &end));
+
+	host1x_job_free(job);
+	free(target.ptr);
+	free(commands.ptr);
+
+	return 0;
+}
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Counts the system calls that it takes to submit a job to an nvhost
+ * channel and to wait for it. No hardware is needed: the channel and the
+ * control device are file descriptors that refer to /dev/null, and ioctl()
+ * and write() are intercepted for them. The fake channel checks the data
+ * written after each submit header against the sizes announced in it, and
+ * jobs complete as soon as they are submitted.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "host1x.h"
+#include "common.h"
+#include "../../src/libhost1x/nvhost.h"
+
+#define NUM_SUBMITS 10000
+#define NUM_PUSHBUFS 2
+#define NUM_WORDS 1024
+#define NUM_RELOCS 16
+
+struct fake_submit_hdr {
+	uint32_t syncpt_id;
+	uint32_t syncpt_incrs;
+	uint32_t num_cmdbufs;
+	uint32_t num_relocs;
+	uint32_t submit_version;
+	uint32_t num_waitchks;
+	uint32_t waitchk_mask;
+	uint32_t pad[5];
+};
+
+struct fake_syncpt_waitex {
+	uint32_t id;
+	uint32_t thresh;
+	uint32_t timeout;
+	uint32_t value;
+};
+
+#define FAKE_IOCTL_FLUSH _IOR('H', 1, uint32_t)
+#define FAKE_IOCTL_GET_SYNCPOINTS _IOR('H', 2, uint32_t)
+#define FAKE_IOCTL_SUBMIT_EXT _IOW('H', 7, struct fake_submit_hdr)
+#define FAKE_IOCTL_SYNCPT_READ _IOWR('H', 1, uint32_t[2])
+#define FAKE_IOCTL_SYNCPT_WAITEX _IOWR('H', 6, struct fake_syncpt_waitex)
+
+#define FAKE_SYNCPT 1
+
+/* sizes of struct nvhost_cmdbuf, nvhost_reloc plus shift and waitchk */
+#define FAKE_CMDBUF_SIZE 12
+#define FAKE_RELOC_SIZE (16 + 4)
+#define FAKE_WAITCHK_SIZE 16
+
+static struct {
+	int fd;
+	unsigned long ioctls;
+	unsigned long writes;
+	size_t expected;
+	size_t written;
+	bool error;
+} channel = {
+	.fd = -1,
+};
+
+static struct {
+	int fd;
+	unsigned long ioctls;
+	uint32_t syncpt;
+} ctrl = {
+	.fd = -1,
+	.syncpt = 42,
+};
+
+static int ctrl_ioctl(unsigned long request, void *arg)
+{
+	struct fake_syncpt_waitex *wait;
+	uint32_t *read;
+
+	ctrl.ioctls++;
+
+	switch (request) {
+	case FAKE_IOCTL_SYNCPT_READ:
+		read = arg;
+		read[1] = ctrl.syncpt;
+		return 0;
+
+	case FAKE_IOCTL_SYNCPT_WAITEX:
+		wait = arg;
+		wait->value = ctrl.syncpt;
+		return 0;
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct fake_submit_hdr *hdr;
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (fd >= 0 && fd == ctrl.fd)
+		return ctrl_ioctl(request, arg);
+
+	if (fd < 0 || fd != channel.fd)
+		return syscall(SYS_ioctl, fd, request, arg);
+
+	channel.ioctls++;
+
+	if (request == FAKE_IOCTL_GET_SYNCPOINTS) {
+		*(uint32_t *)arg = 1 << FAKE_SYNCPT;
+		return 0;
+	}
+
+	if (request == FAKE_IOCTL_FLUSH) {
+		*(uint32_t *)arg = ctrl.syncpt;
+		return 0;
+	}
+
+	if (request == FAKE_IOCTL_SUBMIT_EXT) {
+		/* the previous submission must have been written completely */
+		if (channel.written != channel.expected)
+			channel.error = true;
+
+		hdr = arg;
+
+		channel.expected = hdr->num_cmdbufs * FAKE_CMDBUF_SIZE +
+				   hdr->num_relocs * FAKE_RELOC_SIZE +
+				   hdr->num_waitchks * FAKE_WAITCHK_SIZE;
+		channel.written = 0;
+
+		ctrl.syncpt += hdr->syncpt_incrs;
+		return 0;
+	}
+
+	if (_IOC_DIR(request) & _IOC_READ)
+		memset(arg, 0, _IOC_SIZE(request));
+
+	return 0;
+}
+
+ssize_t write(int fd, const void *buffer, size_t size)
+{
+	if (fd < 0 || fd != channel.fd)
+		return syscall(SYS_write, fd, buffer, size);
+
+	channel.writes++;
+	channel.written += size;
+
+	if (channel.written > channel.expected)
+		channel.error = true;
+
+	return size;
+}
+
+static int build_job(struct host1x_job *job, struct host1x_bo *commands,
+		     struct host1x_bo *target)
+{
+	struct host1x_pushbuf *pb;
+	unsigned int i, j;
+	int err;
+
+	for (i = 0; i < NUM_PUSHBUFS; i++) {
+		pb = host1x_job_append(job, commands, i * NUM_WORDS * 4);
+		if (!pb)
+			return -ENOMEM;
+
+		for (j = 0; j < NUM_WORDS; j++) {
+			if (j % (NUM_WORDS / NUM_RELOCS) == 0) {
+				err = host1x_pushbuf_relocate(pb, target, 0, 0);
+				if (err < 0)
+					return err;
+			}
+
+			err = host1x_pushbuf_push(pb, 0xdeadbeef);
+			if (err < 0)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct nvmap_handle commands_handle, target_handle;
+	struct nvhost_bo commands, target;
+	struct nvhost_client client;
+	struct timespec start, end;
+	struct host1x_fence fence;
+	struct nvhost_ctrl nvctrl;
+	struct host1x_job *job;
+	struct nvmap nvmap;
+	unsigned long ioctls;
+	unsigned int i;
+	int err;
+
+	memset(&nvmap, 0, sizeof(nvmap));
+	nvmap.fd = -1;
+
+	ctrl.fd = open("/dev/null", O_RDWR);
+	channel.fd = open("/dev/null", O_RDWR);
+	if (ctrl.fd < 0 || channel.fd < 0) {
+		fprintf(stderr, "failed to open /dev/null: %d\n", errno);
+		return 1;
+	}
+
+	memset(&nvctrl, 0, sizeof(nvctrl));
+	nvctrl.fd = ctrl.fd;
+
+	memset(&client, 0, sizeof(client));
+
+	err = nvhost_client_init(&client, &nvmap, &nvctrl, channel.fd);
+	if (err < 0) {
+		fprintf(stderr, "nvhost_client_init() failed: %d\n", err);
+		return 1;
+	}
+
+	memset(&commands_handle, 0, sizeof(commands_handle));
+	commands_handle.size = NUM_PUSHBUFS * NUM_WORDS * 4;
+	commands_handle.id = 1;
+
+	memset(&commands, 0, sizeof(commands));
+	commands.base.size = commands_handle.size;
+	commands.base.ptr = malloc(commands.base.size);
+	commands.base.handle = commands_handle.id;
+	commands.handle = &commands_handle;
+
+	memset(&target_handle, 0, sizeof(target_handle));
+	target_handle.size = 4096;
+	target_handle.id = 2;
+
+	memset(&target, 0, sizeof(target));
+	target.base.size = target_handle.size;
+	target.base.ptr = malloc(target.base.size);
+	target.base.handle = target_handle.id;
+	target.handle = &target_handle;
+
+	if (!commands.base.ptr || !target.base.ptr) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	job = host1x_job_create(FAKE_SYNCPT);
+	if (!job) {
+		fprintf(stderr, "host1x_job_create() failed\n");
+		return 1;
+	}
+
+	err = build_job(job, &commands.base, &target.base);
+	if (err < 0) {
+		fprintf(stderr, "build_job() failed: %d\n", err);
+		return 1;
+	}
+
+	job->syncpt_incrs = 1;
+
+	channel.ioctls = 0;
+	channel.writes = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NUM_SUBMITS; i++) {
+		err = client.base.submit(&client.base, job);
+		if (err < 0) {
+			fprintf(stderr, "submit failed: %d\n", err);
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (channel.error || channel.written != channel.expected) {
+		fprintf(stderr, "submission data does not match header\n");
+		return 1;
+	}
+
+	printf("%u pushbufs, %u relocs: %.2f ioctls/submit %.2f writes/submit "
+	       "%.3f us/submit\n", NUM_PUSHBUFS, NUM_PUSHBUFS * NUM_RELOCS,
+	       (double)channel.ioctls / NUM_SUBMITS,
+	       (double)channel.writes / NUM_SUBMITS,
+	       timespec_diff(&start, &end) * 1000000 / NUM_SUBMITS);
+
+	/*
+	 * Only the first wait needs to ask the kernel, the others are known
+	 * to be satisfied from the value that it returned.
+	 */
+	err = client.base.flush(&client.base, &fence.value);
+	if (err < 0) {
+		fprintf(stderr, "flush failed: %d\n", err);
+		return 1;
+	}
+
+	fence.client = &client.base;
+	fence.syncpt = FAKE_SYNCPT;
+
+	ioctls = ctrl.ioctls;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NUM_SUBMITS; i++) {
+		err = host1x_fence_wait(&fence, ~0u);
+		if (err < 0) {
+			fprintf(stderr, "host1x_fence_wait() failed: %d\n",
+				err);
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("wait: %.4f ioctls/wait %.3f us/wait\n",
+	       (double)(ctrl.ioctls - ioctls) / NUM_SUBMITS,
+	       timespec_diff(&start, &end) * 1000000 / NUM_SUBMITS);
+
+	host1x_job_free(job);
+	nvhost_client_exit(&client);
+	free(target.base.ptr);
+	free(commands.base.ptr);
+	close(ctrl.fd);
+
+	return 0;
+}
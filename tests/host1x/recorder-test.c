@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Records jobs on several threads at once and submits them through a single
+ * queue, then checks that every syncpoint increment has reached the client.
+ * Use HOST1X_BACKEND=soft to run this without hardware.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "host1x.h"
+#include "../../src/libhost1x/host1x-private.h"
+
+#define NUM_THREADS 4
+#define NUM_JOBS 2000
+#define NUM_INCRS 4
+#define NUM_PADDING 256
+
+struct worker {
+	struct host1x_recorder *recorder;
+	uint32_t syncpt;
+	pthread_t thread;
+	int err;
+};
+
+static int record_job(struct worker *worker)
+{
+	struct host1x_pushbuf *pb;
+	unsigned int i;
+	int err;
+
+	pb = host1x_recorder_begin(worker->recorder);
+	if (!pb)
+		return -ENOMEM;
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0x000, 0x051, 0x00));
+
+	/* writes to a scratch register to give the job some weight */
+	for (i = 0; i < NUM_PADDING; i++)
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x009, i));
+
+	for (i = 0; i < NUM_INCRS; i++) {
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x0001));
+		err = host1x_pushbuf_push(pb, 0x000001 << 8 | worker->syncpt);
+		if (err < 0)
+			return err;
+	}
+
+	return host1x_recorder_end(worker->recorder);
+}
+
+static void *worker_thread(void *data)
+{
+	struct worker *worker = data;
+	unsigned int i;
+
+	for (i = 0; i < NUM_JOBS; i++) {
+		worker->err = record_job(worker);
+		if (worker->err < 0)
+			return NULL;
+	}
+
+	worker->err = host1x_recorder_flush(worker->recorder, NULL);
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct worker workers[NUM_THREADS];
+	struct timespec start, end;
+	struct host1x_client *client;
+	struct host1x_queue *queue;
+	uint32_t before, after;
+	struct host1x *host1x;
+	unsigned int i;
+	double elapsed;
+	int err;
+
+	host1x = host1x_open();
+	if (!host1x) {
+		fprintf(stderr, "host1x_open() failed\n");
+		return 1;
+	}
+
+	client = host1x_get_client(host1x, 0x51);
+	if (!client) {
+		fprintf(stderr, "gr2d not available\n");
+		return 1;
+	}
+
+	queue = host1x_queue_create(host1x);
+	if (!queue) {
+		fprintf(stderr, "host1x_queue_create() failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		workers[i].syncpt = client->syncpts[0].id;
+		workers[i].recorder = host1x_recorder_create(queue, client, 4,
+							     16 * 4096);
+		if (!workers[i].recorder) {
+			fprintf(stderr, "host1x_recorder_create() failed\n");
+			return 1;
+		}
+	}
+
+	err = client->read_syncpt(client, client->syncpts[0].id, &before);
+	if (err < 0) {
+		fprintf(stderr, "failed to read syncpoint: %d\n", err);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NUM_THREADS; i++)
+		pthread_create(&workers[i].thread, NULL, worker_thread,
+			       &workers[i]);
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		pthread_join(workers[i].thread, NULL);
+
+		if (workers[i].err < 0) {
+			fprintf(stderr, "thread %u failed: %d\n", i,
+				workers[i].err);
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	err = client->read_syncpt(client, client->syncpts[0].id, &after);
+	if (err < 0) {
+		fprintf(stderr, "failed to read syncpoint: %d\n", err);
+		return 1;
+	}
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		  (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	printf("%u threads, %u jobs in %.3f s, %.3f us/job\n", NUM_THREADS,
+	       NUM_THREADS * NUM_JOBS, elapsed,
+	       elapsed * 1000000 / (NUM_THREADS * NUM_JOBS));
+
+	for (i = 0; i < NUM_THREADS; i++)
+		host1x_recorder_free(workers[i].recorder);
+
+	host1x_queue_free(queue);
+	host1x_close(host1x);
+
+	if (after - before != NUM_THREADS * NUM_JOBS * NUM_INCRS) {
+		fprintf(stderr, "syncpoint advanced by %u, expected %u\n",
+			after - before, NUM_THREADS * NUM_JOBS * NUM_INCRS);
+		return 1;
+	}
+
+	return 0;
+}
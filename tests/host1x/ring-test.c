@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Exercises the command ring against a fake channel that only executes jobs
+ * once somebody waits for them. Every job records a checksum of its command
+ * buffers at submission and verifies it at execution, so any region that is
+ * reused while still in flight is detected. Two jobs are built in the ring
+ * at the same time, so that submitting one of them must not release or trim
+ * the regions of the other.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host1x.h"
+#include "common.h"
+
+#define NUM_FRAMES 2000
+#define MAX_JOBS 256
+
+struct ring_job {
+	uint32_t fence;
+	uint32_t checksum;
+	const uint32_t *words[16];
+	unsigned long lengths[16];
+	unsigned int num_cmdbufs;
+};
+
+/* a fake client that only executes jobs once they are waited for */
+struct ring_client {
+	struct fake_client fake;
+
+	struct ring_job jobs[MAX_JOBS];
+	unsigned int first, num_jobs, max_jobs;
+	unsigned int errors;
+};
+
+static struct ring_client *to_ring_client(struct host1x_client *client)
+{
+	return container_of(to_fake_client(client), struct ring_client, fake);
+}
+
+static uint32_t ring_checksum(struct ring_job *job)
+{
+	uint32_t checksum = 2166136261u;
+	unsigned long i;
+	unsigned int j;
+
+	for (j = 0; j < job->num_cmdbufs; j++)
+		for (i = 0; i < job->lengths[j]; i++)
+			checksum = (checksum ^ job->words[j][i]) * 16777619u;
+
+	return checksum;
+}
+
+static int ring_submit(struct host1x_client *client, struct host1x_job *job)
+{
+	struct ring_client *ring = to_ring_client(client);
+	struct ring_job *rj;
+	unsigned int i;
+
+	if (ring->num_jobs == MAX_JOBS || job->num_pushbufs > 16)
+		return -ENOSPC;
+
+	rj = &ring->jobs[(ring->first + ring->num_jobs++) % MAX_JOBS];
+	rj->num_cmdbufs = job->num_pushbufs;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		struct host1x_pushbuf *pb = job->pushbufs[i];
+
+		rj->words[i] = pb->bo->ptr + pb->offset;
+		rj->lengths[i] = pb->length;
+	}
+
+	fake_client_submit(client, job);
+	rj->fence = ring->fake.submitted;
+	rj->checksum = ring_checksum(rj);
+
+	if (ring->num_jobs > ring->max_jobs)
+		ring->max_jobs = ring->num_jobs;
+
+	return 0;
+}
+
+static int ring_wait(struct host1x_client *client, uint32_t syncpt,
+		     uint32_t fence, uint32_t timeout)
+{
+	struct ring_client *ring = to_ring_client(client);
+	struct ring_job *rj;
+
+	if (syncpt != client->syncpts[0].id)
+		return -EINVAL;
+
+	while (ring->num_jobs > 0 &&
+	       (int32_t)(fence - ring->fake.completed) > 0) {
+		rj = &ring->jobs[ring->first];
+
+		if (ring_checksum(rj) != rj->checksum)
+			ring->errors++;
+
+		ring->fake.completed = rj->fence;
+		ring->first = (ring->first + 1) % MAX_JOBS;
+		ring->num_jobs--;
+	}
+
+	return 0;
+}
+
+/* pushes a register write with the given number of random words */
+static int emit_words(struct host1x_pushbuf *pb, unsigned int words)
+{
+	unsigned int i;
+	int err;
+
+	err = host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x100, words));
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < words; i++) {
+		err = host1x_pushbuf_push(pb, rand());
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/* mostly small jobs, some spanning several regions */
+static unsigned int random_words(unsigned int frame)
+{
+	return 1 + rand() % (frame % 16 ? 256 : 12288);
+}
+
+static int submit(struct ring_client *client, struct host1x_job *job,
+		  struct host1x_pushbuf *pb)
+{
+	struct host1x_fence fence;
+	int err;
+
+	err = host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x000,
+						client->fake.syncpt.id));
+	if (err < 0)
+		return err;
+
+	return host1x_client_submit_async(&client->fake.base, job, &fence);
+}
+
+int main(int argc, char *argv[])
+{
+	struct host1x host1x = { .bo_create = fake_bo_create };
+	struct host1x_pushbuf *pbs[2];
+	struct host1x_job *jobs[2];
+	struct ring_client client;
+	struct host1x_ring *ring;
+	unsigned int i, j;
+	int err;
+
+	memset(&client, 0, sizeof(client));
+	fake_client_init(&client.fake, 3);
+	client.fake.base.submit = ring_submit;
+	client.fake.base.wait = ring_wait;
+	host1x_bo_cache_init(&host1x.bo_cache);
+
+	ring = host1x_ring_create(&host1x, 4, 4 * 4096);
+	if (!ring) {
+		fprintf(stderr, "host1x_ring_create() failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		jobs[i] = host1x_job_create(client.fake.syncpt.id);
+		if (!jobs[i]) {
+			fprintf(stderr, "host1x_job_create() failed\n");
+			return 1;
+		}
+	}
+
+	srand(1);
+
+	for (i = 0; i < NUM_FRAMES; i++) {
+		for (j = 0; j < 2; j++) {
+			host1x_job_reset(jobs[j]);
+
+			pbs[j] = host1x_job_append_ring(jobs[j], ring);
+			if (!pbs[j]) {
+				fprintf(stderr,
+					"host1x_job_append_ring() failed\n");
+				return 1;
+			}
+
+			err = emit_words(pbs[j], random_words(i));
+			if (err < 0) {
+				fprintf(stderr, "emit_words() failed: %d\n",
+					err);
+				return 1;
+			}
+		}
+
+		/* the second job stays open while the first is submitted */
+		err = submit(&client, jobs[0], pbs[0]);
+		if (err < 0) {
+			fprintf(stderr, "submit() failed: %d\n", err);
+			return 1;
+		}
+
+		err = emit_words(pbs[1], random_words(i));
+		if (err < 0) {
+			fprintf(stderr, "emit_words() failed: %d\n", err);
+			return 1;
+		}
+
+		err = submit(&client, jobs[1], pbs[1]);
+		if (err < 0) {
+			fprintf(stderr, "submit() failed: %d\n", err);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < 2; i++)
+		host1x_job_free(jobs[i]);
+
+	host1x_ring_free(ring);
+	host1x_bo_cache_exit(&host1x.bo_cache);
+
+	printf("%u jobs, up to %u in flight, %u corrupted\n", 2 * NUM_FRAMES,
+	       client.max_jobs, client.errors);
+
+	/* each job increments the syncpoint once */
+	if (client.errors > 0 || client.fake.submitted != 2 * NUM_FRAMES ||
+	    client.fake.completed != client.fake.submitted)
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Writes gr3d registers through the shadow and checks that only the writes
+ * which change something end up in the command stream.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host1x.h"
+#include "../../src/libhost1x/host1x-private.h"
+
+static unsigned int errors;
+
+static void expect(struct host1x_pushbuf *pb, unsigned long *length,
+		   unsigned long words, const char *what)
+{
+	unsigned long emitted = pb->length - *length;
+
+	if (emitted != words) {
+		fprintf(stderr, "%s: %lu words, expected %lu\n", what, emitted,
+			words);
+		errors++;
+	}
+
+	*length = pb->length;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t state[4] = { 0x3f800000, 0, 0, 0x3f800000 };
+	struct host1x_shadow_stats stats;
+	struct host1x_shadow *shadow;
+	struct host1x_pushbuf *pb;
+	struct host1x_gr3d *gr3d;
+	unsigned long generation;
+	uint32_t uniforms[16];
+	struct host1x *host1x;
+	unsigned long length;
+	unsigned int i;
+	int err;
+
+	setenv("HOST1X_BACKEND", "soft", 1);
+
+	host1x = host1x_open();
+	if (!host1x) {
+		fprintf(stderr, "host1x_open() failed\n");
+		return 1;
+	}
+
+	gr3d = host1x_get_gr3d(host1x);
+	shadow = host1x_client_get_shadow(gr3d->client);
+
+	pb = host1x_batch_begin(gr3d->batch);
+	if (!pb) {
+		fprintf(stderr, "host1x_batch_begin() failed\n");
+		return 1;
+	}
+
+	length = pb->length;
+
+	host1x_shadow_write(shadow, pb, 0x343, 0xb8e00000);
+	expect(pb, &length, 2, "first write");
+
+	host1x_shadow_write(shadow, pb, 0x343, 0xb8e00000);
+	expect(pb, &length, 0, "same value");
+
+	host1x_shadow_write(shadow, pb, 0x903, 0x2);
+	expect(pb, &length, 1, "immediate");
+
+	host1x_shadow_write_incr(shadow, pb, 0x348, state, 4);
+	expect(pb, &length, 5, "first block");
+
+	host1x_shadow_write_incr(shadow, pb, 0x348, state, 4);
+	expect(pb, &length, 0, "same block");
+
+	/* the unchanged register in between is cheaper to rewrite */
+	state[0] = 0x3f000000;
+	state[2] = 0x3f000000;
+	host1x_shadow_write_incr(shadow, pb, 0x348, state, 4);
+	expect(pb, &length, 4, "merged runs");
+
+	for (i = 0; i < 16; i++)
+		uniforms[i] = i;
+
+	host1x_shadow_upload(shadow, pb, 0x208, 0, uniforms, 16);
+	expect(pb, &length, 3 + 16, "first upload");
+
+	host1x_shadow_upload(shadow, pb, 0x208, 0, uniforms, 16);
+	expect(pb, &length, 0, "same upload");
+
+	uniforms[5] = 0x3f800000;
+	host1x_shadow_upload(shadow, pb, 0x208, 0, uniforms, 16);
+	expect(pb, &length, 3 + 4, "one vec4");
+
+	/* raw writes make the shadow forget the register */
+	uniforms[0] = HOST1X_OPCODE_IMM(0x903, 0x2);
+	host1x_shadow_emit(shadow, pb, uniforms, 1);
+	expect(pb, &length, 1, "raw write");
+
+	host1x_shadow_write(shadow, pb, 0x903, 0x2);
+	expect(pb, &length, 1, "after raw write");
+
+	generation = host1x_shadow_get_generation(shadow);
+	host1x_shadow_invalidate(shadow);
+
+	if (host1x_shadow_get_generation(shadow) == generation) {
+		fprintf(stderr, "generation unchanged by invalidation\n");
+		errors++;
+	}
+
+	host1x_shadow_write(shadow, pb, 0x343, 0xb8e00000);
+	expect(pb, &length, 2, "after invalidation");
+
+	host1x_shadow_get_stats(shadow, &stats);
+	printf("%lu words written, %lu writes elided\n", stats.written,
+	       stats.elided);
+
+	err = host1x_batch_end(gr3d->batch);
+	if (err == 0)
+		err = host1x_batch_flush(gr3d->batch, NULL);
+
+	if (err < 0) {
+		fprintf(stderr, "failed to submit: %d\n", err);
+		errors++;
+	}
+
+	host1x_close(host1x);
+
+	printf("%u errors\n", errors);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Runs gr2d fills and copies on the software backend and checks the pixels
+ * that they produce, as well as gr3d jobs that wait for gr2d in the command
+ * stream and jobs that span several command buffers.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host1x.h"
+#include "../../src/libhost1x/host1x-private.h"
+
+#define WIDTH 64
+#define HEIGHT 64
+
+/* framebuffers use 16x16 byte tiles */
+static uint32_t get_pixel(struct host1x_framebuffer *fb, unsigned int x,
+			  unsigned int y)
+{
+	unsigned int tile = (y / 16) * (fb->pitch / 16) + (x * 4) / 16;
+	uint32_t *ptr = fb->bo->ptr + tile * 256 + (y % 16) * 16 + (x * 4) % 16;
+
+	return *ptr;
+}
+
+static unsigned int check_rect(struct host1x_framebuffer *fb, unsigned int x,
+			       unsigned int y, unsigned int width,
+			       unsigned int height, uint32_t inside,
+			       uint32_t outside)
+{
+	unsigned int i, j, errors = 0;
+
+	for (j = 0; j < fb->height; j++) {
+		for (i = 0; i < fb->width; i++) {
+			bool in = i >= x && i < x + width &&
+				  j >= y && j < y + height;
+			uint32_t expected = in ? inside : outside;
+			uint32_t pixel = get_pixel(fb, i, j);
+
+			if (pixel != expected) {
+				if (errors++ < 8)
+					fprintf(stderr, "pixel %u,%u: %08x, expected %08x\n",
+						i, j, pixel, expected);
+			}
+		}
+	}
+
+	return errors;
+}
+
+/*
+ * Waits for fences that have passed are dropped, other waits end up in the
+ * command stream, where the software backend fails jobs that would wait for
+ * a fence that is never reached.
+ */
+static unsigned int check_waits(struct host1x *host1x,
+				struct host1x_fence *fence)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(host1x);
+	struct host1x_batch *batch = gr3d->batch;
+	struct host1x_fence pending = *fence;
+	unsigned int errors = 0;
+	int err;
+
+	err = host1x_batch_wait(batch, fence);
+	if (err < 0 || (batch->pb && batch->job->num_waitchks > 0)) {
+		fprintf(stderr, "wait for signaled fence was not dropped\n");
+		errors++;
+	}
+
+	/* far beyond anything that gr2d has been asked to do */
+	pending.value += 1000;
+
+	err = host1x_batch_wait(batch, &pending);
+	if (err < 0 || batch->job->num_waitchks != 1) {
+		fprintf(stderr, "wait for pending fence was not recorded\n");
+		errors++;
+	}
+
+	err = host1x_batch_end(batch);
+	if (err == 0)
+		err = host1x_batch_flush(batch, NULL);
+
+	if (err != -EDEADLK) {
+		fprintf(stderr, "wait for pending fence returned %d\n", err);
+		errors++;
+	}
+
+	return errors;
+}
+
+/*
+ * Pushes enough opcodes to fill several segments. None of them may be split
+ * from its payload, which the software backend would reject.
+ */
+static unsigned int check_segments(struct host1x *host1x)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(host1x);
+	struct host1x_batch *batch = gr3d->batch;
+	struct host1x_pushbuf *pb;
+	unsigned int errors = 0;
+	unsigned int i, j;
+	int err = 0;
+
+	pb = host1x_batch_begin(batch);
+	if (!pb)
+		return 1;
+
+	for (i = 0; i < 1000 && err == 0; i++) {
+		err = host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x100, 6));
+
+		for (j = 0; j < 6 && err == 0; j++)
+			err = host1x_pushbuf_push(pb, i);
+	}
+
+	if (err < 0 || batch->job->num_pushbufs < 2) {
+		fprintf(stderr, "failed to fill segments: %d\n", err);
+		errors++;
+	}
+
+	err = host1x_batch_end(batch);
+	if (err == 0)
+		err = host1x_batch_flush(batch, NULL);
+
+	if (err < 0) {
+		fprintf(stderr, "job with several segments failed: %d\n", err);
+		errors++;
+	}
+
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	struct host1x_framebuffer *src, *dst;
+	struct host1x_fence fences[2];
+	struct host1x_gr2d *gr2d;
+	struct host1x *host1x;
+	unsigned int errors;
+	int err;
+
+	setenv("HOST1X_BACKEND", "soft", 1);
+
+	host1x = host1x_open();
+	if (!host1x) {
+		fprintf(stderr, "host1x_open() failed\n");
+		return 1;
+	}
+
+	gr2d = host1x_get_gr2d(host1x);
+
+	src = host1x_framebuffer_create(host1x, WIDTH, HEIGHT, 32, 0);
+	dst = host1x_framebuffer_create(host1x, WIDTH, HEIGHT, 32, 0);
+	if (!src || !dst) {
+		fprintf(stderr, "host1x_framebuffer_create() failed\n");
+		return 1;
+	}
+
+	err = host1x_gr2d_clear(gr2d, src, 1.0f, 0.0f, 0.0f, 1.0f, &fences[0]);
+	if (err < 0) {
+		fprintf(stderr, "host1x_gr2d_clear() failed: %d\n", err);
+		return 1;
+	}
+
+	err = host1x_gr2d_clear(gr2d, dst, 0.0f, 0.0f, 1.0f, 1.0f, &fences[1]);
+	if (err < 0) {
+		fprintf(stderr, "host1x_gr2d_clear() failed: %d\n", err);
+		return 1;
+	}
+
+	err = host1x_fence_wait_all(fences, 2, 0);
+	if (err < 0) {
+		fprintf(stderr, "host1x_fence_wait_all() failed: %d\n", err);
+		return 1;
+	}
+
+	errors = check_rect(src, 0, 0, WIDTH, HEIGHT, 0xff0000ff, 0);
+
+	err = host1x_gr2d_blit(gr2d, src, dst, 5, 3, 17, 29, 20, 10, NULL);
+	if (err < 0) {
+		fprintf(stderr, "host1x_gr2d_blit() failed: %d\n", err);
+		return 1;
+	}
+
+	errors += check_rect(dst, 17, 29, 20, 10, 0xff0000ff, 0xffff0000);
+	errors += check_segments(host1x);
+	errors += check_waits(host1x, &fences[1]);
+
+	host1x_framebuffer_free(dst);
+	host1x_framebuffer_free(src);
+	host1x_close(host1x);
+
+	printf("%u errors\n", errors);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Records a template at one offset of a push buffer, stamps it out at another
+ * one with different patches and relocation targets, and checks that the
+ * result is the same as building the stream directly with those values.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host1x.h"
+#include "../../src/libhost1x/host1x-private.h"
+
+#define NUM_PATCHES 5
+#define NUM_TARGETS 2
+
+static unsigned int errors;
+
+static int emit_prefix(struct host1x_pushbuf *pb, uint32_t syncpt,
+		       unsigned int words)
+{
+	unsigned int i;
+	int err;
+
+	err = host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x200, words));
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < words; i++) {
+		err = host1x_pushbuf_push(pb, 0x10000 + i);
+		if (err < 0)
+			return err;
+	}
+
+	/* increments before the template must not be counted for it */
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x1));
+
+	return host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt);
+}
+
+/*
+ * Builds the stream that the template is recorded from, or the one that it
+ * is compared against if no template is passed. Slot 3 is left unused.
+ */
+static int emit_body(struct host1x_pushbuf *pb, struct host1x_template *tmpl,
+		     uint32_t syncpt, const uint32_t *patches,
+		     const struct host1x_template_target *targets)
+{
+	/* patch slots of the MASK payload, the second word is fixed */
+	static const int slots[4] = { 2, -1, 0, 4 };
+	unsigned int i;
+	int err;
+
+	if (tmpl)
+		host1x_template_begin(tmpl, pb);
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x1));
+	host1x_pushbuf_push(pb, 0x000002 << 8 | syncpt);
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x352, 0x1b));
+
+	for (i = 0; i < 4; i++) {
+		if (slots[i] < 0) {
+			host1x_pushbuf_push(pb, 0x3f800000);
+			continue;
+		}
+
+		if (tmpl) {
+			err = host1x_template_patch(tmpl, pb, slots[i]);
+			if (err < 0)
+				return err;
+		}
+
+		host1x_pushbuf_push(pb, patches[slots[i]]);
+	}
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe01, 0x01));
+	host1x_pushbuf_relocate(pb, targets[0].bo, targets[0].offset, 0);
+	host1x_pushbuf_push(pb, 0xdeadbeef);
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x121, 0x03));
+	host1x_pushbuf_relocate(pb, targets[1].bo, targets[1].offset, 8);
+	host1x_pushbuf_push(pb, 0xdeadbeef);
+
+	if (tmpl) {
+		err = host1x_template_patch(tmpl, pb, 1);
+		if (err < 0)
+			return err;
+	}
+
+	host1x_pushbuf_push(pb, patches[1]);
+	host1x_pushbuf_push(pb, 0x00c0ffee);
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x01));
+	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt);
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 0x01));
+	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt);
+
+	if (tmpl)
+		return host1x_template_end(tmpl, pb);
+
+	return 0;
+}
+
+static struct host1x_job *job_create(struct host1x *host1x, uint32_t syncpt,
+				     struct host1x_bo **bop,
+				     struct host1x_pushbuf **pbp)
+{
+	struct host1x_job *job;
+	struct host1x_bo *bo;
+
+	bo = host1x_bo_create(host1x, 4096, 2);
+	if (!bo)
+		return NULL;
+
+	if (host1x_bo_mmap(bo, NULL) < 0) {
+		host1x_bo_free(bo);
+		return NULL;
+	}
+
+	job = host1x_job_create(syncpt);
+	if (!job) {
+		host1x_bo_free(bo);
+		return NULL;
+	}
+
+	*pbp = host1x_job_append(job, bo, 0);
+	if (!*pbp) {
+		host1x_job_free(job);
+		host1x_bo_free(bo);
+		return NULL;
+	}
+
+	*bop = bo;
+
+	return job;
+}
+
+static void compare(struct host1x_pushbuf *pb, struct host1x_pushbuf *ref,
+		    struct host1x_bo *bo, struct host1x_bo *ref_bo)
+{
+	uint32_t *words = bo->ptr, *expected = ref_bo->ptr;
+	unsigned long i;
+
+	if (pb->length != ref->length) {
+		fprintf(stderr, "%lu words, expected %lu\n", pb->length,
+			ref->length);
+		errors++;
+		return;
+	}
+
+	for (i = 0; i < pb->length; i++) {
+		if (words[i] != expected[i]) {
+			fprintf(stderr, "word %lu: %08x, expected %08x\n", i,
+				words[i], expected[i]);
+			errors++;
+		}
+	}
+
+	if (pb->num_relocs != ref->num_relocs) {
+		fprintf(stderr, "%lu relocations, expected %lu\n",
+			pb->num_relocs, ref->num_relocs);
+		errors++;
+		return;
+	}
+
+	for (i = 0; i < pb->num_relocs; i++) {
+		struct host1x_pushbuf_reloc *reloc = &pb->relocs[i];
+		struct host1x_pushbuf_reloc *want = &ref->relocs[i];
+
+		if (reloc->source_offset != want->source_offset ||
+		    reloc->target != want->target ||
+		    reloc->target_offset != want->target_offset ||
+		    reloc->shift != want->shift) {
+			fprintf(stderr, "relocation %lu: %lx -> %p+%lx<<%lu, "
+				"expected %lx -> %p+%lx<<%lu\n", i,
+				reloc->source_offset, reloc->target,
+				reloc->target_offset, reloc->shift,
+				want->source_offset, want->target,
+				want->target_offset, want->shift);
+			errors++;
+		}
+	}
+
+	if (pb->job->syncpt_incrs != ref->job->syncpt_incrs) {
+		fprintf(stderr, "%u syncpoint increments, expected %u\n",
+			pb->job->syncpt_incrs, ref->job->syncpt_incrs);
+		errors++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t recorded[NUM_PATCHES] = { 1, 2, 3, 4, 5 };
+	uint32_t patches[NUM_PATCHES] = { 0xa0, 0xa1, 0xa2, 0xa3, 0xa4 };
+	struct host1x_template_target original[NUM_TARGETS];
+	struct host1x_template_target targets[NUM_TARGETS];
+	struct host1x_bo *bos[3], *buffers[4];
+	struct host1x_pushbuf *pbs[3];
+	struct host1x_job *jobs[3];
+	struct host1x_template *tmpl;
+	struct host1x_gr3d *gr3d;
+	struct host1x *host1x;
+	unsigned int i;
+	uint32_t syncpt;
+	int err;
+
+	setenv("HOST1X_BACKEND", "soft", 1);
+
+	host1x = host1x_open();
+	if (!host1x) {
+		fprintf(stderr, "host1x_open() failed\n");
+		return 1;
+	}
+
+	gr3d = host1x_get_gr3d(host1x);
+	syncpt = gr3d->client->syncpts[0].id;
+
+	for (i = 0; i < 4; i++) {
+		buffers[i] = host1x_bo_create(host1x, 4096, 2);
+		if (!buffers[i]) {
+			fprintf(stderr, "host1x_bo_create() failed\n");
+			return 1;
+		}
+	}
+
+	original[0].bo = buffers[0];
+	original[0].offset = 0x10;
+	original[1].bo = buffers[1];
+	original[1].offset = 0x20;
+	targets[0].bo = buffers[2];
+	targets[0].offset = 0x30;
+	targets[1].bo = buffers[3];
+	targets[1].offset = 0x40;
+
+	/* recorded, stamped out and built directly */
+	for (i = 0; i < 3; i++) {
+		jobs[i] = job_create(host1x, syncpt, &bos[i], &pbs[i]);
+		if (!jobs[i]) {
+			fprintf(stderr, "failed to create job\n");
+			return 1;
+		}
+	}
+
+	tmpl = host1x_template_create();
+	if (!tmpl) {
+		fprintf(stderr, "host1x_template_create() failed\n");
+		return 1;
+	}
+
+	/* record at a different offset than where the template is stamped */
+	emit_prefix(pbs[0], syncpt, 7);
+
+	err = emit_body(pbs[0], tmpl, syncpt, recorded, original);
+	if (err < 0 || !host1x_template_is_valid(tmpl)) {
+		fprintf(stderr, "failed to record template: %d\n", err);
+		return 1;
+	}
+
+	/* stamp twice, to check that each copy is relocated on its own */
+	emit_prefix(pbs[1], syncpt, 2);
+	emit_prefix(pbs[2], syncpt, 2);
+
+	for (i = 0; i < 2; i++) {
+		err = host1x_pushbuf_stamp(pbs[1], tmpl, patches, targets);
+		if (err < 0) {
+			fprintf(stderr, "host1x_pushbuf_stamp() failed: %d\n",
+				err);
+			return 1;
+		}
+
+		emit_body(pbs[2], NULL, syncpt, patches, targets);
+	}
+
+	compare(pbs[1], pbs[2], bos[1], bos[2]);
+
+	/* one from the prefix and three from each copy of the template */
+	if (jobs[1]->syncpt_incrs != 1 + 2 * 3) {
+		fprintf(stderr, "%u syncpoint increments, expected %u\n",
+			jobs[1]->syncpt_incrs, 1 + 2 * 3);
+		errors++;
+	}
+
+	host1x_template_free(tmpl);
+
+	for (i = 0; i < 3; i++) {
+		host1x_job_free(jobs[i]);
+		host1x_bo_free(bos[i]);
+	}
+
+	for (i = 0; i < 4; i++)
+		host1x_bo_free(buffers[i]);
+
+	host1x_close(host1x);
+
+	printf("%u errors\n", errors);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,640 @@
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "host1x.h"
+#include "../src/libhost1x/host1x-private.h"
+
+struct opts {
+	unsigned int loops;
+	bool fast;
+	bool help;
+};
+
+struct blob {
+	uint64_t hash;
+	const void *data;
+	size_t size;
+};
+
+struct replay_bo {
+	struct host1x_bo *bo;
+	void *ptr;
+	size_t size;
+
+	/* contents currently in the buffer object */
+	uint64_t hash;
+	bool loaded;
+
+	struct host1x_fence fence;
+};
+
+struct replay_client {
+	struct host1x_client *client;
+	uint32_t class;
+	uint32_t syncpt;
+	struct host1x_job *job;
+	struct host1x_fence fence;
+};
+
+struct replay {
+	struct host1x *host1x;
+	struct host1x_ring *ring;
+	bool fast;
+
+	struct blob *blobs;
+	unsigned long max_blobs;
+
+	struct replay_bo *bos;
+	unsigned long num_bos;
+
+	struct replay_client clients[4];
+	unsigned int num_clients;
+
+	unsigned long submits;
+	unsigned long mismatches;
+};
+
+static void usage(FILE *fp, const char *program)
+{
+	fprintf(fp, "usage: %s [options] FILE\n", program);
+	fprintf(fp, "\n");
+	fprintf(fp, "options:\n");
+	fprintf(fp, "  -f, --fast       only upload the initial buffer contents\n");
+	fprintf(fp, "  -h, --help       display this help screen\n");
+	fprintf(fp, "  -n, --loops N    replay the capture N times\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "The backend can be selected with HOST1X_BACKEND.\n");
+}
+
+static int parse_command_line(struct opts *opts, int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{ "fast", 0, NULL, 'f' },
+		{ "help", 0, NULL, 'h' },
+		{ "loops", 1, NULL, 'n' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+
+	memset(opts, 0, sizeof(*opts));
+	opts->loops = 1;
+
+	while ((opt = getopt_long(argc, argv, "fhn:", options, NULL)) != -1) {
+		switch (opt) {
+		case 'f':
+			opts->fast = true;
+			break;
+
+		case 'h':
+			opts->help = true;
+			break;
+
+		case 'n':
+			opts->loops = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			fprintf(stderr, "invalid option '%c'\n", opt);
+			return -1;
+		}
+	}
+
+	return optind;
+}
+
+static void *load_file(const char *path, size_t *sizep)
+{
+	size_t size = 0, max = 0, num;
+	void *data = NULL, *tmp;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+
+	do {
+		if (size == max) {
+			max = max ? max * 2 : 1024 * 1024;
+
+			tmp = realloc(data, max);
+			if (!tmp) {
+				free(data);
+				fclose(fp);
+				return NULL;
+			}
+
+			data = tmp;
+		}
+
+		num = fread(data + size, 1, max - size, fp);
+		size += num;
+	} while (num > 0);
+
+	fclose(fp);
+
+	*sizep = size;
+	return data;
+}
+
+static struct blob *blob_lookup(struct replay *replay, uint64_t hash)
+{
+	unsigned long i = hash & (replay->max_blobs - 1);
+
+	while (replay->blobs[i].data && replay->blobs[i].hash != hash)
+		i = (i + 1) & (replay->max_blobs - 1);
+
+	return &replay->blobs[i];
+}
+
+/* collects the blobs of the capture in a hash table */
+static int index_blobs(struct replay *replay, const void *data, size_t size)
+{
+	const void *ptr = data + sizeof(struct host1x_capture_header);
+	unsigned long num_blobs = 0;
+
+	while (ptr + sizeof(struct host1x_capture_record) <= data + size) {
+		const struct host1x_capture_record *record = ptr;
+
+		ptr += sizeof(*record);
+
+		if (record->size > data + size - ptr) {
+			fprintf(stderr, "capture is truncated\n");
+			return -EINVAL;
+		}
+
+		if (record->type == HOST1X_CAPTURE_BLOB)
+			num_blobs++;
+
+		ptr += record->size;
+	}
+
+	replay->max_blobs = 16;
+
+	while (replay->max_blobs < num_blobs * 2)
+		replay->max_blobs *= 2;
+
+	replay->blobs = calloc(replay->max_blobs, sizeof(*replay->blobs));
+	if (!replay->blobs)
+		return -ENOMEM;
+
+	ptr = data + sizeof(struct host1x_capture_header);
+
+	while (ptr + sizeof(struct host1x_capture_record) <= data + size) {
+		const struct host1x_capture_record *record = ptr;
+		const struct host1x_capture_blob *header = ptr + sizeof(*record);
+		struct blob *blob;
+
+		if (record->type == HOST1X_CAPTURE_BLOB) {
+			blob = blob_lookup(replay, header->hash);
+			blob->hash = header->hash;
+			blob->data = header + 1;
+			blob->size = record->size - sizeof(*header);
+		}
+
+		ptr += sizeof(*record) + record->size;
+	}
+
+	return 0;
+}
+
+static struct replay_client *get_client(struct replay *replay, uint32_t class)
+{
+	struct replay_client *client;
+	unsigned int i;
+
+	for (i = 0; i < replay->num_clients; i++)
+		if (replay->clients[i].class == class)
+			return &replay->clients[i];
+
+	if (replay->num_clients == sizeof(replay->clients) /
+				   sizeof(replay->clients[0]))
+		return NULL;
+
+	client = &replay->clients[replay->num_clients];
+
+	client->client = host1x_get_client(replay->host1x, class);
+	if (!client->client) {
+		fprintf(stderr, "no client for class %#x\n", class);
+		return NULL;
+	}
+
+	client->syncpt = client->client->syncpts[0].id;
+
+	client->job = host1x_job_create(client->syncpt);
+	if (!client->job)
+		return NULL;
+
+	client->class = class;
+	replay->num_clients++;
+
+	return client;
+}
+
+static int create_bo(struct replay *replay,
+		     const struct host1x_capture_bo *record)
+{
+	struct replay_bo *bo;
+	int err;
+
+	if (record->id >= replay->num_bos) {
+		unsigned long num = replay->num_bos ? replay->num_bos : 64;
+
+		while (num <= record->id)
+			num *= 2;
+
+		bo = realloc(replay->bos, num * sizeof(*bo));
+		if (!bo)
+			return -ENOMEM;
+
+		memset(bo + replay->num_bos, 0,
+		       (num - replay->num_bos) * sizeof(*bo));
+		replay->bos = bo;
+		replay->num_bos = num;
+	}
+
+	bo = &replay->bos[record->id];
+
+	/* buffer objects keep their contents from one loop to the next */
+	if (bo->bo)
+		return 0;
+
+	bo->bo = host1x_bo_create(replay->host1x, record->size,
+				  record->flags);
+	if (!bo->bo)
+		return -ENOMEM;
+
+	err = host1x_bo_mmap(bo->bo, &bo->ptr);
+	if (err < 0)
+		return err;
+
+	bo->size = record->size;
+
+	return 0;
+}
+
+static struct replay_bo *get_bo(struct replay *replay, uint32_t id)
+{
+	if (id >= replay->num_bos || !replay->bos[id].bo)
+		return NULL;
+
+	return &replay->bos[id];
+}
+
+/* uploads the captured contents of a buffer object if they differ */
+static int load_bo(struct replay *replay, struct replay_bo *bo, uint64_t hash)
+{
+	struct blob *blob;
+	int err;
+
+	if (bo->loaded && (bo->hash == hash || replay->fast))
+		return 0;
+
+	blob = blob_lookup(replay, hash);
+	if (!blob->data || blob->size != bo->size)
+		return -EINVAL;
+
+	/* don't modify the buffer while the hardware may still use it */
+	err = host1x_fence_wait(&bo->fence, -1);
+	if (err < 0)
+		return err;
+
+	memcpy(bo->ptr, blob->data, blob->size);
+	host1x_bo_mark_dirty(bo->bo, 0, blob->size);
+
+	bo->hash = hash;
+	bo->loaded = true;
+
+	return 0;
+}
+
+/*
+ * The syncpoints used during the capture are not necessarily the same as
+ * those of the replay clients, so increments are redirected on the fly.
+ * This keeps track of the register that each word is written to.
+ */
+struct remap {
+	uint32_t from;
+	uint32_t to;
+
+	unsigned int opcode;
+	uint32_t offset;
+	uint32_t mask;
+	uint32_t count;
+};
+
+static uint32_t remap_syncpt(struct remap *remap, uint32_t word)
+{
+	uint32_t offset;
+	unsigned int i;
+
+	if (remap->count > 0 || remap->mask != 0) {
+		switch (remap->opcode) {
+		case 0x0: /* SETCL */
+		case 0x3: /* MASK */
+			i = ffs(remap->mask) - 1;
+			remap->mask &= remap->mask - 1;
+			offset = remap->offset + i;
+			break;
+
+		case 0x1: /* INCR */
+			offset = remap->offset++;
+			remap->count--;
+			break;
+
+		case 0x2: /* NONINCR */
+			offset = remap->offset;
+			remap->count--;
+			break;
+
+		default: /* GATHER address */
+			remap->count = 0;
+			return word;
+		}
+
+		if (offset == 0 && (word & 0xff) == remap->from)
+			word = (word & ~0xff) | remap->to;
+
+		return word;
+	}
+
+	remap->opcode = word >> 28;
+	remap->offset = (word >> 16) & 0xfff;
+	remap->mask = 0;
+	remap->count = 0;
+
+	switch (remap->opcode) {
+	case 0x0: /* SETCL */
+		remap->mask = word & 0x3f;
+		break;
+
+	case 0x1: /* INCR */
+	case 0x2: /* NONINCR */
+		remap->count = word & 0xffff;
+		break;
+
+	case 0x3: /* MASK */
+		remap->mask = word & 0xffff;
+		break;
+
+	case 0x4: /* IMM */
+		if (remap->offset == 0 && (word & 0xff) == remap->from)
+			word = (word & ~0xff) | remap->to;
+
+		break;
+
+	case 0x6: /* GATHER */
+		remap->count = 1;
+		break;
+	}
+
+	return word;
+}
+
+static int replay_submit(struct replay *replay, const void *payload,
+			 size_t size)
+{
+	const struct host1x_capture_submit *submit = payload;
+	const struct host1x_capture_cmdbuf *cmdbufs;
+	const struct host1x_capture_reloc *relocs;
+	const struct host1x_capture_state *states;
+	const struct host1x_capture_reloc *reloc;
+	struct replay_client *client;
+	struct host1x_pushbuf *pb;
+	struct host1x_fence fence;
+	struct remap remap;
+	unsigned int i, j;
+	int err;
+
+	cmdbufs = (const void *)(submit + 1);
+	relocs = (const void *)(cmdbufs + submit->num_cmdbufs);
+	states = (const void *)(relocs + submit->num_relocs);
+
+	if ((const void *)(states + submit->num_bos) > payload + size)
+		return -EINVAL;
+
+	client = get_client(replay, submit->class);
+	if (!client)
+		return -ENODEV;
+
+	for (i = 0; i < submit->num_bos; i++) {
+		struct replay_bo *bo = get_bo(replay, states[i].id);
+
+		if (!bo)
+			return -EINVAL;
+
+		err = load_bo(replay, bo, states[i].hash);
+		if (err < 0)
+			return err;
+	}
+
+	host1x_job_reset(client->job);
+
+	pb = host1x_job_append_ring(client->job, replay->ring);
+	if (!pb)
+		return -ENOMEM;
+
+	memset(&remap, 0, sizeof(remap));
+	remap.from = submit->syncpt;
+	remap.to = client->syncpt;
+	reloc = relocs;
+
+	for (i = 0; i < submit->num_cmdbufs; i++) {
+		struct blob *blob = blob_lookup(replay, cmdbufs[i].hash);
+		const uint32_t *words = blob->data;
+
+		if (!words || blob->size != cmdbufs[i].words * 4)
+			return -EINVAL;
+
+		for (j = 0; j < cmdbufs[i].words; j++) {
+			/* relocations are recorded in command stream order */
+			if (reloc < relocs + submit->num_relocs &&
+			    reloc->cmdbuf == i && reloc->offset == j * 4) {
+				struct replay_bo *target;
+
+				target = get_bo(replay, reloc->target);
+				if (!target)
+					return -EINVAL;
+
+				err = host1x_pushbuf_relocate(pb, target->bo,
+							      reloc->target_offset,
+							      reloc->shift);
+				if (err < 0)
+					return err;
+
+				reloc++;
+			}
+
+			err = host1x_pushbuf_push(pb, remap_syncpt(&remap,
+								   words[j]));
+			if (err < 0)
+				return err;
+		}
+	}
+
+	if (reloc != relocs + submit->num_relocs) {
+		fprintf(stderr, "relocations out of order\n");
+		return -EINVAL;
+	}
+
+	if (client->job->syncpt_incrs != submit->syncpt_incrs)
+		replay->mismatches++;
+
+	err = host1x_client_submit_async(client->client, client->job, &fence);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < submit->num_bos; i++)
+		replay->bos[states[i].id].fence = fence;
+
+	client->fence = fence;
+	replay->submits++;
+
+	return 0;
+}
+
+static int replay_capture(struct replay *replay, const void *data,
+			  size_t size)
+{
+	const void *ptr = data + sizeof(struct host1x_capture_header);
+	unsigned int i;
+	int err = 0;
+
+	while (ptr + sizeof(struct host1x_capture_record) <= data + size) {
+		const struct host1x_capture_record *record = ptr;
+		const void *payload = ptr + sizeof(*record);
+
+		switch (record->type) {
+		case HOST1X_CAPTURE_BLOB:
+			break;
+
+		case HOST1X_CAPTURE_BO:
+			err = create_bo(replay, payload);
+			break;
+
+		case HOST1X_CAPTURE_SUBMIT:
+			err = replay_submit(replay, payload, record->size);
+			break;
+
+		default:
+			fprintf(stderr, "unknown record type %u\n",
+				record->type);
+			break;
+		}
+
+		if (err < 0)
+			return err;
+
+		ptr = payload + record->size;
+	}
+
+	for (i = 0; i < replay->num_clients; i++) {
+		err = host1x_fence_wait(&replay->clients[i].fence, -1);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct host1x_capture_header *header;
+	struct timespec start, end;
+	struct replay replay;
+	unsigned int i;
+	struct opts opts;
+	double elapsed;
+	size_t size;
+	void *data;
+	int err;
+
+	err = parse_command_line(&opts, argc, argv);
+	if (err < 0)
+		return 1;
+
+	if (opts.help || err >= argc) {
+		usage(opts.help ? stdout : stderr, argv[0]);
+		return opts.help ? 0 : 1;
+	}
+
+	data = load_file(argv[err], &size);
+	if (!data) {
+		fprintf(stderr, "failed to load %s\n", argv[err]);
+		return 1;
+	}
+
+	header = data;
+
+	if (size < sizeof(*header) || header->magic != HOST1X_CAPTURE_MAGIC ||
+	    header->version != HOST1X_CAPTURE_VERSION) {
+		fprintf(stderr, "%s is not a capture file\n", argv[err]);
+		return 1;
+	}
+
+	memset(&replay, 0, sizeof(replay));
+	replay.fast = opts.fast;
+
+	err = index_blobs(&replay, data, size);
+	if (err < 0)
+		return 1;
+
+	replay.host1x = host1x_open();
+	if (!replay.host1x) {
+		fprintf(stderr, "host1x_open() failed\n");
+		return 1;
+	}
+
+	replay.ring = host1x_ring_create(replay.host1x, 4, 32 * 4096);
+	if (!replay.ring) {
+		fprintf(stderr, "host1x_ring_create() failed\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < opts.loops; i++) {
+		err = replay_capture(&replay, data, size);
+		if (err < 0) {
+			fprintf(stderr, "replay failed: %d\n", err);
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		  (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	printf("%lu submits in %.3f s, %.3f us/submit\n", replay.submits,
+	       elapsed, replay.submits ? elapsed * 1000000 / replay.submits : 0);
+
+	if (replay.mismatches > 0)
+		printf("%lu submits with a different number of syncpoint increments\n",
+		       replay.mismatches);
+
+	for (i = 0; i < replay.num_clients; i++)
+		host1x_job_free(replay.clients[i].job);
+
+	for (i = 0; i < replay.num_bos; i++)
+		if (replay.bos[i].bo)
+			host1x_bo_free(replay.bos[i].bo);
+
+	host1x_ring_free(replay.ring);
+	host1x_close(replay.host1x);
+	free(replay.bos);
+	free(replay.blobs);
+	free(data);
+
+	return 0;
+}